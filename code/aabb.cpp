@@ -129,4 +129,12 @@ float aabb_distance_exterior_sq_point(AABB* aabb, Vector3 query_point)
         }
     }
     return dist_sq;
-}
\ No newline at end of file
+}
+
+float aabb_get_surface_area(const AABB* aabb)
+{
+    float dx = aabb->max_p.v[0] - aabb->min_p.v[0];
+    float dy = aabb->max_p.v[1] - aabb->min_p.v[1];
+    float dz = aabb->max_p.v[2] - aabb->min_p.v[2];
+    return 2.f * (dx * dy + dy * dz + dz * dx);
+}
@@ -19,5 +19,6 @@ int aabb_get_logest_axis_index(AABB* aabb); // 0 - X, 1 - Y, 2 - Z
 bool aabb_intersect_aabb(AABB* a, AABB* b);
 bool aabb_contain_point(AABB* aabb, Vector3 query_point);
 float aabb_distance_exterior_sq_point(AABB* aabb, Vector3 query_point);
+float aabb_get_surface_area(const AABB* aabb);
 
 #endif
\ No newline at end of file
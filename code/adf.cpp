@@ -0,0 +1,334 @@
+#include "adf.h"
+
+#include <math.h>
+#include <float.h>
+#include <stdint.h>
+#include <algorithm>
+
+#include "common.h"
+#include "sdf_grid.h"
+
+// a cell is tested on the 3x3x3 lattice of its corners, edge/face midpoints and center.
+// The 19 non-corner samples become the corners of the children when it subdivides.
+#define ADF_LATTICE_COUNT 27
+
+static inline int adf_lattice_index(int x, int y, int z)
+{
+    return (z * 3 + y) * 3 + x;
+}
+
+static inline float adf_trilinear(const float* corners, float tx, float ty, float tz)
+{
+    float c00 = corners[0] + (corners[1] - corners[0]) * tx;
+    float c10 = corners[2] + (corners[3] - corners[2]) * tx;
+    float c01 = corners[4] + (corners[5] - corners[4]) * tx;
+    float c11 = corners[6] + (corners[7] - corners[6]) * tx;
+
+    float c0 = c00 + (c10 - c00) * ty;
+    float c1 = c01 + (c11 - c01) * ty;
+
+    return c0 + (c1 - c0) * tz;
+}
+
+struct ADFSampleWork
+{
+    ObjData::Shape* shape;
+    const ADF* adf;
+    SignMethod sign_method;
+    float finest_size;
+    const uint64_t* keys;
+    float* sdfs;
+};
+
+// lattice points are keyed by their integer coordinate on the finest level, 21 bits per axis
+static inline uint64_t adf_sample_key(int x, int y, int z)
+{
+    return ((uint64_t)z << 42) | ((uint64_t)y << 21) | (uint64_t)x;
+}
+
+static void adf_sample_work(void* param, size_t begin, size_t end)
+{
+    ADFSampleWork& work = *(ADFSampleWork*)param;
+
+    // the keys are sorted, so the previous sample is close and its closest face bounds the next query
+    int seed_face_index = -1;
+
+    for (size_t ki = begin; ki < end; ++ki)
+    {
+        uint64_t key = work.keys[ki];
+        int x = (int)(key & 0x1fffff);
+        int y = (int)((key >> 21) & 0x1fffff);
+        int z = (int)(key >> 42);
+
+        Vector3 p = vector3_set3(work.adf->min_pos[0] + work.finest_size * x, work.adf->min_pos[1] + work.finest_size * y, work.adf->min_pos[2] + work.finest_size * z);
+        work.sdfs[ki] = signed_distance(work.shape, p, NULL, &seed_face_index, work.sign_method, seed_face_index);
+    }
+}
+
+// evaluates every key in parallel. keys must be unique.
+static void adf_evaluate_samples(const ADF* adf, ObjData::Shape* shape, SignMethod sign_method, const std::vector<uint64_t>& keys, std::vector<float>* out_sdfs, int thread_count)
+{
+    out_sdfs->resize(keys.size());
+
+    ADFSampleWork work;
+    work.shape = shape;
+    work.adf = adf;
+    work.sign_method = sign_method;
+    work.finest_size = adf->size / (float)(1 << adf->max_depth);
+    work.keys = keys.data();
+    work.sdfs = out_sdfs->data();
+    parallel_for(0, keys.size(), 256, thread_count, adf_sample_work, &work);
+}
+
+// cell being refined, coord is its min corner on the finest level
+struct ADFBuildCell
+{
+    int node;
+    int coord[3];
+};
+
+static inline bool adf_is_cell_outside(const ADF* adf, const ADFBuildCell& cell, float finest_size)
+{
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        if (adf->min_pos[axis] + finest_size * cell.coord[axis] >= adf->max_pos[axis])
+            return true;
+    }
+    return false;
+}
+
+void adf_build(ADF* adf, ObjData::Shape* shape, const float* min_pos, const float* max_pos, float min_cell_size, float tolerance, SignMethod sign_method, int thread_count)
+{
+    float size = max_pos[0] - min_pos[0];
+    for (int axis = 1; axis < 3; ++axis)
+    {
+        if (max_pos[axis] - min_pos[axis] > size)
+            size = max_pos[axis] - min_pos[axis];
+    }
+
+    int max_depth = 0;
+    while (size / (float)(1 << max_depth) > min_cell_size && max_depth < 20)
+    {
+        ++max_depth;
+    }
+
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        adf->min_pos[axis] = min_pos[axis];
+        adf->max_pos[axis] = max_pos[axis];
+    }
+    adf->size = size;
+    adf->tolerance = tolerance;
+    adf->max_depth = max_depth;
+    adf->nodes.clear();
+
+    ADFNode root;
+    root.children = -1;
+    for (int c = 0; c < 8; ++c)
+    {
+        Vector3 p = vector3_set3(min_pos[0] + size * (c & 1), min_pos[1] + size * ((c >> 1) & 1), min_pos[2] + size * ((c >> 2) & 1));
+        root.corners[c] = signed_distance(shape, p, NULL, NULL, sign_method);
+    }
+    adf->nodes.push_back(root);
+
+    // breadth-first. The new lattice points of a whole level are deduplicated, since the
+    // neighbouring cells share their faces, and evaluated in parallel. Then the level is split.
+    float finest_size = size / (float)(1 << max_depth);
+    ADFBuildCell root_cell = { 0, { 0, 0, 0 } };
+    std::vector<ADFBuildCell> cells(1, root_cell);
+    std::vector<ADFBuildCell> next_cells;
+    std::vector<uint64_t> keys;
+    std::vector<float> sdfs;
+
+    for (int depth = 0; depth < max_depth && cells.empty() == false; ++depth)
+    {
+        int half_step = 1 << (max_depth - depth - 1);
+
+        keys.clear();
+        for (size_t ci = 0; ci < cells.size(); ++ci)
+        {
+            const int* coord = cells[ci].coord;
+            for (int li = 0; li < ADF_LATTICE_COUNT; ++li)
+            {
+                int x = li % 3;
+                int y = (li / 3) % 3;
+                int z = li / 9;
+                if ((x & 1) == 0 && (y & 1) == 0 && (z & 1) == 0)
+                    continue;
+
+                keys.push_back(adf_sample_key(coord[0] + x * half_step, coord[1] + y * half_step, coord[2] + z * half_step));
+            }
+        }
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+        adf_evaluate_samples(adf, shape, sign_method, keys, &sdfs, thread_count);
+
+        next_cells.clear();
+        for (size_t ci = 0; ci < cells.size(); ++ci)
+        {
+            const ADFBuildCell& cell = cells[ci];
+            int node_index = cell.node;
+            const int* coord = cell.coord;
+            // the region of the root cube beyond max_pos is never sampled, keep it coarse
+            if (adf_is_cell_outside(adf, cell, finest_size))
+                continue;
+
+            float lattice[ADF_LATTICE_COUNT];
+            for (int li = 0; li < ADF_LATTICE_COUNT; ++li)
+            {
+                int x = li % 3;
+                int y = (li / 3) % 3;
+                int z = li / 9;
+                if ((x & 1) == 0 && (y & 1) == 0 && (z & 1) == 0)
+                {
+                    lattice[li] = adf->nodes[node_index].corners[(x >> 1) | ((y >> 1) << 1) | ((z >> 1) << 2)];
+                    continue;
+                }
+
+                uint64_t key = adf_sample_key(coord[0] + x * half_step, coord[1] + y * half_step, coord[2] + z * half_step);
+                lattice[li] = sdfs[std::lower_bound(keys.begin(), keys.end(), key) - keys.begin()];
+            }
+
+            bool subdivide = depth < ADF_MIN_DEPTH;
+            if (subdivide == false)
+            {
+                // the distance is 1-lipschitz, so a cell whose lattice is farther than its half diagonal from
+                // the surface can't contain it. There the tolerance grows by that clearance, which still keeps
+                // the sign : the medial axis kinks would otherwise refine down to max_depth without improving the surface.
+                float cell_tolerance = tolerance;
+                float min_abs_sdf = FLT_MAX;
+                for (int li = 0; li < ADF_LATTICE_COUNT; ++li)
+                {
+                    min_abs_sdf = std::min(min_abs_sdf, fabsf(lattice[li]));
+                }
+                float half_diagonal = finest_size * (float)(half_step * 2) * 0.8660254f;
+                if (min_abs_sdf > half_diagonal)
+                {
+                    cell_tolerance = tolerance + (min_abs_sdf - half_diagonal);
+                }
+
+                const float* corners = adf->nodes[node_index].corners;
+                for (int li = 0; li < ADF_LATTICE_COUNT && subdivide == false; ++li)
+                {
+                    int x = li % 3;
+                    int y = (li / 3) % 3;
+                    int z = li / 9;
+                    float interpolated = adf_trilinear(corners, x * 0.5f, y * 0.5f, z * 0.5f);
+                    subdivide = fabsf(interpolated - lattice[li]) > cell_tolerance;
+                }
+            }
+
+            if (subdivide == false)
+                continue;
+
+            int first_child = (int)adf->nodes.size();
+            adf->nodes[node_index].children = first_child;
+
+            for (int c = 0; c < 8; ++c)
+            {
+                int cx = c & 1;
+                int cy = (c >> 1) & 1;
+                int cz = (c >> 2) & 1;
+
+                ADFNode child;
+                child.children = -1;
+                for (int cc = 0; cc < 8; ++cc)
+                {
+                    child.corners[cc] = lattice[adf_lattice_index(cx + (cc & 1), cy + ((cc >> 1) & 1), cz + ((cc >> 2) & 1))];
+                }
+
+                adf->nodes.push_back(child);
+
+                ADFBuildCell child_cell = { first_child + c, { coord[0] + cx * half_step, coord[1] + cy * half_step, coord[2] + cz * half_step } };
+                next_cells.push_back(child_cell);
+            }
+        }
+
+        cells.swap(next_cells);
+    }
+}
+
+float adf_sample(const ADF* adf, Vector3 p)
+{
+    const ADFNode* node = &(adf->nodes[0]);
+    float cell_min[3] = { adf->min_pos[0], adf->min_pos[1], adf->min_pos[2] };
+    float cell_size = adf->size;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        if (p.v[axis] < cell_min[axis]) p.v[axis] = cell_min[axis];
+        if (p.v[axis] > cell_min[axis] + cell_size) p.v[axis] = cell_min[axis] + cell_size;
+    }
+
+    while (node->children >= 0)
+    {
+        cell_size *= 0.5f;
+        int c = 0;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            if (p.v[axis] >= cell_min[axis] + cell_size)
+            {
+                cell_min[axis] += cell_size;
+                c |= 1 << axis;
+            }
+        }
+
+        node = &(adf->nodes[node->children + c]);
+    }
+
+    float inv_size = 1.f / cell_size;
+    return adf_trilinear
+    (
+        node->corners,
+        (p.v[0] - cell_min[0]) * inv_size,
+        (p.v[1] - cell_min[1]) * inv_size,
+        (p.v[2] - cell_min[2]) * inv_size
+    );
+}
+
+void adf_to_grid(const ADF* adf, float grid_delta, Grid* out_grid)
+{
+    Grid* grid = out_grid;
+    grid->delta = grid_delta;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        grid->min_pos[axis] = adf->min_pos[axis];
+        grid->max_pos[axis] = adf->max_pos[axis];
+        grid->dimensions[axis] = grid->max_pos[axis] - grid->min_pos[axis];
+    }
+    grid->nx = (int)(grid->dimensions[0] / grid_delta + 0.5f);
+    grid->ny = (int)(grid->dimensions[1] / grid_delta + 0.5f);
+    grid->nz = (int)(grid->dimensions[2] / grid_delta + 0.5f);
+    grid->sdf_debugs.clear();
+
+    grid_init_bricks(grid, 0.f);
+    grid_allocate_all_bricks(grid);
+
+    for (int k = 0; k < grid->nz; ++k)
+    {
+        for (int j = 0; j < grid->ny; ++j)
+        {
+            for (int i = 0; i < grid->nx; ++i)
+            {
+                Vector3 p = vector3_set3(grid->min_pos[0] + grid_delta * i, grid->min_pos[1] + grid_delta * j, grid->min_pos[2] + grid_delta * k);
+                grid_set_sdf(grid, i, j, k, adf_sample(adf, p));
+            }
+        }
+    }
+}
+
+size_t adf_get_leaf_count(const ADF* adf)
+{
+    size_t leaf_count = 0;
+    for (const ADFNode& node : adf->nodes)
+    {
+        if (node.children < 0)
+            ++leaf_count;
+    }
+    return leaf_count;
+}
+
+size_t adf_get_memory_size(const ADF* adf)
+{
+    return sizeof(ADFNode) * adf->nodes.size();
+}
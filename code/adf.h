@@ -0,0 +1,46 @@
+#ifndef __ADF_H__
+#define __ADF_H__
+
+#include <stddef.h>
+#include <vector>
+#include "vector.h"
+#include "obj.h"
+
+struct Grid;
+
+// cells with a depth lower than this always subdivide so that small features
+// between the error samples of a big cell are not missed.
+#define ADF_MIN_DEPTH 3
+
+// corners[c] is the signed distance at cell_min + cell_size * (c & 1, (c >> 1) & 1, (c >> 2) & 1).
+// The cell bounds are not stored, they follow from the descent from the root.
+// children is the node index of the first of 8 children in the same corner order, -1 for a leaf.
+struct ADFNode
+{
+    float corners[8];
+    int children;
+};
+
+// adaptive distance field. A cell subdivides only if the trilinear interpolation of its corners
+// deviates from the true distance by more than tolerance, down to cells of min_cell_size.
+struct ADF
+{
+    float min_pos[3];
+    float max_pos[3]; // bounds of the sampled region. The root cube covers it.
+    float size; // root cube size
+    float tolerance;
+    int max_depth;
+    std::vector<ADFNode> nodes; // nodes[0] is the root
+};
+
+void adf_build(ADF* adf, ObjData::Shape* shape, const float* min_pos, const float* max_pos, float min_cell_size, float tolerance, SignMethod sign_method, int thread_count);
+
+// same as grid_sample. p is clamped into the root cube.
+float adf_sample(const ADF* adf, Vector3 p);
+// resample into the uniform grid with grid_delta over [min_pos, max_pos] so it can feed the marching cubes rendering.
+void adf_to_grid(const ADF* adf, float grid_delta, Grid* out_grid);
+
+size_t adf_get_leaf_count(const ADF* adf);
+size_t adf_get_memory_size(const ADF* adf);
+
+#endif
@@ -0,0 +1,1090 @@
+#include "bvh.h"
+
+#include <assert.h>
+#include <float.h>
+#include <algorithm>
+#include <math.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include "common.h"
+
+#define BVH_SAH_BIN_COUNT 12
+// subtrees with fewer leaves are built by a single job
+#define BVH_SERIAL_BUILD_SIZE 4096
+
+static inline bool bvh_is_leaf(const BVH* bvh)
+{
+    return (bvh->left == -1 && bvh->right == -1);
+}
+
+static inline void bvh_refit(BVH* bvhs, int index)
+{
+    BVH& bvh = bvhs[index];
+    bvh.aabb = bvhs[bvh.left].aabb;
+    aabb_combine_aabb(&(bvh.aabb), &(bvhs[bvh.right].aabb));
+    aabb_get_center(&(bvh.aabb), bvh.center);
+}
+
+// from godot/sort_array.h
+template<class T, class Comparator>
+class SortArray
+{
+public:
+	Comparator compare;
+
+	inline int bitlog(int n)
+	{
+		int k;
+		for (k = 0; n != 1; n >>= 1)
+			++k;
+
+		return k;
+	}
+
+	const T& median_of_3(const T& a, const T& b, const T& c)
+	{
+		if (compare(a, b))
+		{
+			if (compare(b, c))
+				return b;
+			else if (compare(a, c))
+				return c;
+			else
+				return a;
+		}
+		else if (compare(a, c))
+		{
+			return a;
+		}
+		else if (compare(b, c))
+		{
+			return c;
+		}
+		else
+		{
+			return b;
+		}
+	}
+
+	inline int partitioner(int first, int last, T pivot, T* arr)
+	{
+		const int unmodified_first = first;
+		const int unmodified_last = last;
+
+		while (true)
+		{
+			while (compare(arr[first], pivot))
+			{
+				++first;
+			}
+			--last;
+
+			while (compare(pivot, arr[last]))
+			{
+				--last;
+			}
+
+			if (!(first < last))
+			{
+				return first;
+			}
+
+			T temp = arr[first];
+			arr[first] = arr[last];
+			arr[last] = temp;
+
+			++first;
+		}
+	}
+
+	inline void unguarded_linear_insert(int last, T value, T* p)
+	{
+		int next = last - 1;
+		while (compare(value, p[next]))
+		{
+			p[last] = p[next];
+			last = next;
+			--next;
+		}
+		p[last] = value;
+	}
+
+	inline void linear_insert(int first, int last, T* p)
+	{
+		T val = p[last];
+		if (compare(val, p[first]))
+		{
+			for (int i = last; i > first; --i)
+			{
+				p[i] = p[i - 1];
+			}
+
+			p[first] = val;
+		}
+		else
+		{
+			unguarded_linear_insert(last, val, p);
+		}
+	}
+
+	inline void insertion_sort(int first, int last, T* p)
+	{
+		if (first == last)
+			return;
+
+		for (int i = first + 1; i != last; ++i)
+		{
+			linear_insert(first, i, p);
+		}
+	}
+
+	inline void introselect(int first, int nth, int last, T* p, int max_depth)
+	{
+		while (last - first > 3)
+		{
+			if (max_depth == 0)
+			{
+				return;
+			}
+
+			int cut = partitioner(first, last,
+				median_of_3
+				(
+					p[first],
+					p[first + (last - first) / 2],
+					p[last - 1]
+				),
+				p
+			);
+
+			if (cut <= nth)
+			{
+				first = cut;
+			}
+			else
+			{
+				last = cut;
+			}
+		}
+
+		insertion_sort(first, last, p);
+	}
+
+	
+	inline void nth_element(int first, int last, int nth, T* p)
+	{
+		if (first == last || last == nth)
+		{
+			return;
+		}
+		introselect(first, nth, last, p, bitlog(last - first));
+	}
+};
+
+template<int axis>
+struct BVHCompare
+{
+	bool operator()(const BVH* left, const BVH* right)
+	{
+		return left->center[axis] < right->center[axis];
+	}
+};
+
+// median split of the longest axis, from godot/triangle_mesh.cpp
+static int bvh_split_median(BVH** p_bb, int p_size, AABB* aabb)
+{
+	int li = aabb_get_logest_axis_index(aabb);
+	
+	switch (li)
+	{
+	case 0:
+		SortArray<BVH*, BVHCompare<0>> sort_x;
+		sort_x.nth_element(0, p_size, p_size / 2, p_bb);
+		break;
+	case 1:
+		SortArray<BVH*, BVHCompare<1>> sort_y;
+		sort_y.nth_element(0, p_size, p_size / 2, p_bb);
+		break;
+	case 2:
+		SortArray<BVH*, BVHCompare<2>> sort_z;
+		sort_z.nth_element(0, p_size, p_size / 2, p_bb);
+		break;
+	}
+
+	return p_size / 2;
+}
+
+struct SAHBin
+{
+    AABB aabb;
+    int count;
+};
+
+// clamped, the float rounding can put the centroids on the bounds just out of [0, BVH_SAH_BIN_COUNT)
+static inline int bvh_sah_bin_index(float center, float cmin, float bin_scale)
+{
+    int bi = (int)((center - cmin) * bin_scale);
+    if (bi < 0) bi = 0;
+    if (bi >= BVH_SAH_BIN_COUNT) bi = BVH_SAH_BIN_COUNT - 1;
+    return bi;
+}
+
+// the cheapest of BVH_SAH_BIN_COUNT - 1 planes on each axis
+static int bvh_split_sah(BVH** p_bb, int p_size)
+{
+    AABB centroid_aabb;
+    aabb_set_min_max(&centroid_aabb, p_bb[0]->center[0], p_bb[0]->center[1], p_bb[0]->center[2]);
+    for (int i = 1; i < p_size; ++i)
+    {
+        aabb_combine_float(&centroid_aabb, p_bb[i]->center);
+    }
+
+    int best_axis = -1;
+    int best_split = 0;
+    float best_cost = FLT_MAX;
+    SAHBin bins[BVH_SAH_BIN_COUNT];
+    float right_areas[BVH_SAH_BIN_COUNT];
+    int right_counts[BVH_SAH_BIN_COUNT];
+
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        float cmin = centroid_aabb.min_p.v[axis];
+        float extent = centroid_aabb.max_p.v[axis] - cmin;
+        if (extent <= 0.f)
+            continue;
+
+        // a denormal extent overflows the scale to infinity, the bin indices would be NaN
+        float bin_scale = BVH_SAH_BIN_COUNT / extent;
+        if (!(bin_scale <= FLT_MAX))
+            continue;
+
+        for (int bi = 0; bi < BVH_SAH_BIN_COUNT; ++bi)
+        {
+            bins[bi].count = 0;
+        }
+
+        for (int i = 0; i < p_size; ++i)
+        {
+            BVH* leaf = p_bb[i];
+            int bi = bvh_sah_bin_index(leaf->center[axis], cmin, bin_scale);
+
+            if (bins[bi].count == 0)
+                bins[bi].aabb = leaf->aabb;
+            else
+                aabb_combine_aabb(&(bins[bi].aabb), &(leaf->aabb));
+            ++bins[bi].count;
+        }
+
+        // right_*[bi] covers the bins [bi, BVH_SAH_BIN_COUNT)
+        AABB right_aabb;
+        int right_count = 0;
+        for (int bi = BVH_SAH_BIN_COUNT - 1; bi > 0; --bi)
+        {
+            if (bins[bi].count > 0)
+            {
+                if (right_count == 0)
+                    right_aabb = bins[bi].aabb;
+                else
+                    aabb_combine_aabb(&right_aabb, &(bins[bi].aabb));
+                right_count += bins[bi].count;
+            }
+            right_counts[bi] = right_count;
+            right_areas[bi] = right_count > 0 ? aabb_get_surface_area(&right_aabb) : 0.f;
+        }
+
+        AABB left_aabb;
+        int left_count = 0;
+        for (int bi = 0; bi < BVH_SAH_BIN_COUNT - 1; ++bi)
+        {
+            if (bins[bi].count > 0)
+            {
+                if (left_count == 0)
+                    left_aabb = bins[bi].aabb;
+                else
+                    aabb_combine_aabb(&left_aabb, &(bins[bi].aabb));
+                left_count += bins[bi].count;
+            }
+
+            if (left_count == 0 || right_counts[bi + 1] == 0)
+                continue;
+
+            float cost = aabb_get_surface_area(&left_aabb) * left_count + right_areas[bi + 1] * right_counts[bi + 1];
+            if (cost < best_cost)
+            {
+                best_cost = cost;
+                best_axis = axis;
+                best_split = bi + 1;
+            }
+        }
+    }
+
+    // every centroid is the same point, any split is as good as the median
+    if (best_axis < 0)
+        return p_size / 2;
+
+    float cmin = centroid_aabb.min_p.v[best_axis];
+    float bin_scale = BVH_SAH_BIN_COUNT / (centroid_aabb.max_p.v[best_axis] - cmin);
+
+    BVH** first = p_bb;
+    BVH** last = p_bb + p_size;
+    while (first < last)
+    {
+        int bi = bvh_sah_bin_index((*first)->center[best_axis], cmin, bin_scale);
+
+        if (bi < best_split)
+        {
+            ++first;
+        }
+        else
+        {
+            --last;
+            BVH* temp = *first;
+            *first = *last;
+            *last = temp;
+        }
+    }
+
+    return (int)(first - p_bb);
+}
+
+static inline int bvh_count_leading_zeros64(uint64_t x)
+{
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse64(&index, x);
+    return 63 - (int)index;
+#else
+    return __builtin_clzll(x);
+#endif
+}
+
+// Karras' findSplit : the last leaf before the highest bit where the sorted codes of [first, last] differ.
+// Identical codes are split in the middle.
+static int lbvh_find_split(const uint64_t* codes, int first, int last)
+{
+    uint64_t first_code = codes[first];
+    uint64_t last_code = codes[last];
+    if (first_code == last_code)
+        return (first + last) >> 1;
+
+    int common_prefix = bvh_count_leading_zeros64(first_code ^ last_code);
+
+    // binary search for the last code sharing more than common_prefix bits with first_code
+    int split = first;
+    int step = last - first;
+    do
+    {
+        step = (step + 1) >> 1;
+        int new_split = split + step;
+        if (new_split < last)
+        {
+            int split_prefix = bvh_count_leading_zeros64(first_code ^ codes[new_split]);
+            if (split_prefix > common_prefix)
+                split = new_split;
+        }
+    } while (step > 1);
+
+    return split;
+}
+
+struct BVHBuildContext
+{
+    BVH* bvhs;
+    BVHBuilder builder;
+    BVH** leaves; // the leaf order of the build, sorted by morton codes for BVH_BUILDER_LBVH
+    const uint64_t* morton_codes; // morton_codes[i] is for leaves[i]
+
+    ThreadPool* tp;
+    int serial_size;
+
+    std::mutex mutex;
+    int max_depth;
+    std::vector<int> unfit_nodes; // split by jobs before their children were built
+};
+
+// reorders p_bb[0, p_size) into the two children and returns the size of the left one.
+// out_aabb gets the bounds of the range, except for BVH_BUILDER_LBVH which is refit from the children.
+static int bvh_split(const BVHBuildContext* context, BVH** p_bb, int p_size, AABB* out_aabb)
+{
+    if (context->builder == BVH_BUILDER_LBVH)
+    {
+        int first = (int)(p_bb - context->leaves);
+        return lbvh_find_split(context->morton_codes, first, first + p_size - 1) - first + 1;
+    }
+
+    *out_aabb = p_bb[0]->aabb;
+    for (int i = 1; i < p_size; ++i)
+    {
+        aabb_combine_aabb(out_aabb, &(p_bb[i]->aabb));
+    }
+
+    if (context->builder == BVH_BUILDER_SAH)
+        return bvh_split_sah(p_bb, p_size);
+
+    return bvh_split_median(p_bb, p_size, out_aabb);
+}
+
+// the subtree over p_size leaves owns the p_size - 1 internal nodes from node_base and its root is the last of them.
+// It is the index the sequential post-order allocation would give.
+static inline int bvh_subtree_root(BVH* bvhs, BVH** p_bb, int p_size, int node_base)
+{
+    if (p_size == 1)
+        return (int)(p_bb[0] - bvhs);
+
+    return node_base + p_size - 2;
+}
+
+static inline void bvh_set_node(BVH* bvhs, int index, AABB* aabb, int left, int right)
+{
+    BVH* new_bvh = &(bvhs[index]);
+    new_bvh->aabb = *aabb;
+    aabb_get_center(aabb, new_bvh->center);
+    new_bvh->face_index = -1;
+    new_bvh->left = left;
+    new_bvh->right = right;
+}
+
+static int bvh_build_range(const BVHBuildContext* context, BVH** p_bb, int p_size, int node_base, int depth, int& r_max_depth)
+{
+    if (depth > r_max_depth)
+        r_max_depth = depth;
+
+    BVH* bvhs = context->bvhs;
+    if (p_size == 1)
+        return (int)(p_bb[0] - bvhs);
+
+    AABB aabb;
+    int mid = bvh_split(context, p_bb, p_size, &aabb);
+
+    int left = bvh_build_range(context, p_bb, mid, node_base, depth + 1, r_max_depth);
+    int right = bvh_build_range(context, p_bb + mid, p_size - mid, node_base + mid - 1, depth + 1, r_max_depth);
+
+    int index = bvh_subtree_root(bvhs, p_bb, p_size, node_base);
+    bvh_set_node(bvhs, index, &aabb, left, right);
+    if (context->builder == BVH_BUILDER_LBVH)
+        bvh_refit(bvhs, index);
+
+    return index;
+}
+
+struct BVHBuildTask
+{
+    BVHBuildContext* context;
+    BVH** p_bb;
+    int p_size;
+    int node_base;
+    int depth;
+};
+
+static void bvh_build_work(void* argument);
+
+static void bvh_enqueue_task(BVHBuildContext* context, BVH** p_bb, int p_size, int node_base, int depth)
+{
+    BVHBuildTask* task = new BVHBuildTask;
+    task->context = context;
+    task->p_bb = p_bb;
+    task->p_size = p_size;
+    task->node_base = node_base;
+    task->depth = depth;
+
+    context->tp->EnqueueJob(bvh_build_work, task);
+}
+
+// a big range is split here and its children become new jobs, a small one is built at once.
+// The node of a split is written before its children exist since their indices are already known.
+static void bvh_build_work(void* argument)
+{
+    BVHBuildTask* task = (BVHBuildTask*)argument;
+    BVHBuildContext* context = task->context;
+    BVH* bvhs = context->bvhs;
+
+    int max_depth = 0;
+    int unfit_node = -1;
+    if (task->p_size <= context->serial_size)
+    {
+        bvh_build_range(context, task->p_bb, task->p_size, task->node_base, task->depth, max_depth);
+    }
+    else
+    {
+        max_depth = task->depth;
+
+        AABB aabb;
+        int mid = bvh_split(context, task->p_bb, task->p_size, &aabb);
+        BVH** right_bb = task->p_bb + mid;
+        int right_base = task->node_base + mid - 1;
+
+        int index = bvh_subtree_root(bvhs, task->p_bb, task->p_size, task->node_base);
+        int left = bvh_subtree_root(bvhs, task->p_bb, mid, task->node_base);
+        int right = bvh_subtree_root(bvhs, right_bb, task->p_size - mid, right_base);
+        bvh_set_node(bvhs, index, &aabb, left, right);
+        if (context->builder == BVH_BUILDER_LBVH)
+            unfit_node = index;
+
+        bvh_enqueue_task(context, task->p_bb, mid, task->node_base, task->depth + 1);
+        bvh_enqueue_task(context, right_bb, task->p_size - mid, right_base, task->depth + 1);
+    }
+
+    context->mutex.lock();
+    if (max_depth > context->max_depth)
+        context->max_depth = max_depth;
+    if (unfit_node >= 0)
+        context->unfit_nodes.push_back(unfit_node);
+    context->mutex.unlock();
+
+    delete task;
+}
+
+#define LBVH_RADIX_BITS 8
+#define LBVH_RADIX_SIZE (1 << LBVH_RADIX_BITS)
+
+// every job owns a fixed chunk of the leaves. The phases of the sort are fork/joins over the jobs :
+// the centroid bounds, the 63 bit morton codes, then the histogram and the scatter of each pass of a LSD radix sort.
+struct LBVHSortContext
+{
+    BVH* bvhs;
+    int leaf_count;
+    int job_count;
+
+    std::vector<AABB> job_centroid_aabbs;
+    std::vector<int> job_histograms; // LBVH_RADIX_SIZE per job, the scatter offsets after the prefix sum
+    uint64_t* keys[2];
+    int* values[2];
+    BVH** out_leaves;
+
+    AABB centroid_aabb;
+    int src;
+    int shift;
+};
+
+static inline void lbvh_job_range(const LBVHSortContext* context, size_t ji, int* out_begin, int* out_end)
+{
+    *out_begin = (int)((int64_t)context->leaf_count * (int64_t)ji / context->job_count);
+    *out_end = (int)((int64_t)context->leaf_count * (int64_t)(ji + 1) / context->job_count);
+}
+
+static void lbvh_centroid_work(void* argument, size_t job_begin, size_t job_end)
+{
+    LBVHSortContext* context = (LBVHSortContext*)argument;
+    for (size_t ji = job_begin; ji < job_end; ++ji)
+    {
+        int begin, end;
+        lbvh_job_range(context, ji, &begin, &end);
+
+        AABB& job_aabb = context->job_centroid_aabbs[ji];
+        job_aabb.min_p = vector3_set1(FLT_MAX);
+        job_aabb.max_p = vector3_set1(-FLT_MAX);
+        for (int i = begin; i < end; ++i)
+        {
+            aabb_combine_float(&job_aabb, context->bvhs[i].center);
+        }
+    }
+}
+
+static void lbvh_code_work(void* argument, size_t job_begin, size_t job_end)
+{
+    LBVHSortContext* context = (LBVHSortContext*)argument;
+    const AABB& centroid_aabb = context->centroid_aabb;
+
+    float scales[3];
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        float extent = centroid_aabb.max_p.v[axis] - centroid_aabb.min_p.v[axis];
+        scales[axis] = extent > 0.f ? (float)((1 << 21) - 1) / extent : 0.f;
+    }
+
+    for (size_t ji = job_begin; ji < job_end; ++ji)
+    {
+        int begin, end;
+        lbvh_job_range(context, ji, &begin, &end);
+        for (int i = begin; i < end; ++i)
+        {
+            const float* c = context->bvhs[i].center;
+            uint32_t q[3];
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                float f = (c[axis] - centroid_aabb.min_p.v[axis]) * scales[axis];
+                q[axis] = f < (float)((1 << 21) - 1) ? (uint32_t)f : (uint32_t)((1 << 21) - 1);
+            }
+            context->keys[0][i] = morton_encode3(q[0], q[1], q[2]);
+            context->values[0][i] = i;
+        }
+    }
+}
+
+static void lbvh_histogram_work(void* argument, size_t job_begin, size_t job_end)
+{
+    LBVHSortContext* context = (LBVHSortContext*)argument;
+    const uint64_t* src_keys = context->keys[context->src];
+    int shift = context->shift;
+    for (size_t ji = job_begin; ji < job_end; ++ji)
+    {
+        int begin, end;
+        lbvh_job_range(context, ji, &begin, &end);
+
+        int* histogram = &(context->job_histograms[ji * LBVH_RADIX_SIZE]);
+        memset(histogram, 0, sizeof(int) * LBVH_RADIX_SIZE);
+        for (int i = begin; i < end; ++i)
+        {
+            ++histogram[(src_keys[i] >> shift) & (LBVH_RADIX_SIZE - 1)];
+        }
+    }
+}
+
+static void lbvh_scatter_work(void* argument, size_t job_begin, size_t job_end)
+{
+    LBVHSortContext* context = (LBVHSortContext*)argument;
+    const uint64_t* src_keys = context->keys[context->src];
+    const int* src_values = context->values[context->src];
+    uint64_t* dest_keys = context->keys[1 - context->src];
+    int* dest_values = context->values[1 - context->src];
+    int shift = context->shift;
+    for (size_t ji = job_begin; ji < job_end; ++ji)
+    {
+        int begin, end;
+        lbvh_job_range(context, ji, &begin, &end);
+
+        int* offsets = &(context->job_histograms[ji * LBVH_RADIX_SIZE]);
+        for (int i = begin; i < end; ++i)
+        {
+            int d = (int)((src_keys[i] >> shift) & (LBVH_RADIX_SIZE - 1));
+            int di = offsets[d]++;
+            dest_keys[di] = src_keys[i];
+            dest_values[di] = src_values[i];
+        }
+    }
+}
+
+static void lbvh_output_work(void* argument, size_t job_begin, size_t job_end)
+{
+    LBVHSortContext* context = (LBVHSortContext*)argument;
+    for (size_t ji = job_begin; ji < job_end; ++ji)
+    {
+        int begin, end;
+        lbvh_job_range(context, ji, &begin, &end);
+        for (int i = begin; i < end; ++i)
+        {
+            context->out_leaves[i] = &(context->bvhs[context->values[0][i]]);
+        }
+    }
+}
+
+// sorts the leaves by the morton codes of their centers into out_leaves and out_codes
+static void lbvh_sort_leaves(BVH* bvhs, int leaf_count, int thread_count, BVH** out_leaves, uint64_t* out_codes)
+{
+    std::vector<uint64_t> temp_keys(leaf_count);
+    std::vector<int> values(leaf_count * 2);
+
+    LBVHSortContext context;
+    context.bvhs = bvhs;
+    context.leaf_count = leaf_count;
+    context.job_count = thread_count == 1 ? 1 : scheduler_reserve(thread_count);
+    context.job_centroid_aabbs.resize(context.job_count);
+    context.job_histograms.resize(context.job_count * LBVH_RADIX_SIZE);
+    context.keys[0] = out_codes;
+    context.keys[1] = temp_keys.data();
+    context.values[0] = values.data();
+    context.values[1] = values.data() + leaf_count;
+    context.out_leaves = out_leaves;
+    context.src = 0;
+    context.shift = 0;
+
+    size_t job_count = (size_t)context.job_count;
+    parallel_for(0, job_count, 1, thread_count, lbvh_centroid_work, &context);
+
+    context.centroid_aabb = context.job_centroid_aabbs[0];
+    for (int jj = 1; jj < context.job_count; ++jj)
+    {
+        aabb_combine_aabb(&context.centroid_aabb, &(context.job_centroid_aabbs[jj]));
+    }
+
+    parallel_for(0, job_count, 1, thread_count, lbvh_code_work, &context);
+
+    for (int shift = 0; shift < 63; shift += LBVH_RADIX_BITS)
+    {
+        context.shift = shift;
+        parallel_for(0, job_count, 1, thread_count, lbvh_histogram_work, &context);
+
+        // the chunk of a job goes after every smaller digit and after the same digit of the previous jobs
+        int offset = 0;
+        for (int d = 0; d < LBVH_RADIX_SIZE; ++d)
+        {
+            for (int jj = 0; jj < context.job_count; ++jj)
+            {
+                int& count = context.job_histograms[jj * LBVH_RADIX_SIZE + d];
+                int next_offset = offset + count;
+                count = offset;
+                offset = next_offset;
+            }
+        }
+
+        parallel_for(0, job_count, 1, thread_count, lbvh_scatter_work, &context);
+        context.src = 1 - context.src;
+    }
+
+    assert(context.src == 0);
+    parallel_for(0, job_count, 1, thread_count, lbvh_output_work, &context);
+}
+
+int bvh_build(BVH* bvhs, int leaf_count, BVHBuilder builder, int thread_count, int* out_max_depth)
+{
+    *out_max_depth = 0;
+    if (leaf_count <= 0)
+        return 0;
+
+    std::vector<BVH*> bvh_ps(leaf_count);
+    std::vector<uint64_t> morton_codes;
+
+    BVHBuildContext context;
+    context.bvhs = bvhs;
+    context.builder = builder;
+    context.leaves = bvh_ps.data();
+    context.morton_codes = NULL;
+    context.tp = NULL;
+    context.serial_size = leaf_count;
+    context.max_depth = 0;
+
+    if (leaf_count <= BVH_SERIAL_BUILD_SIZE)
+    {
+        if (builder == BVH_BUILDER_LBVH)
+        {
+            morton_codes.resize(leaf_count);
+            lbvh_sort_leaves(bvhs, leaf_count, 1, bvh_ps.data(), morton_codes.data());
+            context.morton_codes = morton_codes.data();
+        }
+        else
+        {
+            for (int fi = 0; fi < leaf_count; ++fi)
+            {
+                bvh_ps[fi] = &(bvhs[fi]);
+            }
+        }
+
+        bvh_build_range(&context, bvh_ps.data(), leaf_count, leaf_count, 1, *out_max_depth);
+        return 2 * leaf_count - 1;
+    }
+
+    ThreadPool tp(thread_count);
+    context.tp = &tp;
+    // a few jobs per thread to balance the uneven sah splits
+    context.serial_size = leaf_count / ((int)tp.GetThreadCount() * 8);
+    if (context.serial_size < BVH_SERIAL_BUILD_SIZE)
+        context.serial_size = BVH_SERIAL_BUILD_SIZE;
+
+    if (builder == BVH_BUILDER_LBVH)
+    {
+        morton_codes.resize(leaf_count);
+        lbvh_sort_leaves(bvhs, leaf_count, thread_count, bvh_ps.data(), morton_codes.data());
+        context.morton_codes = morton_codes.data();
+    }
+    else
+    {
+        for (int fi = 0; fi < leaf_count; ++fi)
+        {
+            bvh_ps[fi] = &(bvhs[fi]);
+        }
+    }
+
+    // the jobs enqueue the jobs of their children before they finish, so the join waits for the whole tree
+    bvh_enqueue_task(&context, bvh_ps.data(), leaf_count, leaf_count, 1);
+    tp.Join(ThreadPool::SHUTDOWN_GRACEFULLY);
+
+    // children are before their parent
+    std::sort(context.unfit_nodes.begin(), context.unfit_nodes.end());
+    for (int node_index : context.unfit_nodes)
+    {
+        bvh_refit(bvhs, node_index);
+    }
+
+    *out_max_depth = context.max_depth;
+    return 2 * leaf_count - 1;
+}
+
+// surface area of the union of a and b
+static inline float bvh_union_area(BVH* bvhs, int a, int b)
+{
+    AABB aabb = bvhs[a].aabb;
+    aabb_combine_aabb(&aabb, &(bvhs[b].aabb));
+    return aabb_get_surface_area(&aabb);
+}
+
+// bottom-up, so the subtrees are already rotated when their parent is. Returns true if anything changed.
+static bool bvh_rotate_subtree(BVH* bvhs, int index)
+{
+    BVH& bvh = bvhs[index];
+    if (bvh_is_leaf(&bvh))
+        return false;
+
+    bool changed = bvh_rotate_subtree(bvhs, bvh.left);
+    changed = bvh_rotate_subtree(bvhs, bvh.right) || changed;
+
+    // child c of this node swaps with grandchild g of the other child o.
+    // o is refit to the union of c and the other grandchild, that area change is the gain.
+    float best_gain = 0.f;
+    int best_child_side = -1;
+    int best_grandchild_side = -1;
+    for (int side = 0; side < 2; ++side)
+    {
+        int child = side == 0 ? bvh.left : bvh.right;
+        int other = side == 0 ? bvh.right : bvh.left;
+        if (bvh_is_leaf(&(bvhs[other])))
+            continue;
+
+        float other_area = aabb_get_surface_area(&(bvhs[other].aabb));
+        for (int gside = 0; gside < 2; ++gside)
+        {
+            int remaining = gside == 0 ? bvhs[other].right : bvhs[other].left;
+            float gain = other_area - bvh_union_area(bvhs, child, remaining);
+            if (gain > best_gain)
+            {
+                best_gain = gain;
+                best_child_side = side;
+                best_grandchild_side = gside;
+            }
+        }
+    }
+
+    if (best_child_side < 0)
+        return changed;
+
+    int& child = best_child_side == 0 ? bvh.left : bvh.right;
+    int other = best_child_side == 0 ? bvh.right : bvh.left;
+    int& grandchild = best_grandchild_side == 0 ? bvhs[other].left : bvhs[other].right;
+
+    int temp = child;
+    child = grandchild;
+    grandchild = temp;
+    bvh_refit(bvhs, other);
+
+    return true;
+}
+
+static void bvh_renumber(const std::vector<BVH>& src, int index, int depth, std::vector<BVH>* dest, int* r_next, int* r_max_depth, int* out_index)
+{
+    if (depth > *r_max_depth)
+        *r_max_depth = depth;
+
+    const BVH& bvh = src[index];
+    if (bvh_is_leaf(&bvh))
+    {
+        *out_index = index;
+        return;
+    }
+
+    int left, right;
+    bvh_renumber(src, bvh.left, depth + 1, dest, r_next, r_max_depth, &left);
+    bvh_renumber(src, bvh.right, depth + 1, dest, r_next, r_max_depth, &right);
+
+    int new_index = (*r_next)++;
+    (*dest)[new_index] = bvh;
+    (*dest)[new_index].left = left;
+    (*dest)[new_index].right = right;
+    *out_index = new_index;
+}
+
+int bvh_optimize_rotations(std::vector<BVH>* bvhs, int leaf_count, int pass_count)
+{
+    if (bvhs->empty())
+        return 0;
+
+    int root = (int)bvhs->size() - 1;
+    for (int pass = 0; pass < pass_count; ++pass)
+    {
+        if (bvh_rotate_subtree(bvhs->data(), root) == false)
+            break;
+    }
+
+    std::vector<BVH> renumbered(*bvhs);
+    int next = leaf_count;
+    int max_depth = 0;
+    int new_root;
+    bvh_renumber(*bvhs, root, 1, &renumbered, &next, &max_depth, &new_root);
+    assert(new_root == (int)bvhs->size() - 1 || leaf_count == 1);
+    bvhs->swap(renumbered);
+
+    return max_depth;
+}
+
+void bvh_get_leaf_order(const std::vector<BVH>& bvhs, int leaf_size, int leaf_alignment, BVHLeafOrder* out_leaf_order)
+{
+    int node_count = (int)bvhs.size();
+    out_leaf_order->leaf_size = leaf_size;
+    out_leaf_order->firsts.resize(node_count);
+    out_leaf_order->counts.resize(node_count);
+
+    // children are before their parent. slot_counts is counts with the leaves rounded up to leaf_alignment.
+    std::vector<int>& counts = out_leaf_order->counts;
+    std::vector<int> slot_counts(node_count);
+    for (int bi = 0; bi < node_count; ++bi)
+    {
+        const BVH& bvh = bvhs[bi];
+        counts[bi] = bvh_is_leaf(&bvh) ? 1 : counts[bvh.left] + counts[bvh.right];
+        if (counts[bi] <= leaf_size)
+            slot_counts[bi] = (counts[bi] + leaf_alignment - 1) / leaf_alignment * leaf_alignment;
+        else
+            slot_counts[bi] = slot_counts[bvh.left] + slot_counts[bvh.right];
+    }
+    out_leaf_order->face_indices.assign(node_count > 0 ? slot_counts[node_count - 1] : 0, -1);
+
+    // and parents after them, the left subtree comes first
+    std::vector<int>& firsts = out_leaf_order->firsts;
+    if (node_count > 0)
+        firsts[node_count - 1] = 0;
+
+    for (int bi = node_count - 1; bi >= 0; --bi)
+    {
+        const BVH& bvh = bvhs[bi];
+        if (bvh_is_leaf(&bvh))
+        {
+            out_leaf_order->face_indices[firsts[bi]] = bvh.face_index;
+            continue;
+        }
+
+        // the faces of a leaf are contiguous, the leaves are aligned
+        firsts[bvh.left] = firsts[bi];
+        firsts[bvh.right] = firsts[bi] + (counts[bi] <= leaf_size ? counts[bvh.left] : slot_counts[bvh.left]);
+    }
+
+    for (size_t fi = 1; fi < out_leaf_order->face_indices.size(); ++fi)
+    {
+        if (out_leaf_order->face_indices[fi] < 0)
+            out_leaf_order->face_indices[fi] = out_leaf_order->face_indices[fi - 1];
+    }
+}
+
+static int bvh_linearize_node(const BVH* bvhs, const BVHLeafOrder* leaf_order, int bvh_index, BVHNode* nodes, int* order, int* r_next)
+{
+    int index = (*r_next)++;
+    const BVH& bvh = bvhs[bvh_index];
+    order[index] = bvh_index;
+
+    BVHNode& node = nodes[index];
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        node.min_p[axis] = bvh.aabb.min_p.v[axis];
+        node.max_p[axis] = bvh.aabb.max_p.v[axis];
+    }
+
+    if (bvh_is_leaf_in_order(leaf_order, bvh_index))
+    {
+        node.offset = leaf_order->firsts[bvh_index];
+        node.face_count = leaf_order->counts[bvh_index];
+        return index;
+    }
+
+    // the left subtree follows its parent
+    bvh_linearize_node(bvhs, leaf_order, bvh.left, nodes, order, r_next);
+    node.offset = bvh_linearize_node(bvhs, leaf_order, bvh.right, nodes, order, r_next);
+    node.face_count = 0;
+
+    return index;
+}
+
+void bvh_linearize(const std::vector<BVH>& bvhs, const BVHLeafOrder& leaf_order, BVHNodeArray* out_nodes, std::vector<int>* out_order)
+{
+    out_nodes->resize(bvhs.size());
+    out_order->resize(bvhs.size());
+    if (bvhs.empty())
+        return;
+
+    int next = 0;
+    bvh_linearize_node(bvhs.data(), &leaf_order, (int)bvhs.size() - 1, out_nodes->data(), out_order->data(), &next);
+    out_nodes->resize(next);
+    out_order->resize(next);
+}
+
+// the steps of the children of a node on one axis. origin + q * scale is evaluated exactly like the queries do,
+// and the steps move outwards until the box contains the child bounds.
+static void bvh_quantize_axis(const float* child_mins, const float* child_maxs, const int* children, float* out_origin, float* out_scale, uint8_t* out_mins, uint8_t* out_maxs)
+{
+    float node_min = FLT_MAX;
+    float node_max = -FLT_MAX;
+    for (int ci = 0; ci < BVH_WIDE_WIDTH; ++ci)
+    {
+        if (children[ci] == BVH_WIDE_EMPTY_CHILD)
+            continue;
+
+        if (child_mins[ci] < node_min) node_min = child_mins[ci];
+        if (child_maxs[ci] > node_max) node_max = child_maxs[ci];
+    }
+
+    if (node_min > node_max)
+    {
+        node_min = node_max = 0.f;
+    }
+
+    // the smallest power of two covering the extent in 255 steps, with a floor keeping it a normal float
+    double extent = (double)node_max - (double)node_min;
+    int exponent = -125;
+    if (extent > 0.0)
+    {
+        frexp(extent / 255.0, &exponent);
+        if (exponent < -125)
+            exponent = -125;
+    }
+    float scale = ldexpf(1.f, exponent);
+
+    *out_origin = node_min;
+    *out_scale = scale;
+    for (int ci = 0; ci < BVH_WIDE_WIDTH; ++ci)
+    {
+        if (children[ci] == BVH_WIDE_EMPTY_CHILD)
+        {
+            out_mins[ci] = 255;
+            out_maxs[ci] = 0;
+            continue;
+        }
+
+        int q_min = (int)floor(((double)child_mins[ci] - node_min) / scale);
+        if (q_min < 0) q_min = 0;
+        if (q_min > 255) q_min = 255;
+        while (q_min > 0 && node_min + (float)q_min * scale > child_mins[ci])
+            --q_min;
+
+        int q_max = (int)ceil(((double)child_maxs[ci] - node_min) / scale);
+        if (q_max < 0) q_max = 0;
+        if (q_max > 255) q_max = 255;
+        while (q_max < 255 && node_min + (float)q_max * scale < child_maxs[ci])
+            ++q_max;
+        assert(node_min + (float)q_max * scale >= child_maxs[ci]);
+
+        out_mins[ci] = (uint8_t)q_min;
+        out_maxs[ci] = (uint8_t)q_max;
+    }
+}
+
+void bvh_quantize_wide(const std::vector<BVHWide>& wide_bvhs, std::vector<BVHWideQuantized, AlignedAllocator<BVHWideQuantized, 64>>* out_nodes)
+{
+    out_nodes->resize(wide_bvhs.size());
+    for (size_t ni = 0; ni < wide_bvhs.size(); ++ni)
+    {
+        const BVHWide& src = wide_bvhs[ni];
+        BVHWideQuantized& dest = (*out_nodes)[ni];
+
+        bvh_quantize_axis(src.min_x, src.max_x, src.children, &(dest.origin[0]), &(dest.scale[0]), dest.min_x, dest.max_x);
+        bvh_quantize_axis(src.min_y, src.max_y, src.children, &(dest.origin[1]), &(dest.scale[1]), dest.min_y, dest.max_y);
+        bvh_quantize_axis(src.min_z, src.max_z, src.children, &(dest.origin[2]), &(dest.scale[2]), dest.min_z, dest.max_z);
+        for (int ci = 0; ci < BVH_WIDE_WIDTH; ++ci)
+        {
+            dest.children[ci] = src.children[ci];
+        }
+    }
+}
+
+float bvh_get_sah_cost(const std::vector<BVH>& bvhs)
+{
+    if (bvhs.empty())
+        return 0.f;
+
+    float root_area = aabb_get_surface_area(&(bvhs.back().aabb));
+    if (root_area <= 0.f)
+        return 0.f;
+
+    float cost = 0.f;
+    for (const BVH& bvh : bvhs)
+    {
+        cost += aabb_get_surface_area(&(bvh.aabb));
+    }
+    return cost / root_area;
+}
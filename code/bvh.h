@@ -0,0 +1,50 @@
+#ifndef __BVH_H__
+#define __BVH_H__
+
+#include "obj.h"
+
+// bvh builders and tree quality tools. The nodes follow the layout used by ObjData::Shape :
+// bvhs[0, leaf_count) are the leaves, the internal nodes are appended after their children
+// and the root is the last node.
+
+// builds the internal nodes over the leaves bvhs[0, leaf_count), which need their aabb and center.
+// bvhs needs room for 2 * leaf_count - 1 nodes. The big subtrees are built on thread_count threads.
+// A node index only depends on the leaf ranges, so the tree is the same for any thread_count.
+// Returns the node count.
+int bvh_build(BVH* bvhs, int leaf_count, BVHBuilder builder, int thread_count, int* out_max_depth);
+
+// Kensler's tree rotations : swaps a child with a grandchild on the other side whenever
+// it shrinks the surface area of the modified child. The internal nodes are renumbered
+// afterwards so the children are still before their parent. Returns the new max depth.
+int bvh_optimize_rotations(std::vector<BVH>* bvhs, int leaf_count, int pass_count);
+
+// the faces in depth first leaf order. A subtree of at most leaf_size faces is a single leaf whose faces
+// are face_indices[firsts[i], firsts[i] + counts[i]) for its bvhs index i. Every leaf starts at a multiple
+// of leaf_alignment, the slots between two leaves repeat the last face of the first one.
+struct BVHLeafOrder
+{
+    int leaf_size;
+    std::vector<int> firsts;
+    std::vector<int> counts;
+    std::vector<int> face_indices;
+};
+
+void bvh_get_leaf_order(const std::vector<BVH>& bvhs, int leaf_size, int leaf_alignment, BVHLeafOrder* out_leaf_order);
+
+static inline bool bvh_is_leaf_in_order(const BVHLeafOrder* leaf_order, int bvh_index)
+{
+    return leaf_order->counts[bvh_index] <= leaf_order->leaf_size;
+}
+
+// depth first copy of the tree without the construction data, with the leaves of leaf_order.
+// out_order[i] is the bvhs index of out_nodes[i].
+void bvh_linearize(const std::vector<BVH>& bvhs, const BVHLeafOrder& leaf_order, BVHNodeArray* out_nodes, std::vector<int>* out_order);
+
+// quantizes every node of the wide tree, the node indices are the same
+void bvh_quantize_wide(const std::vector<BVHWide>& wide_bvhs, std::vector<BVHWideQuantized, AlignedAllocator<BVHWideQuantized, 64>>* out_nodes);
+
+// expected cost of a closest point query : sum of the node surface areas relative to the root,
+// 1 per internal node traversal and 1 per triangle test.
+float bvh_get_sah_cost(const std::vector<BVH>& bvhs);
+
+#endif
@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <chrono>
+
+#include "common.h"
+#include "obj.h"
+#include "bvh.h"
+
+// compares the bvh builders : build time of the tree, and time of closest point queries through it
+static void print_usage()
+{
+    printf("usage: bvh_benchmark <mesh.obj> [options]\n");
+    printf("  -s, --scale <float>     model scale (default 1.0)\n");
+    printf("  -t, --threads <int>     build thread count, 0 uses every core (default 0)\n");
+    printf("  -q, --queries <int>     random query points per builder (default 100000)\n");
+    printf("  -r, --repeats <int>     builds per builder, the fastest one is reported (default 5)\n");
+    printf("  -Q, --quantize          query the quantized bvh\n");
+    printf("  -l, --leaf <int>        faces per bvh leaf, 1 to 8 (default %d)\n", BVH_LEAF_DEFAULT_FACES);
+    printf("  -T, --triangle-table    query through the precomputed triangle data\n");
+    printf("  -m, --max-distance <float>  radius of the queries, 0 is unbounded (default 0)\n");
+}
+
+static bool is_option(const char* arg, const char* short_name, const char* long_name)
+{
+    return strcmp(arg, short_name) == 0 || strcmp(arg, long_name) == 0;
+}
+
+static double elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// xorshift, the query points are the same for every builder
+static float random_float(uint32_t* state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return (float)(x >> 8) / (float)(1 << 24);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        print_usage();
+        return 1;
+    }
+
+    const char* mesh_path = argv[1];
+
+    ObjLoadConfig config;
+    int query_count = 100000;
+    int repeat_count = 5;
+    float max_distance = 0.f;
+    for (int ai = 2; ai < argc; ++ai)
+    {
+        const char* arg = argv[ai];
+        if (is_option(arg, "-Q", "--quantize"))
+        {
+            config.bvh_quantize = true;
+            continue;
+        }
+
+        if (is_option(arg, "-T", "--triangle-table"))
+        {
+            config.triangle_table = true;
+            continue;
+        }
+
+        if (ai + 1 >= argc)
+        {
+            printf("Missing value for %s\n", arg);
+            print_usage();
+            return 1;
+        }
+
+        const char* value = argv[++ai];
+        if (is_option(arg, "-s", "--scale"))
+        {
+            config.model_scale = (float)atof(value);
+        }
+        else if (is_option(arg, "-t", "--threads"))
+        {
+            config.thread_count = atoi(value);
+        }
+        else if (is_option(arg, "-q", "--queries"))
+        {
+            query_count = atoi(value);
+        }
+        else if (is_option(arg, "-r", "--repeats"))
+        {
+            repeat_count = atoi(value);
+        }
+        else if (is_option(arg, "-m", "--max-distance"))
+        {
+            max_distance = (float)atof(value);
+        }
+        else if (is_option(arg, "-l", "--leaf"))
+        {
+            config.bvh_leaf_size = atoi(value);
+        }
+        else
+        {
+            printf("Unknown option %s\n", arg);
+            print_usage();
+            return 1;
+        }
+    }
+
+    if (config.model_scale <= 0.f || config.thread_count < 0 || query_count <= 0 || repeat_count <= 0 || max_distance < 0.f || config.bvh_leaf_size < 1 || config.bvh_leaf_size > BVH_LEAF_MAX_FACES)
+    {
+        printf("Invalid option value\n");
+        print_usage();
+        return 1;
+    }
+
+    if (is_file_exist(mesh_path) == false)
+    {
+        printf("Fail to find %s\n", mesh_path);
+        return 1;
+    }
+
+    // keeps bvhs for the leaves of the build timings
+    ObjLoadConfig load_config = config;
+    load_config.bvh_quantize = false;
+    ObjData* od = obj_load(mesh_path, load_config);
+
+    const BVHBuilder builders[] = { BVH_BUILDER_MEDIAN, BVH_BUILDER_SAH, BVH_BUILDER_LBVH };
+    const char* builder_names[] = { "median", "sah", "lbvh" };
+
+    for (size_t si = 0; si < od->shapes.size(); ++si)
+    {
+        ObjData::Shape& shape = od->shapes[si];
+        int face_count = (int)shape.indices.size() / 3;
+        if (face_count == 0)
+            continue;
+
+        // the queries cover the bounds of the mesh and a margin around it
+        float margin[3];
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            margin[axis] = (shape.max_positions[axis] - shape.min_positions[axis]) * 0.1f;
+        }
+
+        printf("shape %d : %d triangles\n", (int)si, face_count);
+        printf("  %-8s %12s %12s %8s %10s %10s\n", "builder", "build ms", "query us", "depth", "sah cost", "bvh MB");
+
+        std::vector<BVH> leaves(shape.bvhs.begin(), shape.bvhs.begin() + face_count);
+        std::vector<BVH> scratch(2 * face_count - 1);
+        for (int bi = 0; bi < (int)(sizeof(builders) / sizeof(builders[0])); ++bi)
+        {
+            double build_ms = DBL_MAX;
+            for (int ri = 0; ri < repeat_count; ++ri)
+            {
+                memcpy(scratch.data(), leaves.data(), sizeof(BVH) * face_count);
+
+                int max_depth;
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                bvh_build(scratch.data(), face_count, builders[bi], config.thread_count, &max_depth);
+                double ms = elapsed_ms(start);
+                if (ms < build_ms)
+                    build_ms = ms;
+            }
+
+            ObjLoadConfig build_config = config;
+            build_config.bvh_builder = builders[bi];
+            shape_build_bvh(&shape, build_config);
+
+            uint32_t random_state = 0x9e3779b9u;
+            float checksum = 0.f;
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            for (int qi = 0; qi < query_count; ++qi)
+            {
+                Vector3 q;
+                for (int axis = 0; axis < 3; ++axis)
+                {
+                    float t = random_float(&random_state);
+                    q.v[axis] = shape.min_positions[axis] - margin[axis] + t * (shape.max_positions[axis] - shape.min_positions[axis] + 2.f * margin[axis]);
+                }
+
+                float squared_distance;
+                Vector3 closest_point;
+                int face_index;
+                TriangleFeature feature;
+                if (max_distance > 0.f)
+                {
+                    if (minimum_squared_distance_within(&shape, q, max_distance, &squared_distance, &closest_point, &face_index, &feature))
+                        checksum += squared_distance;
+                }
+                else
+                {
+                    minimum_squared_distance(&shape, q, &squared_distance, &closest_point, &face_index, &feature);
+                    checksum += squared_distance;
+                }
+            }
+            double query_us = elapsed_ms(start) * 1000.0 / query_count;
+
+            double memory_mb = (double)shape_get_bvh_memory_size(&shape) / (1024.0 * 1024.0);
+            printf("  %-8s %12.2f %12.3f %8d %10.2f %10.2f   (checksum %g)\n", builder_names[bi], build_ms, query_us, shape.bvh_max_depth, shape.bvh_sah_cost, memory_mb, checksum);
+        }
+    }
+
+    obj_unload(od);
+
+    return 0;
+}
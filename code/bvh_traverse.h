@@ -0,0 +1,397 @@
+#ifndef __BVH_TRAVERSE_H__
+#define __BVH_TRAVERSE_H__
+
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+
+#include "obj.h"
+#include "geometry_algorithm.h"
+
+// queries over Shape::bvh_nodes. A query is a visitor given to one of the two traversal loops, which keep their
+// stack in a fixed array and never allocate. shape_build_bvh rebuilds the trees deeper than the stack with the
+// median split. The loops still check the stack, a deeper tree stops the traversal and they return false.
+#define BVH_TRAVERSE_STACK_SIZE 128
+
+// Visitor of bvh_traverse, in any order :
+//   bool visit_node(const BVHNode* node, int node_index) : false culls the node and its subtree. Called for the leaves too.
+//   bool visit_leaf(const BVHNode* node, int node_index) : the faces leaf_face_indices[offset, offset + face_count).
+//                                                          false stops the traversal.
+template<class Visitor>
+inline bool bvh_traverse(const ObjData::Shape* shape, Visitor& visitor)
+{
+    if (shape->bvh_nodes.empty())
+        return true;
+
+    int stack[BVH_TRAVERSE_STACK_SIZE];
+    int stack_index = 0;
+    const BVHNode* nodes = shape->bvh_nodes.data();
+
+    int node_index = 0;
+    while (true)
+    {
+        const BVHNode* node = &(nodes[node_index]);
+        if (visitor.visit_node(node, node_index))
+        {
+            if (node->face_count > 0)
+            {
+                if (visitor.visit_leaf(node, node_index) == false)
+                    return true;
+            }
+            else
+            {
+                // the left child is the next node, only the right one is pushed
+                assert(stack_index < BVH_TRAVERSE_STACK_SIZE);
+                if (stack_index >= BVH_TRAVERSE_STACK_SIZE)
+                    return false;
+
+                stack[stack_index] = node->offset;
+                ++stack_index;
+                node_index = node_index + 1;
+                continue;
+            }
+        }
+
+        if (stack_index <= 0)
+            break;
+
+        --stack_index;
+        node_index = stack[stack_index];
+    }
+    return true;
+}
+
+// Visitor of bvh_traverse_nearest, the closest nodes first :
+//   float node_distance(const BVHNode* node) : key of the node, the children are visited smallest first
+//   float bound() : the nodes with a key >= bound are culled. It can shrink in visit_leaf.
+//   void visit_leaf(const BVHNode* node, int node_index)
+template<class Visitor>
+inline bool bvh_traverse_nearest(const ObjData::Shape* shape, Visitor& visitor)
+{
+    if (shape->bvh_nodes.empty())
+        return true;
+
+    int stack[BVH_TRAVERSE_STACK_SIZE];
+    float stack_distances[BVH_TRAVERSE_STACK_SIZE];
+    int stack_index = 0;
+    const BVHNode* nodes = shape->bvh_nodes.data();
+
+    int node_index = 0;
+    if (visitor.node_distance(&(nodes[0])) >= visitor.bound())
+        return true;
+
+    while (true)
+    {
+        const BVHNode* node = &(nodes[node_index]);
+        if (node->face_count > 0)
+        {
+            visitor.visit_leaf(node, node_index);
+        }
+        else
+        {
+            int near_index = node_index + 1;
+            int far_index = node->offset;
+            float near_distance = visitor.node_distance(&(nodes[near_index]));
+            float far_distance = visitor.node_distance(&(nodes[far_index]));
+            if (far_distance < near_distance)
+            {
+                int index = near_index; near_index = far_index; far_index = index;
+                float distance = near_distance; near_distance = far_distance; far_distance = distance;
+            }
+
+            float bound = visitor.bound();
+            if (near_distance < bound)
+            {
+                if (far_distance < bound)
+                {
+                    assert(stack_index < BVH_TRAVERSE_STACK_SIZE);
+                    if (stack_index >= BVH_TRAVERSE_STACK_SIZE)
+                        return false;
+
+                    stack[stack_index] = far_index;
+                    stack_distances[stack_index] = far_distance;
+                    ++stack_index;
+                }
+                node_index = near_index;
+                continue;
+            }
+        }
+
+        // the bound may have shrunk since the entries were pushed
+        node_index = -1;
+        while (stack_index > 0)
+        {
+            --stack_index;
+            if (stack_distances[stack_index] < visitor.bound())
+            {
+                node_index = stack[stack_index];
+                break;
+            }
+        }
+        if (node_index < 0)
+            break;
+    }
+    return true;
+}
+
+static inline float bvh_node_distance_sq(const BVHNode* node, Vector3 p)
+{
+    float tx = fmaxf(fmaxf(node->min_p[0] - p.v[0], p.v[0] - node->max_p[0]), 0.f);
+    float ty = fmaxf(fmaxf(node->min_p[1] - p.v[1], p.v[1] - node->max_p[1]), 0.f);
+    float tz = fmaxf(fmaxf(node->min_p[2] - p.v[2], p.v[2] - node->max_p[2]), 0.f);
+    return tx * tx + ty * ty + tz * tz;
+}
+
+static inline bool bvh_node_overlap_aabb(const BVHNode* node, const AABB& aabb)
+{
+    return !(aabb.max_p.v[0] < node->min_p[0] || aabb.min_p.v[0] > node->max_p[0]
+        || aabb.max_p.v[1] < node->min_p[1] || aabb.min_p.v[1] > node->max_p[1]
+        || aabb.max_p.v[2] < node->min_p[2] || aabb.min_p.v[2] > node->max_p[2]);
+}
+
+// the faces whose triangle bounds overlap the box. The bounds of the leaves and of their triangles are tested,
+// so there is no false positive from a leaf that only touches the box with another triangle.
+template<class F>
+struct BVHAABBVisitor
+{
+    const ObjData::Shape* shape;
+    AABB aabb;
+    F* f;
+
+    bool visit_node(const BVHNode* node, int) const
+    {
+        return bvh_node_overlap_aabb(node, aabb);
+    }
+
+    bool visit_leaf(const BVHNode* node, int) const
+    {
+        const float* triangles = &(shape->leaf_triangles[node->offset * 9]);
+        for (int li = 0; li < node->face_count; ++li)
+        {
+            Vector3 a = triangles_get_vertex(triangles, li, 0);
+            Vector3 b = triangles_get_vertex(triangles, li, 1);
+            Vector3 c = triangles_get_vertex(triangles, li, 2);
+            bool is_overlap = true;
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                float min_v = fminf(fminf(a.v[axis], b.v[axis]), c.v[axis]);
+                float max_v = fmaxf(fmaxf(a.v[axis], b.v[axis]), c.v[axis]);
+                is_overlap = is_overlap && !(aabb.max_p.v[axis] < min_v || aabb.min_p.v[axis] > max_v);
+            }
+
+            if (is_overlap)
+                (*f)(shape->leaf_face_indices[node->offset + li]);
+        }
+        return true;
+    }
+};
+
+// the faces with a point within radius of the center
+template<class F>
+struct BVHSphereVisitor
+{
+    const ObjData::Shape* shape;
+    Vector3 center;
+    float radius_sq;
+    F* f;
+
+    bool visit_node(const BVHNode* node, int) const
+    {
+        return bvh_node_distance_sq(node, center) <= radius_sq;
+    }
+
+    bool visit_leaf(const BVHNode* node, int) const
+    {
+        const float* triangles = &(shape->leaf_triangles[node->offset * 9]);
+        for (int li = 0; li < node->face_count; ++li)
+        {
+            Vector3 point = triangle_closest_point(center, triangles_get_vertex(triangles, li, 0), triangles_get_vertex(triangles, li, 1), triangles_get_vertex(triangles, li, 2));
+            if (vector3_distance_sq(point, center) <= radius_sq)
+                (*f)(shape->leaf_face_indices[node->offset + li]);
+        }
+        return true;
+    }
+};
+
+struct BVHNearestVisitor
+{
+    const ObjData::Shape* shape;
+    Vector3 query_point;
+    float closest_dist; // squared
+    Vector3 closest_point;
+    TriangleFeature closest_feature;
+    int closest_face_index;
+
+    float node_distance(const BVHNode* node) const { return bvh_node_distance_sq(node, query_point); }
+    float bound() const { return closest_dist; }
+
+    void visit_leaf(const BVHNode* node, int)
+    {
+        Vector3 point;
+        float dist;
+        TriangleFeature feature;
+        int li = triangles_closest_point(query_point, &(shape->leaf_triangles[node->offset * 9]), node->face_count, &point, &dist, &feature);
+        if (dist < closest_dist)
+        {
+            closest_dist = dist;
+            closest_point = point;
+            closest_feature = feature;
+            closest_face_index = shape->leaf_face_indices[node->offset + li];
+        }
+    }
+};
+
+// the k closest faces, sorted by distance in the caller arrays
+struct BVHKNearestVisitor
+{
+    const ObjData::Shape* shape;
+    Vector3 query_point;
+    float max_dist; // squared
+    int k;
+    int count;
+    int* face_indices;
+    float* squared_distances;
+
+    float node_distance(const BVHNode* node) const { return bvh_node_distance_sq(node, query_point); }
+    float bound() const { return count < k ? max_dist : squared_distances[k - 1]; }
+
+    void visit_leaf(const BVHNode* node, int)
+    {
+        const float* triangles = &(shape->leaf_triangles[node->offset * 9]);
+        for (int li = 0; li < node->face_count; ++li)
+        {
+            Vector3 point = triangle_closest_point(query_point, triangles_get_vertex(triangles, li, 0), triangles_get_vertex(triangles, li, 1), triangles_get_vertex(triangles, li, 2));
+            float dist = vector3_distance_sq(point, query_point);
+            if (dist >= bound())
+                continue;
+
+            // insertion into the sorted arrays, the farthest falls off when they are full
+            int ki = count < k ? count++ : k - 1;
+            while (ki > 0 && squared_distances[ki - 1] > dist)
+            {
+                squared_distances[ki] = squared_distances[ki - 1];
+                face_indices[ki] = face_indices[ki - 1];
+                --ki;
+            }
+            squared_distances[ki] = dist;
+            face_indices[ki] = shape->leaf_face_indices[node->offset + li];
+        }
+    }
+};
+
+// the first hit of the ray, from either side of the triangles
+struct BVHRayVisitor
+{
+    const ObjData::Shape* shape;
+    Vector3 origin;
+    Vector3 dir; // normalized
+    Vector3 inv_dir;
+    float closest_t;
+    int closest_face_index;
+
+    // entry distance of the ray into the node bounds, FLT_MAX if it misses them
+    float node_distance(const BVHNode* node) const
+    {
+        float t_min = 0.f;
+        float t_max = closest_t;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            float t0 = (node->min_p[axis] - origin.v[axis]) * inv_dir.v[axis];
+            float t1 = (node->max_p[axis] - origin.v[axis]) * inv_dir.v[axis];
+            // fminf and fmaxf drop the NaN of a ray in the plane of a slab
+            t_min = fmaxf(t_min, fminf(t0, t1));
+            t_max = fminf(t_max, fmaxf(t0, t1));
+        }
+        return t_min <= t_max ? t_min : FLT_MAX;
+    }
+    float bound() const { return closest_t; }
+
+    void visit_leaf(const BVHNode* node, int)
+    {
+        const float* triangles = &(shape->leaf_triangles[node->offset * 9]);
+        for (int li = 0; li < node->face_count; ++li)
+        {
+            TriangleRayIntersect param;
+            param.a = triangles_get_vertex(triangles, li, 0);
+            param.b = triangles_get_vertex(triangles, li, 1);
+            param.c = triangles_get_vertex(triangles, li, 2);
+            param.ray_origin = origin;
+            param.ray_dir = dir;
+            if (triangle_intersect_ray(param) && param.out_t >= 0.f && param.out_t < closest_t)
+            {
+                closest_t = param.out_t;
+                closest_face_index = shape->leaf_face_indices[node->offset + li];
+            }
+        }
+    }
+};
+
+// calls f(face_index) for every face whose triangle bounds overlap aabb
+template<class F>
+inline void bvh_query_aabb(const ObjData::Shape* shape, const AABB& aabb, F f)
+{
+    BVHAABBVisitor<F> visitor = { shape, aabb, &f };
+    bvh_traverse(shape, visitor);
+}
+
+// calls f(face_index) for every face closer than radius to center
+template<class F>
+inline void bvh_query_sphere(const ObjData::Shape* shape, Vector3 center, float radius, F f)
+{
+    BVHSphereVisitor<F> visitor = { shape, center, radius * radius, &f };
+    bvh_traverse(shape, visitor);
+}
+
+// the closest face strictly within max_distance (FLT_MAX : unbounded), -1 if there is none
+inline int bvh_query_nearest(const ObjData::Shape* shape, Vector3 query_point, float max_distance, float* out_squared_distance, Vector3* out_closest_point, TriangleFeature* out_feature)
+{
+    BVHNearestVisitor visitor;
+    visitor.shape = shape;
+    visitor.query_point = query_point;
+    visitor.closest_dist = max_distance == FLT_MAX ? FLT_MAX : max_distance * max_distance;
+    visitor.closest_point = query_point;
+    visitor.closest_feature = TRIANGLE_FEATURE_FACE;
+    visitor.closest_face_index = -1;
+    bvh_traverse_nearest(shape, visitor);
+
+    *out_squared_distance = visitor.closest_dist;
+    *out_closest_point = visitor.closest_point;
+    *out_feature = visitor.closest_feature;
+    return visitor.closest_face_index;
+}
+
+// up to k faces strictly within max_distance, closest first. Returns how many were written.
+inline int bvh_query_k_nearest(const ObjData::Shape* shape, Vector3 query_point, int k, float max_distance, int* out_face_indices, float* out_squared_distances)
+{
+    if (k <= 0)
+        return 0;
+
+    BVHKNearestVisitor visitor;
+    visitor.shape = shape;
+    visitor.query_point = query_point;
+    visitor.max_dist = max_distance == FLT_MAX ? FLT_MAX : max_distance * max_distance;
+    visitor.k = k;
+    visitor.count = 0;
+    visitor.face_indices = out_face_indices;
+    visitor.squared_distances = out_squared_distances;
+    bvh_traverse_nearest(shape, visitor);
+    return visitor.count;
+}
+
+// the first face hit by the ray within [0, max_t), -1 if there is none. dir is normalized.
+inline int bvh_query_ray(const ObjData::Shape* shape, Vector3 origin, Vector3 dir, float max_t, float* out_t)
+{
+    BVHRayVisitor visitor;
+    visitor.shape = shape;
+    visitor.origin = origin;
+    visitor.dir = dir;
+    visitor.inv_dir = vector3_set3(1.f / dir.v[0], 1.f / dir.v[1], 1.f / dir.v[2]);
+    visitor.closest_t = max_t;
+    visitor.closest_face_index = -1;
+    bvh_traverse_nearest(shape, visitor);
+
+    *out_t = visitor.closest_t;
+    return visitor.closest_face_index;
+}
+
+#endif
@@ -1,7 +1,16 @@
 #include "common.h"
+#include "topology.h"
+
+#include <atomic>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#endif
 
 #if _WIN32 || _WIN64
 #include <Windows.h>
+#else
+#include <sys/stat.h>
 #endif
 
 #if _WIN32 || _WIN64
@@ -95,7 +104,7 @@ bool is_file_exist(const char* utf8_path)
 	return false;
 #else
 	struct stat sb;
-	int ret = stat(utf8Path, &sb);
+	int ret = stat(utf8_path, &sb);
 	if (ret == -1)
 		return false;
 
@@ -106,4 +115,716 @@ bool is_file_exist(const char* utf8_path)
 
 	return false;
 #endif
-}
\ No newline at end of file
+}
+static inline uint64_t morton_spread21(uint32_t v)
+{
+	uint64_t x = v & 0x1fffff;
+	x = (x | (x << 32)) & 0x1f00000000ffffull;
+	x = (x | (x << 16)) & 0x1f0000ff0000ffull;
+	x = (x | (x << 8)) & 0x100f00f00f00f00full;
+	x = (x | (x << 4)) & 0x10c30c30c30c30c3ull;
+	x = (x | (x << 2)) & 0x1249249249249249ull;
+	return x;
+}
+
+uint64_t morton_encode3(uint32_t x, uint32_t y, uint32_t z)
+{
+	return morton_spread21(x) | (morton_spread21(y) << 1) | (morton_spread21(z) << 2);
+}
+
+void* aligned_malloc(size_t size, size_t alignment)
+{
+#if defined(_MSC_VER)
+	return _aligned_malloc(size, alignment);
+#else
+	void* p = NULL;
+	if (posix_memalign(&p, alignment, size) != 0)
+		return NULL;
+
+	return p;
+#endif
+}
+
+void aligned_free(void* p)
+{
+#if defined(_MSC_VER)
+	_aligned_free(p);
+#else
+	free(p);
+#endif
+}
+
+#define SCHEDULER_MAX_WORKERS 256
+#define SCHEDULER_MAX_DEQUES 512 // the workers and the other threads which submit jobs
+#define SCHEDULER_DEQUE_SIZE 4096 // a power of 2
+#define SCHEDULER_INJECTION_QUEUE_SIZE 65536 // a power of 2
+// tries for a job before an idle thread sleeps, the first half with a pause and the rest with a yield
+#define SCHEDULER_SPIN_COUNT 64
+
+static inline void scheduler_cpu_relax()
+{
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+	_mm_pause();
+#endif
+}
+
+// the fields are atomic since a thief may read a slot while the owner writes it again,
+// a thief which read a stale slot fails its compare exchange on top and drops it
+struct SchedulerSlot
+{
+	std::atomic<Job> function;
+	std::atomic<void*> argument;
+	std::atomic<JobGroup*> group;
+};
+
+// Chase-Lev deque, the C11 version of Le et al. "Correct and Efficient Work-Stealing for Weak Memory Models".
+// Only the owner pushes and pops at the bottom, any thread steals at the top. The size is fixed, push fails when it is full.
+struct WorkStealingDeque
+{
+	std::atomic<int64_t> top;
+	std::atomic<int64_t> bottom;
+	SchedulerSlot slots[SCHEDULER_DEQUE_SIZE];
+
+	WorkStealingDeque()
+		: top(0), bottom(0)
+	{
+	}
+};
+
+static bool deque_push(WorkStealingDeque* deque, const QueueElement& qe)
+{
+	int64_t b = deque->bottom.load(std::memory_order_relaxed);
+	int64_t t = deque->top.load(std::memory_order_acquire);
+	if (b - t >= SCHEDULER_DEQUE_SIZE)
+		return false;
+
+	SchedulerSlot& slot = deque->slots[b & (SCHEDULER_DEQUE_SIZE - 1)];
+	slot.function.store(qe.function, std::memory_order_relaxed);
+	slot.argument.store(qe.argument, std::memory_order_relaxed);
+	slot.group.store(qe.group, std::memory_order_relaxed);
+	// a release store rather than a release fence : the same code, and ThreadSanitizer, which ignores
+	// the fences, sees the thieves synchronize with the push
+	deque->bottom.store(b + 1, std::memory_order_release);
+	return true;
+}
+
+static inline void deque_read_slot(WorkStealingDeque* deque, int64_t index, QueueElement* out_qe)
+{
+	SchedulerSlot& slot = deque->slots[index & (SCHEDULER_DEQUE_SIZE - 1)];
+	out_qe->function = slot.function.load(std::memory_order_relaxed);
+	out_qe->argument = slot.argument.load(std::memory_order_relaxed);
+	out_qe->group = slot.group.load(std::memory_order_relaxed);
+}
+
+static bool deque_pop(WorkStealingDeque* deque, QueueElement* out_qe)
+{
+	int64_t b = deque->bottom.load(std::memory_order_relaxed) - 1;
+	deque->bottom.store(b, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t t = deque->top.load(std::memory_order_relaxed);
+	if (t > b)
+	{
+		deque->bottom.store(b + 1, std::memory_order_relaxed);
+		return false;
+	}
+
+	deque_read_slot(deque, b, out_qe);
+	if (t == b)
+	{
+		// the last job, a thief may be taking it
+		bool won = deque->top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+		deque->bottom.store(b + 1, std::memory_order_relaxed);
+		return won;
+	}
+
+	return true;
+}
+
+static bool deque_steal(WorkStealingDeque* deque, QueueElement* out_qe)
+{
+	int64_t t = deque->top.load(std::memory_order_acquire);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	int64_t b = deque->bottom.load(std::memory_order_acquire);
+	if (t >= b)
+		return false;
+
+	deque_read_slot(deque, t, out_qe);
+	return deque->top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+}
+
+static inline bool deque_is_empty(WorkStealingDeque* deque)
+{
+	return deque->top.load(std::memory_order_relaxed) >= deque->bottom.load(std::memory_order_relaxed);
+}
+
+// bounded MPMC queue of Dmitry Vyukov, every slot has a sequence number telling whose turn it is
+struct InjectionQueueCell
+{
+	std::atomic<size_t> sequence;
+	QueueElement element;
+};
+
+struct InjectionQueue
+{
+	std::atomic<size_t> enqueue_position;
+	std::atomic<size_t> dequeue_position;
+	std::vector<InjectionQueueCell> cells;
+
+	InjectionQueue()
+		: enqueue_position(0), dequeue_position(0), cells(SCHEDULER_INJECTION_QUEUE_SIZE)
+	{
+		for (size_t i = 0; i < cells.size(); ++i)
+		{
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+};
+
+static bool injection_queue_push(InjectionQueue* queue, const QueueElement& qe)
+{
+	size_t position = queue->enqueue_position.load(std::memory_order_relaxed);
+	InjectionQueueCell* cell;
+	while (true)
+	{
+		cell = &(queue->cells[position & (SCHEDULER_INJECTION_QUEUE_SIZE - 1)]);
+		size_t sequence = cell->sequence.load(std::memory_order_acquire);
+		intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+		if (difference == 0)
+		{
+			if (queue->enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+				break;
+		}
+		else if (difference < 0)
+		{
+			return false;
+		}
+		else
+		{
+			position = queue->enqueue_position.load(std::memory_order_relaxed);
+		}
+	}
+
+	cell->element = qe;
+	cell->sequence.store(position + 1, std::memory_order_release);
+	return true;
+}
+
+static bool injection_queue_pop(InjectionQueue* queue, QueueElement* out_qe)
+{
+	size_t position = queue->dequeue_position.load(std::memory_order_relaxed);
+	InjectionQueueCell* cell;
+	while (true)
+	{
+		cell = &(queue->cells[position & (SCHEDULER_INJECTION_QUEUE_SIZE - 1)]);
+		size_t sequence = cell->sequence.load(std::memory_order_acquire);
+		intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+		if (difference == 0)
+		{
+			if (queue->dequeue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+				break;
+		}
+		else if (difference < 0)
+		{
+			return false;
+		}
+		else
+		{
+			position = queue->dequeue_position.load(std::memory_order_relaxed);
+		}
+	}
+
+	*out_qe = cell->element;
+	cell->sequence.store(position + SCHEDULER_INJECTION_QUEUE_SIZE, std::memory_order_release);
+	return true;
+}
+
+static inline bool injection_queue_is_empty(InjectionQueue* queue)
+{
+	return queue->dequeue_position.load(std::memory_order_relaxed) >= queue->enqueue_position.load(std::memory_order_relaxed);
+}
+
+struct Scheduler
+{
+	InjectionQueue injection_queue;
+	WorkStealingDeque* deques[SCHEDULER_MAX_DEQUES];
+	std::atomic<int> deque_count; // deques[0, deque_count) are ready
+	std::atomic<int> worker_count;
+	std::vector<std::thread> threads;
+	std::mutex reserve_mutex; // the threads and the deques
+	int configured_thread_count; // 0 : not fixed
+	bool pin_threads;
+
+	// sleeping threads. A thread announces itself in sleeper_count, checks for work once more and sleeps until
+	// the epoch changes. The submitters and the last job of a group only lock when someone sleeps.
+	std::mutex park_mutex;
+	std::condition_variable park_condition;
+	std::atomic<int> sleeper_count;
+	uint64_t epoch;
+	std::atomic<bool> shutdown;
+
+	Scheduler()
+		: deque_count(0), worker_count(0), configured_thread_count(0), pin_threads(false), sleeper_count(0), epoch(0), shutdown(false)
+	{
+	}
+
+	~Scheduler()
+	{
+		park_mutex.lock();
+		shutdown.store(true);
+		++epoch;
+		park_condition.notify_all();
+		park_mutex.unlock();
+
+		for (std::thread& t : threads)
+		{
+			t.join();
+		}
+
+		for (int di = 0; di < deque_count.load(); ++di)
+		{
+			delete deques[di];
+		}
+	}
+};
+
+#define SCHEDULER_NO_DEQUE -1
+#define SCHEDULER_DEQUE_UNASSIGNED -2
+static thread_local int scheduler_deque_index = SCHEDULER_DEQUE_UNASSIGNED;
+static thread_local int scheduler_numa_node = 0;
+
+static Scheduler& scheduler_get()
+{
+	static Scheduler scheduler;
+	return scheduler;
+}
+
+// the deque of the calling thread, it gets one on its first submission. A waiting thread pops the jobs it
+// submitted last first, so a nested join runs its own jobs before the older ones. SCHEDULER_NO_DEQUE when
+// every deque is taken, the thread submits to the injection queue then.
+static int scheduler_get_deque(Scheduler& scheduler)
+{
+	if (scheduler_deque_index != SCHEDULER_DEQUE_UNASSIGNED)
+		return scheduler_deque_index;
+
+	std::lock_guard<std::mutex> lg(scheduler.reserve_mutex);
+	int deque_index = scheduler.deque_count.load(std::memory_order_relaxed);
+	if (deque_index < SCHEDULER_MAX_DEQUES)
+	{
+		scheduler.deques[deque_index] = new WorkStealingDeque;
+		scheduler.deque_count.store(deque_index + 1, std::memory_order_release);
+		scheduler_deque_index = deque_index;
+	}
+	else
+	{
+		scheduler_deque_index = SCHEDULER_NO_DEQUE;
+	}
+
+	return scheduler_deque_index;
+}
+
+static void scheduler_wake(Scheduler& scheduler, bool wake_all)
+{
+	// pairs with the fence of the sleeping thread : either it sees the new work or this sees it sleeping
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (scheduler.sleeper_count.load(std::memory_order_relaxed) == 0)
+		return;
+
+	scheduler.park_mutex.lock();
+	++scheduler.epoch;
+	scheduler.park_mutex.unlock();
+
+	if (wake_all)
+		scheduler.park_condition.notify_all();
+	else
+		scheduler.park_condition.notify_one();
+}
+
+static bool scheduler_has_work(Scheduler& scheduler)
+{
+	if (injection_queue_is_empty(&scheduler.injection_queue) == false)
+		return true;
+
+	int deque_count = scheduler.deque_count.load(std::memory_order_acquire);
+	for (int di = 0; di < deque_count; ++di)
+	{
+		if (deque_is_empty(scheduler.deques[di]) == false)
+			return true;
+	}
+
+	return false;
+}
+
+// group is the group the thread waits for, NULL for a worker
+static void scheduler_park(Scheduler& scheduler, JobGroup* group)
+{
+	std::unique_lock<std::mutex> ul(scheduler.park_mutex);
+	uint64_t epoch = scheduler.epoch;
+	scheduler.sleeper_count.fetch_add(1, std::memory_order_relaxed);
+	ul.unlock();
+
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	bool ready = scheduler.shutdown.load(std::memory_order_relaxed) || scheduler_has_work(scheduler) ||
+		(group != NULL && group->pending_count.load(std::memory_order_acquire) == 0);
+	if (ready == false)
+	{
+		ul.lock();
+		while (scheduler.epoch == epoch)
+		{
+			scheduler.park_condition.wait(ul);
+		}
+		ul.unlock();
+	}
+
+	scheduler.sleeper_count.fetch_sub(1, std::memory_order_relaxed);
+}
+
+static bool scheduler_find_job(Scheduler& scheduler, uint32_t* random_state, QueueElement* out_qe)
+{
+	int self = scheduler_deque_index;
+	if (self >= 0 && deque_pop(scheduler.deques[self], out_qe))
+		return true;
+
+	if (injection_queue_pop(&scheduler.injection_queue, out_qe))
+		return true;
+
+	int deque_count = scheduler.deque_count.load(std::memory_order_acquire);
+	if (deque_count == 0)
+		return false;
+
+	// xorshift, from a random victim so the thieves spread over the deques
+	uint32_t x = *random_state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*random_state = x;
+
+	int first = (int)(x % (uint32_t)deque_count);
+	for (int i = 0; i < deque_count; ++i)
+	{
+		int victim = (first + i) % deque_count;
+		if (victim != self && deque_steal(scheduler.deques[victim], out_qe))
+			return true;
+	}
+
+	return false;
+}
+
+static void scheduler_run(Scheduler& scheduler, const QueueElement& qe)
+{
+	if (qe.group->canceled.load(std::memory_order_relaxed) == false)
+		qe.function(qe.argument);
+
+	// the group may be gone once its count is 0
+	if (qe.group->pending_count.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		scheduler_wake(scheduler, true);
+}
+
+static void scheduler_worker_function(Scheduler* scheduler, int worker_index)
+{
+	if (scheduler->pin_threads)
+	{
+		// the calling thread is the first of node 0, worker i is the next one of node (i + 1) % node_count
+		const CPUTopology* topology = topology_get();
+		int node_count = (int)topology->node_cpus.size();
+		int thread_index = worker_index + 1;
+		int node = thread_index % node_count;
+		const std::vector<int>& cpus = topology->node_cpus[node];
+		if (topology_pin_current_thread(cpus[(thread_index / node_count) % cpus.size()]))
+			scheduler_numa_node = node;
+	}
+
+	// after the pinning, so the deque is on the node of the worker
+	scheduler_get_deque(*scheduler);
+	uint32_t random_state = 0x9e3779b9u * (uint32_t)(worker_index + 1);
+
+	int spin = 0;
+	while (scheduler->shutdown.load(std::memory_order_relaxed) == false)
+	{
+		QueueElement qe;
+		if (scheduler_find_job(*scheduler, &random_state, &qe))
+		{
+			scheduler_run(*scheduler, qe);
+			spin = 0;
+		}
+		else if (spin < SCHEDULER_SPIN_COUNT)
+		{
+			if (spin < SCHEDULER_SPIN_COUNT / 2)
+				scheduler_cpu_relax();
+			else
+				std::this_thread::yield();
+			++spin;
+		}
+		else
+		{
+			scheduler_park(*scheduler, NULL);
+			spin = 0;
+		}
+	}
+}
+
+int scheduler_reserve(int thread_count)
+{
+	Scheduler& scheduler = scheduler_get();
+	int configured_thread_count = scheduler.configured_thread_count;
+	if (configured_thread_count > 0 && (thread_count <= 0 || thread_count > configured_thread_count))
+		thread_count = configured_thread_count;
+
+	if (thread_count <= 0)
+		thread_count = (int)std::thread::hardware_concurrency();
+	if (thread_count <= 0)
+		thread_count = 1;
+	if (thread_count > SCHEDULER_MAX_WORKERS + 1)
+		thread_count = SCHEDULER_MAX_WORKERS + 1;
+
+	if (scheduler.worker_count.load(std::memory_order_acquire) >= thread_count - 1)
+		return thread_count;
+
+	std::lock_guard<std::mutex> lg(scheduler.reserve_mutex);
+	while ((int)scheduler.threads.size() < thread_count - 1)
+	{
+		int worker_index = (int)scheduler.threads.size();
+		scheduler.threads.push_back(std::thread(scheduler_worker_function, &scheduler, worker_index));
+		scheduler.worker_count.store(worker_index + 1, std::memory_order_release);
+	}
+
+	return thread_count;
+}
+
+// to the deque of the calling thread, or the injection queue when it is full. When both are full the job runs here.
+static void scheduler_push(Scheduler& scheduler, const QueueElement& qe)
+{
+	int self = scheduler_get_deque(scheduler);
+	if (self >= 0 && deque_push(scheduler.deques[self], qe))
+		return;
+
+	if (injection_queue_push(&scheduler.injection_queue, qe))
+		return;
+
+	scheduler_run(scheduler, qe);
+}
+
+void scheduler_submit(JobGroup* group, Job function, void* argument)
+{
+	Scheduler& scheduler = scheduler_get();
+	group->pending_count.fetch_add(1, std::memory_order_relaxed);
+	scheduler_push(scheduler, { function, argument, group });
+	scheduler_wake(scheduler, false);
+}
+
+void scheduler_submit_batch(JobGroup* group, Job function, void* arguments, size_t argument_stride, size_t count)
+{
+	if (count == 0)
+		return;
+
+	Scheduler& scheduler = scheduler_get();
+	group->pending_count.fetch_add((int)count, std::memory_order_relaxed);
+	for (size_t i = 0; i < count; ++i)
+	{
+		scheduler_push(scheduler, { function, (uint8_t*)arguments + i * argument_stride, group });
+	}
+	scheduler_wake(scheduler, count > 1);
+}
+
+void scheduler_wait(JobGroup* group)
+{
+	Scheduler& scheduler = scheduler_get();
+	uint32_t random_state = 0x85ebca6bu ^ (uint32_t)(uintptr_t)group;
+
+	int spin = 0;
+	while (group->pending_count.load(std::memory_order_acquire) > 0)
+	{
+		// any queued job, it may be one the group is waiting for through another group
+		QueueElement qe;
+		if (scheduler_find_job(scheduler, &random_state, &qe))
+		{
+			scheduler_run(scheduler, qe);
+			spin = 0;
+		}
+		else if (spin < SCHEDULER_SPIN_COUNT)
+		{
+			if (spin < SCHEDULER_SPIN_COUNT / 2)
+				scheduler_cpu_relax();
+			else
+				std::this_thread::yield();
+			++spin;
+		}
+		else
+		{
+			scheduler_park(scheduler, group);
+			spin = 0;
+		}
+	}
+
+	group->canceled.store(false, std::memory_order_relaxed);
+}
+
+void scheduler_cancel(JobGroup* group)
+{
+	group->canceled.store(true, std::memory_order_relaxed);
+}
+
+void scheduler_configure(int thread_count, bool pin_threads)
+{
+	Scheduler& scheduler = scheduler_get();
+	{
+		std::lock_guard<std::mutex> lg(scheduler.reserve_mutex);
+		assert(scheduler.threads.empty());
+		scheduler.configured_thread_count = thread_count > 0 ? thread_count : 0;
+		scheduler.pin_threads = pin_threads;
+	}
+
+	scheduler_reserve(thread_count);
+}
+
+int scheduler_get_numa_node()
+{
+	return scheduler_numa_node;
+}
+
+struct ParallelForContext
+{
+	ParallelForJob job;
+	void* argument;
+	size_t end;
+	size_t grain_size;
+	size_t thread_count;
+	std::atomic<size_t> next;
+};
+
+static void parallel_for_work(void* param)
+{
+	ParallelForContext& context = *(ParallelForContext*)param;
+
+	size_t chunk_begin = context.next.load(std::memory_order_relaxed);
+	while (true)
+	{
+		size_t chunk_end;
+		do
+		{
+			if (chunk_begin >= context.end)
+				return;
+
+			// guided chunks : large while there is a lot left, grain_size at the end
+			size_t remaining = context.end - chunk_begin;
+			size_t chunk_size = remaining / (2 * context.thread_count);
+			if (chunk_size < context.grain_size) chunk_size = context.grain_size;
+			if (chunk_size > remaining) chunk_size = remaining;
+			chunk_end = chunk_begin + chunk_size;
+		} while (context.next.compare_exchange_weak(chunk_begin, chunk_end, std::memory_order_relaxed) == false);
+
+		context.job(context.argument, chunk_begin, chunk_end);
+		chunk_begin = context.next.load(std::memory_order_relaxed);
+	}
+}
+
+void parallel_for(size_t begin, size_t end, size_t grain_size, int thread_count, ParallelForJob job, void* argument)
+{
+	if (begin >= end)
+		return;
+
+	if (thread_count <= 0)
+		thread_count = (int)std::thread::hardware_concurrency();
+
+	size_t chunk_count = (end - begin + grain_size - 1) / (grain_size > 0 ? grain_size : 1);
+	if (thread_count <= 1 || chunk_count <= 1)
+	{
+		job(argument, begin, end);
+		return;
+	}
+
+	ParallelForContext context;
+	context.job = job;
+	context.argument = argument;
+	context.end = end;
+	context.grain_size = grain_size > 0 ? grain_size : 1;
+	context.thread_count = (size_t)thread_count < chunk_count ? (size_t)thread_count : chunk_count;
+	context.next.store(begin);
+
+	ThreadPool tp((int)context.thread_count);
+	tp.EnqueueJobs(parallel_for_work, &context, 0, context.thread_count);
+	tp.Join(ThreadPool::SHUTDOWN_GRACEFULLY);
+}
+
+int task_graph_add(TaskGraph* graph, Job function, void* argument)
+{
+	TaskGraphNode node;
+	node.function = function;
+	node.argument = argument;
+	node.dependency_count = 0;
+	graph->nodes.push_back(node);
+
+	return (int)graph->nodes.size() - 1;
+}
+
+void task_graph_add_dependency(TaskGraph* graph, int before, int after)
+{
+	assert(before != after);
+	graph->nodes[before].successors.push_back(after);
+	++graph->nodes[after].dependency_count;
+}
+
+struct TaskGraphRun;
+
+struct TaskGraphRunNode
+{
+	TaskGraphRun* run;
+	const TaskGraphNode* node;
+	std::atomic<int> remaining_dependency_count;
+};
+
+struct TaskGraphRun
+{
+	std::vector<TaskGraphRunNode> nodes;
+	JobGroup group;
+};
+
+static void task_graph_work(void* argument)
+{
+	TaskGraphRunNode* run_node = (TaskGraphRunNode*)argument;
+	TaskGraphRun* run = run_node->run;
+
+	while (run_node != NULL)
+	{
+		const TaskGraphNode* node = run_node->node;
+		node->function(node->argument);
+
+		// the first ready successor continues on this thread, so a chain runs to its end before the
+		// other roots. The others are submitted before this job ends, so the group can't reach 0 early.
+		run_node = NULL;
+		for (int successor : node->successors)
+		{
+			TaskGraphRunNode& successor_node = run->nodes[successor];
+			if (successor_node.remaining_dependency_count.fetch_sub(1, std::memory_order_acq_rel) != 1)
+				continue;
+
+			if (run_node == NULL)
+				run_node = &successor_node;
+			else
+				scheduler_submit(&(run->group), task_graph_work, &successor_node);
+		}
+	}
+}
+
+void task_graph_run(const TaskGraph* graph, int thread_count)
+{
+	scheduler_reserve(thread_count);
+
+	TaskGraphRun run;
+	run.nodes = std::vector<TaskGraphRunNode>(graph->nodes.size());
+	for (size_t ni = 0; ni < graph->nodes.size(); ++ni)
+	{
+		TaskGraphRunNode& run_node = run.nodes[ni];
+		run_node.run = &run;
+		run_node.node = &(graph->nodes[ni]);
+		run_node.remaining_dependency_count.store(graph->nodes[ni].dependency_count, std::memory_order_relaxed);
+	}
+
+	// in reverse since the deque of this thread pops the last one first, so the first root starts first
+	for (size_t ni = graph->nodes.size(); ni > 0; --ni)
+	{
+		if (graph->nodes[ni - 1].dependency_count == 0)
+			scheduler_submit(&(run.group), task_graph_work, &(run.nodes[ni - 1]));
+	}
+
+	scheduler_wait(&(run.group));
+}
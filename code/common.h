@@ -3,12 +3,19 @@
 
 #include <math.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 #include <assert.h>
 #include <vector>
 #include <unordered_map>
 #include <condition_variable>
-#include <queue>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <new>
+#include <memory>
+#include <utility>
+#include <stdlib.h>
 
 #define PID 3.14159265359
 #define PIF 3.14159265359f
@@ -26,12 +33,50 @@
 #endif
 
 typedef void(*Job)(void*);
+
+// counts the unfinished jobs submitted with it, scheduler_wait returns when it is back to 0
+struct JobGroup
+{
+    std::atomic<int> pending_count;
+    std::atomic<bool> canceled; // the jobs which haven't started yet are dropped
+
+    JobGroup()
+        : pending_count(0), canceled(false)
+    {
+    }
+};
+
 struct QueueElement
 {
     Job function;
     void* argument;
+    JobGroup* group;
 };
 
+// The process wide workers. They are created on the first use and stay alive until the process exits,
+// so a fork/join costs no thread creation. Every thread which submits jobs gets a Chase-Lev deque : it pushes
+// and pops its jobs at the bottom and the idle threads steal from the top. A lock-free queue takes the jobs
+// when a deque is full. An idle worker spins for a while before it sleeps.
+// A thread waiting for a group runs the queued jobs meanwhile, which lets a job wait for the jobs it submitted
+// (nested fork/join) without blocking a worker.
+
+// grows the workers so that thread_count threads run jobs, the waiting thread being one of them.
+// thread_count <= 0 uses every hardware thread. Returns the resolved thread_count.
+int scheduler_reserve(int thread_count);
+void scheduler_submit(JobGroup* group, Job function, void* argument);
+// job i gets (uint8_t*)arguments + i * argument_stride, a stride of 0 gives every job the same argument
+void scheduler_submit_batch(JobGroup* group, Job function, void* arguments, size_t argument_stride, size_t count);
+void scheduler_wait(JobGroup* group);
+void scheduler_cancel(JobGroup* group);
+// call before the first job. thread_count > 0 fixes the threads of the process, the reserves don't go past it.
+// pin_threads pins every worker to one cpu, taking the NUMA nodes in turn so the workers spread over the sockets.
+// The calling thread counts as the first one and stays where it is.
+void scheduler_configure(int thread_count, bool pin_threads);
+// NUMA node of the calling thread, 0 unless it is a pinned worker
+int scheduler_get_numa_node();
+
+// fork/join on the process wide scheduler. Join waits for the jobs of this pool only and keeps the workers,
+// so pools can be created per call and inside the jobs of another pool.
 class ThreadPool
 {
 public:
@@ -42,99 +87,84 @@ public:
         SHUTDOWN_GRACEFULLY = (1 << 1)
     };
 
-    ThreadPool()
-        : _shutdownFlag(0)
+    // threadCount <= 0 uses every hardware thread
+    ThreadPool(int threadCount = 0)
+        : _joined(false)
     {
-        _threadCount = std::thread::hardware_concurrency();
-        _threads.resize(_threadCount);
-        for (int i = 0; i < _threadCount; ++i)
-        {
-            _threads[i] = std::thread(&ThreadPool::_threadpoolWorkerFunction, this);
-        }
+        _threadCount = scheduler_reserve(threadCount);
     }
 
     ~ThreadPool()
     {
-        if (_threadCount != 0)
+        if (_joined == false)
         {
             Join(SHUTDOWN_IMMEDIATE);
         }
     }
 
+    // SHUTDOWN_IMMEDIATE drops the jobs which haven't started yet, SHUTDOWN_GRACEFULLY runs every job
     void Join(int flag)
     {
-        _mutex.lock();
-
-        _shutdownFlag = flag;
-        _condition.notify_all();
-
-        _mutex.unlock();
-
-        for (std::thread& t : _threads)
+        if (flag == SHUTDOWN_IMMEDIATE)
         {
-            t.join();
+            scheduler_cancel(&_group);
         }
 
-        _threads.clear();
-        _threadCount = 0;
+        scheduler_wait(&_group);
+        _joined = true;
     }
 
     void EnqueueJob(Job f, void* argument)
     {
-        _mutex.lock();
-
-        _queue.push({ f, argument });
-        _condition.notify_one();
+        _joined = false;
+        scheduler_submit(&_group, f, argument);
+    }
 
-        _mutex.unlock();
+    // count jobs on one submission, see scheduler_submit_batch
+    void EnqueueJobs(Job f, void* arguments, size_t argumentStride, size_t count)
+    {
+        _joined = false;
+        scheduler_submit_batch(&_group, f, arguments, argumentStride, count);
     }
 
-    size_t GetThreadCount() const { return _threads.size(); }
+    size_t GetThreadCount() const { return (size_t)_threadCount; }
 
 private:
 
-    int _shutdownFlag;
-
     int _threadCount;
-    std::vector<std::thread> _threads;
-    std::queue<QueueElement> _queue;
-
-    std::mutex _mutex;
-    std::condition_variable _condition;
-
-    void _threadpoolWorkerFunction()
-    {
-        ThreadPool* tp = this;
-
-        while (true)
-        {
-            std::unique_lock<std::mutex> ul(tp->_mutex);
-
-            tp->_condition.wait
-            (
-                ul,
-                [tp]
-                {
-                    return (tp->_queue.size() > 0 || tp->_shutdownFlag != 0);
-                }
-            );
-
-            if (tp->_shutdownFlag == SHUTDOWN_IMMEDIATE ||
-                (tp->_shutdownFlag == SHUTDOWN_GRACEFULLY && tp->_queue.size() == 0))
-            {
-                break;
-            }
+    bool _joined;
+    JobGroup _group;
+};
 
-            QueueElement qe = tp->_queue.front();
-            tp->_queue.pop();
+// job(argument, chunk_begin, chunk_end) over [begin, end) on thread_count threads, 0 uses every hardware thread.
+// The threads take chunks from an atomic counter, so a slow part of the range doesn't stall the others.
+// A chunk is remaining / (2 * thread count) items and shrinks down to grain_size near the end of the range.
+typedef void(*ParallelForJob)(void* argument, size_t begin, size_t end);
+void parallel_for(size_t begin, size_t end, size_t grain_size, int thread_count, ParallelForJob job, void* argument);
 
-            ul.unlock();
+// jobs with dependencies, which have to form a DAG. A node is submitted to the scheduler as soon as
+// the last node it depends on finishes, so independent chains overlap instead of running stage by stage.
+struct TaskGraphNode
+{
+    Job function;
+    void* argument;
+    std::vector<int> successors;
+    int dependency_count;
+};
 
-            qe.function(qe.argument);
-        }
-    }
+struct TaskGraph
+{
+    std::vector<TaskGraphNode> nodes;
 };
 
+// returns the index of the node
+int task_graph_add(TaskGraph* graph, Job function, void* argument);
+// the node after starts once the node before is done
+void task_graph_add_dependency(TaskGraph* graph, int before, int after);
+// runs every node on thread_count threads (0 uses every hardware thread) and returns when they are all done.
+// The graph can be run again.
+void task_graph_run(const TaskGraph* graph, int thread_count);
+
 #if _WIN32 || _WIN64
 // win32 specific function. You don't need to use these functions on another platform
 void str_widen(const char* str, int strLenWithNULL, wchar_t* buffer, int bufferByteSize);
@@ -147,4 +177,77 @@ void file_open_fill_buffer(const char* path, std::vector<char>& buffer);
 
 bool is_file_exist(const char* utf8_path);
 
+// interleaves the low 21 bits of x, y and z, x in the lowest bit
+uint64_t morton_encode3(uint32_t x, uint32_t y, uint32_t z);
+
+void* aligned_malloc(size_t size, size_t alignment);
+void aligned_free(void* p);
+
+// std::allocator whose resize(n) leaves the new elements uninitialized instead of zeroing them,
+// so the pages of a big array are first touched by the threads which fill it
+template<class T>
+struct DefaultInitAllocator : public std::allocator<T>
+{
+    template<class U>
+    struct rebind
+    {
+        typedef DefaultInitAllocator<U> other;
+    };
+
+    DefaultInitAllocator() {}
+
+    template<class U>
+    DefaultInitAllocator(const DefaultInitAllocator<U>&) {}
+
+    template<class U>
+    void construct(U* p)
+    {
+        ::new((void*)p) U;
+    }
+
+    template<class U, class... Args>
+    void construct(U* p, Args&&... args)
+    {
+        ::new((void*)p) U(std::forward<Args>(args)...);
+    }
+};
+
+// std::allocator only honors the alignments above alignof(max_align_t) from C++17
+template<class T, size_t Alignment>
+struct AlignedAllocator
+{
+    typedef T value_type;
+
+    template<class U>
+    struct rebind
+    {
+        typedef AlignedAllocator<U, Alignment> other;
+    };
+
+    AlignedAllocator() {}
+
+    template<class U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T* allocate(size_t n)
+    {
+        void* p = aligned_malloc(n * sizeof(T), Alignment);
+        if (p == NULL)
+            throw std::bad_alloc();
+
+        return (T*)p;
+    }
+
+    void deallocate(T* p, size_t)
+    {
+        aligned_free(p);
+    }
+
+    template<class U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+
+    template<class U>
+    bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
 #endif
\ No newline at end of file
@@ -0,0 +1,469 @@
+#include "distance_packet.h"
+
+#include <float.h>
+
+#include "common.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+
+// one register of query point coordinates
+#define PACKET_LANE_WIDTH 8
+typedef __m256 PacketLane;
+typedef __m256i PacketLaneInt;
+
+static inline PacketLane lane_load(const float* v) { return _mm256_loadu_ps(v); }
+static inline void lane_store(float* out_v, PacketLane v) { _mm256_storeu_ps(out_v, v); }
+static inline PacketLane lane_set1(float v) { return _mm256_set1_ps(v); }
+static inline PacketLane lane_add(PacketLane a, PacketLane b) { return _mm256_add_ps(a, b); }
+static inline PacketLane lane_sub(PacketLane a, PacketLane b) { return _mm256_sub_ps(a, b); }
+static inline PacketLane lane_mul(PacketLane a, PacketLane b) { return _mm256_mul_ps(a, b); }
+static inline PacketLane lane_div(PacketLane a, PacketLane b) { return _mm256_div_ps(a, b); }
+static inline PacketLane lane_max(PacketLane a, PacketLane b) { return _mm256_max_ps(a, b); }
+static inline PacketLane lane_and(PacketLane a, PacketLane b) { return _mm256_and_ps(a, b); }
+static inline PacketLane lane_lt(PacketLane a, PacketLane b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+static inline PacketLane lane_le(PacketLane a, PacketLane b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+static inline PacketLane lane_ge(PacketLane a, PacketLane b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+static inline PacketLane lane_select(PacketLane mask, PacketLane if_true, PacketLane if_false) { return _mm256_blendv_ps(if_false, if_true, mask); }
+static inline bool lane_any(PacketLane mask) { return _mm256_movemask_ps(mask) != 0; }
+
+static inline float lane_horizontal_min(PacketLane v)
+{
+    __m128 m = _mm_min_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    m = _mm_min_ps(m, _mm_movehl_ps(m, m));
+    m = _mm_min_ss(m, _mm_shuffle_ps(m, m, 1));
+    return _mm_cvtss_f32(m);
+}
+
+static inline float lane_horizontal_max(PacketLane v)
+{
+    __m128 m = _mm_max_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+    m = _mm_max_ss(m, _mm_shuffle_ps(m, m, 1));
+    return _mm_cvtss_f32(m);
+}
+
+static inline PacketLaneInt lane_set1_int(int v) { return _mm256_set1_epi32(v); }
+static inline void lane_store_int(int* out_v, PacketLaneInt v) { _mm256_storeu_si256((__m256i*)out_v, v); }
+static inline PacketLaneInt lane_select_int(PacketLane mask, PacketLaneInt if_true, PacketLaneInt if_false)
+{
+    return _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(if_false), _mm256_castsi256_ps(if_true), mask));
+}
+#elif defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+
+#define PACKET_LANE_WIDTH 4
+typedef __m128 PacketLane;
+typedef __m128i PacketLaneInt;
+
+static inline PacketLane lane_load(const float* v) { return _mm_loadu_ps(v); }
+static inline void lane_store(float* out_v, PacketLane v) { _mm_storeu_ps(out_v, v); }
+static inline PacketLane lane_set1(float v) { return _mm_set1_ps(v); }
+static inline PacketLane lane_add(PacketLane a, PacketLane b) { return _mm_add_ps(a, b); }
+static inline PacketLane lane_sub(PacketLane a, PacketLane b) { return _mm_sub_ps(a, b); }
+static inline PacketLane lane_mul(PacketLane a, PacketLane b) { return _mm_mul_ps(a, b); }
+static inline PacketLane lane_div(PacketLane a, PacketLane b) { return _mm_div_ps(a, b); }
+static inline PacketLane lane_max(PacketLane a, PacketLane b) { return _mm_max_ps(a, b); }
+static inline PacketLane lane_and(PacketLane a, PacketLane b) { return _mm_and_ps(a, b); }
+static inline PacketLane lane_lt(PacketLane a, PacketLane b) { return _mm_cmplt_ps(a, b); }
+static inline PacketLane lane_le(PacketLane a, PacketLane b) { return _mm_cmple_ps(a, b); }
+static inline PacketLane lane_ge(PacketLane a, PacketLane b) { return _mm_cmpge_ps(a, b); }
+// SSE2 has no blendv, the masks are all ones or all zeros per lane
+static inline PacketLane lane_select(PacketLane mask, PacketLane if_true, PacketLane if_false) { return _mm_or_ps(_mm_and_ps(mask, if_true), _mm_andnot_ps(mask, if_false)); }
+static inline bool lane_any(PacketLane mask) { return _mm_movemask_ps(mask) != 0; }
+
+static inline float lane_horizontal_min(PacketLane v)
+{
+    __m128 m = _mm_min_ps(v, _mm_movehl_ps(v, v));
+    m = _mm_min_ss(m, _mm_shuffle_ps(m, m, 1));
+    return _mm_cvtss_f32(m);
+}
+
+static inline float lane_horizontal_max(PacketLane v)
+{
+    __m128 m = _mm_max_ps(v, _mm_movehl_ps(v, v));
+    m = _mm_max_ss(m, _mm_shuffle_ps(m, m, 1));
+    return _mm_cvtss_f32(m);
+}
+
+static inline PacketLaneInt lane_set1_int(int v) { return _mm_set1_epi32(v); }
+static inline void lane_store_int(int* out_v, PacketLaneInt v) { _mm_storeu_si128((__m128i*)out_v, v); }
+static inline PacketLaneInt lane_select_int(PacketLane mask, PacketLaneInt if_true, PacketLaneInt if_false)
+{
+    __m128i m = _mm_castps_si128(mask);
+    return _mm_or_si128(_mm_and_si128(m, if_true), _mm_andnot_si128(m, if_false));
+}
+#endif
+
+#if defined(PACKET_LANE_WIDTH)
+// a packet is this many registers, they share the node fetches and the triangle loads
+#define PACKET_REGISTER_COUNT (DISTANCE_PACKET_SIZE / PACKET_LANE_WIDTH)
+
+// the same operation order as the scalar vector3_ functions, so the lanes give the same floats
+
+static inline PacketLane lane_dot(PacketLane ax, PacketLane ay, PacketLane az, PacketLane bx, PacketLane by, PacketLane bz)
+{
+    return lane_add(lane_add(lane_mul(ax, bx), lane_mul(ay, by)), lane_mul(az, bz));
+}
+
+// triangle_closest_point for a register of query points. Every region is evaluated and the first matching one
+// in the order of the scalar branches is selected.
+static inline void triangle_closest_point_lanes
+(
+    PacketLane px, PacketLane py, PacketLane pz,
+    Vector3 a, Vector3 b, Vector3 c,
+    PacketLane* out_x, PacketLane* out_y, PacketLane* out_z, PacketLaneInt* out_feature
+)
+{
+    const PacketLane zero = lane_set1(0.f);
+
+    PacketLane ax = lane_set1(a.v[0]), ay = lane_set1(a.v[1]), az = lane_set1(a.v[2]);
+    PacketLane bx = lane_set1(b.v[0]), by = lane_set1(b.v[1]), bz = lane_set1(b.v[2]);
+    PacketLane cx = lane_set1(c.v[0]), cy = lane_set1(c.v[1]), cz = lane_set1(c.v[2]);
+
+    Vector3 ab = vector3_sub(b, a);
+    Vector3 ac = vector3_sub(c, a);
+    Vector3 bc = vector3_sub(c, b);
+    PacketLane abx = lane_set1(ab.v[0]), aby = lane_set1(ab.v[1]), abz = lane_set1(ab.v[2]);
+    PacketLane acx = lane_set1(ac.v[0]), acy = lane_set1(ac.v[1]), acz = lane_set1(ac.v[2]);
+
+    PacketLane d1 = lane_dot(abx, aby, abz, lane_sub(px, ax), lane_sub(py, ay), lane_sub(pz, az));
+    PacketLane d2 = lane_dot(acx, acy, acz, lane_sub(px, ax), lane_sub(py, ay), lane_sub(pz, az));
+    PacketLane d3 = lane_dot(abx, aby, abz, lane_sub(px, bx), lane_sub(py, by), lane_sub(pz, bz));
+    PacketLane d4 = lane_dot(acx, acy, acz, lane_sub(px, bx), lane_sub(py, by), lane_sub(pz, bz));
+    PacketLane d5 = lane_dot(abx, aby, abz, lane_sub(px, cx), lane_sub(py, cy), lane_sub(pz, cz));
+    PacketLane d6 = lane_dot(acx, acy, acz, lane_sub(px, cx), lane_sub(py, cy), lane_sub(pz, cz));
+
+    PacketLane vc = lane_sub(lane_mul(d1, d4), lane_mul(d3, d2));
+    PacketLane vb = lane_sub(lane_mul(d5, d2), lane_mul(d1, d6));
+    PacketLane va = lane_sub(lane_mul(d3, d6), lane_mul(d5, d4));
+
+    // face
+    PacketLane denom = lane_div(lane_set1(1.f), lane_add(lane_add(va, vb), vc));
+    PacketLane v = lane_mul(vb, denom);
+    PacketLane w = lane_mul(vc, denom);
+    PacketLane rx = lane_add(ax, lane_add(lane_mul(abx, v), lane_mul(acx, w)));
+    PacketLane ry = lane_add(ay, lane_add(lane_mul(aby, v), lane_mul(acy, w)));
+    PacketLane rz = lane_add(az, lane_add(lane_mul(abz, v), lane_mul(acz, w)));
+    PacketLaneInt feature = lane_set1_int(TRIANGLE_FEATURE_FACE);
+
+    // edge bc
+    PacketLane d43 = lane_sub(d4, d3);
+    PacketLane d56 = lane_sub(d5, d6);
+    PacketLane mask = lane_and(lane_le(va, zero), lane_and(lane_ge(d43, zero), lane_ge(d56, zero)));
+    w = lane_div(d43, lane_add(d43, d56));
+    rx = lane_select(mask, lane_add(bx, lane_mul(lane_set1(bc.v[0]), w)), rx);
+    ry = lane_select(mask, lane_add(by, lane_mul(lane_set1(bc.v[1]), w)), ry);
+    rz = lane_select(mask, lane_add(bz, lane_mul(lane_set1(bc.v[2]), w)), rz);
+    feature = lane_select_int(mask, lane_set1_int(TRIANGLE_FEATURE_EDGE_BC), feature);
+
+    // edge ca
+    mask = lane_and(lane_le(vb, zero), lane_and(lane_ge(d2, zero), lane_le(d6, zero)));
+    w = lane_div(d2, lane_sub(d2, d6));
+    rx = lane_select(mask, lane_add(ax, lane_mul(acx, w)), rx);
+    ry = lane_select(mask, lane_add(ay, lane_mul(acy, w)), ry);
+    rz = lane_select(mask, lane_add(az, lane_mul(acz, w)), rz);
+    feature = lane_select_int(mask, lane_set1_int(TRIANGLE_FEATURE_EDGE_CA), feature);
+
+    // vertex c
+    mask = lane_and(lane_ge(d6, zero), lane_le(d5, d6));
+    rx = lane_select(mask, cx, rx);
+    ry = lane_select(mask, cy, ry);
+    rz = lane_select(mask, cz, rz);
+    feature = lane_select_int(mask, lane_set1_int(TRIANGLE_FEATURE_VERTEX_C), feature);
+
+    // edge ab
+    mask = lane_and(lane_le(vc, zero), lane_and(lane_ge(d1, zero), lane_le(d3, zero)));
+    v = lane_div(d1, lane_sub(d1, d3));
+    rx = lane_select(mask, lane_add(ax, lane_mul(abx, v)), rx);
+    ry = lane_select(mask, lane_add(ay, lane_mul(aby, v)), ry);
+    rz = lane_select(mask, lane_add(az, lane_mul(abz, v)), rz);
+    feature = lane_select_int(mask, lane_set1_int(TRIANGLE_FEATURE_EDGE_AB), feature);
+
+    // vertex b
+    mask = lane_and(lane_ge(d3, zero), lane_le(d4, d3));
+    rx = lane_select(mask, bx, rx);
+    ry = lane_select(mask, by, ry);
+    rz = lane_select(mask, bz, rz);
+    feature = lane_select_int(mask, lane_set1_int(TRIANGLE_FEATURE_VERTEX_B), feature);
+
+    // vertex a
+    mask = lane_and(lane_le(d1, zero), lane_le(d2, zero));
+    rx = lane_select(mask, ax, rx);
+    ry = lane_select(mask, ay, ry);
+    rz = lane_select(mask, az, rz);
+    feature = lane_select_int(mask, lane_set1_int(TRIANGLE_FEATURE_VERTEX_A), feature);
+
+    *out_x = rx;
+    *out_y = ry;
+    *out_z = rz;
+    *out_feature = feature;
+}
+
+static inline PacketLane aabb_distance_exterior_sq_lanes(float min_x, float min_y, float min_z, float max_x, float max_y, float max_z, PacketLane px, PacketLane py, PacketLane pz)
+{
+    const PacketLane zero = lane_set1(0.f);
+    PacketLane tx = lane_max(lane_max(lane_sub(lane_set1(min_x), px), lane_sub(px, lane_set1(max_x))), zero);
+    PacketLane ty = lane_max(lane_max(lane_sub(lane_set1(min_y), py), lane_sub(py, lane_set1(max_y))), zero);
+    PacketLane tz = lane_max(lane_max(lane_sub(lane_set1(min_z), pz), lane_sub(pz, lane_set1(max_z))), zero);
+    return lane_add(lane_add(lane_mul(tx, tx), lane_mul(ty, ty)), lane_mul(tz, tz));
+}
+
+// squared distances of the query points of a register to the child bounds ci of the wide node
+static inline PacketLane aabb_distance_exterior_sq_lanes(const BVHWide* node, int ci, PacketLane px, PacketLane py, PacketLane pz)
+{
+    return aabb_distance_exterior_sq_lanes(node->min_x[ci], node->min_y[ci], node->min_z[ci], node->max_x[ci], node->max_y[ci], node->max_z[ci], px, py, pz);
+}
+
+static inline PacketLane aabb_distance_exterior_sq_lanes(const BVHWideQuantized* node, int ci, PacketLane px, PacketLane py, PacketLane pz)
+{
+    float min_x = node->origin[0] + (float)node->min_x[ci] * node->scale[0];
+    float min_y = node->origin[1] + (float)node->min_y[ci] * node->scale[1];
+    float min_z = node->origin[2] + (float)node->min_z[ci] * node->scale[2];
+    float max_x = node->origin[0] + (float)node->max_x[ci] * node->scale[0];
+    float max_y = node->origin[1] + (float)node->max_y[ci] * node->scale[1];
+    float max_z = node->origin[2] + (float)node->max_z[ci] * node->scale[2];
+    return aabb_distance_exterior_sq_lanes(min_x, min_y, min_z, max_x, max_y, max_z, px, py, pz);
+}
+
+static inline void shape_get_triangle(const ObjData::Shape* shape, int face_index, Vector3* out_a, Vector3* out_b, Vector3* out_c)
+{
+    int fi = face_index * 3;
+    *out_a = vector3_setp(&(shape->positions[shape->indices[fi] * 3]));
+    *out_b = vector3_setp(&(shape->positions[shape->indices[fi + 1] * 3]));
+    *out_c = vector3_setp(&(shape->positions[shape->indices[fi + 2] * 3]));
+}
+
+// the closest point state of the packet, PACKET_REGISTER_COUNT registers of lanes
+struct PacketLanes
+{
+    PacketLane px[PACKET_REGISTER_COUNT];
+    PacketLane py[PACKET_REGISTER_COUNT];
+    PacketLane pz[PACKET_REGISTER_COUNT];
+    PacketLane closest_dist[PACKET_REGISTER_COUNT];
+    PacketLane closest_x[PACKET_REGISTER_COUNT];
+    PacketLane closest_y[PACKET_REGISTER_COUNT];
+    PacketLane closest_z[PACKET_REGISTER_COUNT];
+    PacketLaneInt closest_face[PACKET_REGISTER_COUNT];
+    PacketLaneInt closest_feature[PACKET_REGISTER_COUNT];
+};
+
+// the lanes of register ri that are closer to triangle abc than their closest face take it
+static inline void packet_lanes_update(PacketLanes* lanes, int ri, Vector3 a, Vector3 b, Vector3 c, int face_index)
+{
+    PacketLane px = lanes->px[ri], py = lanes->py[ri], pz = lanes->pz[ri];
+    PacketLane tx, ty, tz;
+    PacketLaneInt feature;
+    triangle_closest_point_lanes(px, py, pz, a, b, c, &tx, &ty, &tz, &feature);
+    PacketLane dist = lane_dot(lane_sub(tx, px), lane_sub(ty, py), lane_sub(tz, pz), lane_sub(tx, px), lane_sub(ty, py), lane_sub(tz, pz));
+
+    PacketLane mask = lane_lt(dist, lanes->closest_dist[ri]);
+    if (lane_any(mask) == false)
+        return;
+
+    lanes->closest_dist[ri] = lane_select(mask, dist, lanes->closest_dist[ri]);
+    lanes->closest_x[ri] = lane_select(mask, tx, lanes->closest_x[ri]);
+    lanes->closest_y[ri] = lane_select(mask, ty, lanes->closest_y[ri]);
+    lanes->closest_z[ri] = lane_select(mask, tz, lanes->closest_z[ri]);
+    lanes->closest_face[ri] = lane_select_int(mask, lane_set1_int(face_index), lanes->closest_face[ri]);
+    lanes->closest_feature[ri] = lane_select_int(mask, feature, lanes->closest_feature[ri]);
+}
+
+// Node is BVHWide or BVHWideQuantized
+template<class Node>
+static void minimum_squared_distance_packet_wide(ObjData::Shape* shape, const Node* nodes, DistancePacket* packet)
+{
+    int* stack = (int*)ALLOCA(sizeof(int) * ((BVH_WIDE_WIDTH - 1) * shape->wide_bvh_max_depth + 1));
+    float* stack_distances = (float*)ALLOCA(sizeof(float) * ((BVH_WIDE_WIDTH - 1) * shape->wide_bvh_max_depth + 1));
+    assert(stack != NULL && stack_distances != NULL);
+
+    PacketLanes lanes;
+    for (int ri = 0; ri < PACKET_REGISTER_COUNT; ++ri)
+    {
+        lanes.px[ri] = lane_load(packet->x + ri * PACKET_LANE_WIDTH);
+        lanes.py[ri] = lane_load(packet->y + ri * PACKET_LANE_WIDTH);
+        lanes.pz[ri] = lane_load(packet->z + ri * PACKET_LANE_WIDTH);
+        lanes.closest_dist[ri] = lane_set1(packet->max_distance == FLT_MAX ? FLT_MAX : packet->max_distance * packet->max_distance);
+        lanes.closest_x[ri] = lane_set1(0.f);
+        lanes.closest_y[ri] = lane_set1(0.f);
+        lanes.closest_z[ri] = lane_set1(0.f);
+        lanes.closest_face[ri] = lane_set1_int(-1);
+        lanes.closest_feature[ri] = lane_set1_int(TRIANGLE_FEATURE_FACE);
+    }
+
+    // every lane starts with the bound of its own seed face
+    int seed_faces[DISTANCE_PACKET_SIZE];
+    memcpy(seed_faces, packet->seed_face_indices, sizeof(seed_faces));
+    for (int li = 0; li < DISTANCE_PACKET_SIZE; ++li)
+    {
+        int face_index = seed_faces[li];
+        if (face_index < 0)
+            continue;
+
+        bool is_done = false;
+        for (int lj = 0; lj < li; ++lj)
+        {
+            is_done = is_done || seed_faces[lj] == face_index;
+        }
+        if (is_done)
+            continue;
+
+        Vector3 ta, tb, tc;
+        shape_get_triangle(shape, face_index, &ta, &tb, &tc);
+        for (int ri = 0; ri < PACKET_REGISTER_COUNT; ++ri)
+        {
+            packet_lanes_update(&lanes, ri, ta, tb, tc, face_index);
+        }
+    }
+
+    // a shape without faces has no tree
+    int stack_index = 0;
+    if (shape->indices.empty() == false)
+    {
+        stack[stack_index] = 0;
+        stack_distances[stack_index] = 0.f;
+        ++stack_index;
+    }
+
+    while (stack_index > 0)
+    {
+        --stack_index;
+        int child = stack[stack_index];
+
+        // the bounds may have shrunk since the entry was pushed, it is skipped when every lane rejects it
+        float max_closest_dist = lane_horizontal_max(lanes.closest_dist[0]);
+        for (int ri = 1; ri < PACKET_REGISTER_COUNT; ++ri)
+        {
+            float register_max_dist = lane_horizontal_max(lanes.closest_dist[ri]);
+            max_closest_dist = register_max_dist > max_closest_dist ? register_max_dist : max_closest_dist;
+        }
+        if (stack_distances[stack_index] >= max_closest_dist)
+            continue;
+
+        if (child < 0)
+        {
+            int first = BVH_WIDE_LEAF_FIRST(child);
+            int count = BVH_WIDE_LEAF_COUNT(child);
+            const float* triangles = &(shape->leaf_triangles[first * 9]);
+            const TrianglePrecomputed* table = shape->leaf_triangle_table.empty() ? NULL : &(shape->leaf_triangle_table[first]);
+            for (int li = 0; li < count; ++li)
+            {
+                if (table != NULL)
+                {
+                    // skip the triangle when its plane is farther than the current closest distance of every lane
+                    const TrianglePrecomputed& t = table[li];
+                    bool is_near = false;
+                    for (int ri = 0; ri < PACKET_REGISTER_COUNT && is_near == false; ++ri)
+                    {
+                        PacketLane plane = lane_dot(lane_set1(t.normal.v[0]), lane_set1(t.normal.v[1]), lane_set1(t.normal.v[2]),
+                            lane_sub(lanes.px[ri], lane_set1(t.a.v[0])), lane_sub(lanes.py[ri], lane_set1(t.a.v[1])), lane_sub(lanes.pz[ri], lane_set1(t.a.v[2])));
+                        PacketLane bound = lane_mul(lane_mul(plane, plane), lane_set1(t.inv_normal_length_sq));
+                        is_near = lane_any(lane_lt(bound, lanes.closest_dist[ri]));
+                    }
+                    if (is_near == false)
+                        continue;
+                }
+
+                Vector3 ta = triangles_get_vertex(triangles, li, 0);
+                Vector3 tb = triangles_get_vertex(triangles, li, 1);
+                Vector3 tc = triangles_get_vertex(triangles, li, 2);
+                for (int ri = 0; ri < PACKET_REGISTER_COUNT; ++ri)
+                {
+                    packet_lanes_update(&lanes, ri, ta, tb, tc, shape->leaf_face_indices[first + li]);
+                }
+            }
+            continue;
+        }
+
+        // a child is visited if any lane can still find a closer triangle in it.
+        // The children are pushed farthest first, by the nearest lane, so the nearest is visited first.
+        const Node* node = &(nodes[child]);
+        float child_min_dist[BVH_WIDE_WIDTH];
+        int order[BVH_WIDE_WIDTH];
+        int order_count = 0;
+        for (int ci = 0; ci < BVH_WIDE_WIDTH; ++ci)
+        {
+            if (node->children[ci] == BVH_WIDE_EMPTY_CHILD)
+                continue;
+
+            bool is_near = false;
+            float min_dist = FLT_MAX;
+            for (int ri = 0; ri < PACKET_REGISTER_COUNT; ++ri)
+            {
+                PacketLane ex_dist = aabb_distance_exterior_sq_lanes(node, ci, lanes.px[ri], lanes.py[ri], lanes.pz[ri]);
+                is_near = is_near || lane_any(lane_lt(ex_dist, lanes.closest_dist[ri]));
+                float register_min_dist = lane_horizontal_min(ex_dist);
+                min_dist = register_min_dist < min_dist ? register_min_dist : min_dist;
+            }
+            if (is_near == false)
+                continue;
+
+            child_min_dist[ci] = min_dist;
+            int oi = order_count++;
+            while (oi > 0 && child_min_dist[order[oi - 1]] > child_min_dist[ci])
+            {
+                order[oi] = order[oi - 1];
+                --oi;
+            }
+            order[oi] = ci;
+        }
+
+        for (int oi = order_count - 1; oi >= 0; --oi)
+        {
+            stack[stack_index] = node->children[order[oi]];
+            stack_distances[stack_index] = child_min_dist[order[oi]];
+            ++stack_index;
+        }
+    }
+
+    for (int ri = 0; ri < PACKET_REGISTER_COUNT; ++ri)
+    {
+        lane_store(packet->squared_distances + ri * PACKET_LANE_WIDTH, lanes.closest_dist[ri]);
+        lane_store(packet->closest_x + ri * PACKET_LANE_WIDTH, lanes.closest_x[ri]);
+        lane_store(packet->closest_y + ri * PACKET_LANE_WIDTH, lanes.closest_y[ri]);
+        lane_store(packet->closest_z + ri * PACKET_LANE_WIDTH, lanes.closest_z[ri]);
+        lane_store_int(packet->face_indices + ri * PACKET_LANE_WIDTH, lanes.closest_face[ri]);
+        lane_store_int(packet->features + ri * PACKET_LANE_WIDTH, lanes.closest_feature[ri]);
+    }
+}
+
+void minimum_squared_distance_packet(ObjData::Shape* shape, DistancePacket* packet)
+{
+    if (shape->quantized_bvhs.empty() == false)
+    {
+        minimum_squared_distance_packet_wide(shape, shape->quantized_bvhs.data(), packet);
+    }
+    else
+    {
+        minimum_squared_distance_packet_wide(shape, shape->wide_bvhs.data(), packet);
+    }
+}
+
+#else
+
+void minimum_squared_distance_packet(ObjData::Shape* shape, DistancePacket* packet)
+{
+    for (int li = 0; li < DISTANCE_PACKET_SIZE; ++li)
+    {
+        Vector3 closest_point;
+        TriangleFeature feature;
+        minimum_squared_distance_within
+        (
+            shape,
+            vector3_set3(packet->x[li], packet->y[li], packet->z[li]),
+            packet->max_distance,
+            &(packet->squared_distances[li]),
+            &closest_point,
+            &(packet->face_indices[li]),
+            &feature,
+            packet->seed_face_indices[li]
+        );
+
+        packet->closest_x[li] = closest_point.v[0];
+        packet->closest_y[li] = closest_point.v[1];
+        packet->closest_z[li] = closest_point.v[2];
+        packet->features[li] = feature;
+    }
+}
+
+#endif
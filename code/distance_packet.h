@@ -0,0 +1,32 @@
+#ifndef __DISTANCE_PACKET_H__
+#define __DISTANCE_PACKET_H__
+
+#include "obj.h"
+
+// query points per packet, one AVX2 register of floats
+#define DISTANCE_PACKET_SIZE 8
+
+// neighboring query points that traverse the bvh together. Structure of arrays.
+struct DistancePacket
+{
+    float x[DISTANCE_PACKET_SIZE];
+    float y[DISTANCE_PACKET_SIZE];
+    float z[DISTANCE_PACKET_SIZE];
+    int seed_face_indices[DISTANCE_PACKET_SIZE]; // -1 : no seed
+    float max_distance; // FLT_MAX, or as minimum_squared_distance_within for every lane
+
+    // results, same as minimum_squared_distance per lane. face index -1 : nothing closer than max_distance
+    float squared_distances[DISTANCE_PACKET_SIZE];
+    float closest_x[DISTANCE_PACKET_SIZE];
+    float closest_y[DISTANCE_PACKET_SIZE];
+    float closest_z[DISTANCE_PACKET_SIZE];
+    int face_indices[DISTANCE_PACKET_SIZE];
+    int features[DISTANCE_PACKET_SIZE]; // TriangleFeature
+};
+
+// walks the wide bvh. A child is skipped only when every lane rejects it, the lanes share the node fetches.
+// The aabb distances and the triangle closest points run in the SIMD lanes, one AVX2 register or two SSE ones.
+// Without SIMD every lane runs minimum_squared_distance. Unused lanes should repeat a used query point.
+void minimum_squared_distance_packet(ObjData::Shape* shape, DistancePacket* packet);
+
+#endif
@@ -0,0 +1,182 @@
+#include "fast_sweeping.h"
+
+#include "common.h"
+
+// the sweep stops when no voxel changes more than grid_delta * FAST_SWEEPING_TOLERANCE
+#define FAST_SWEEPING_TOLERANCE 1e-4f
+#define FAST_SWEEPING_MAX_ITERATION 8
+
+struct FastSweepingWork
+{
+    float* distances;
+    const uint8_t* frozen;
+    int nx, ny, nz;
+    float grid_delta;
+    int direction_begin;
+    int direction_end;
+    float max_change;
+};
+
+static inline void sort3(float* a, float* b, float* c)
+{
+    float t;
+    if (*a > *b) { t = *a; *a = *b; *b = t; }
+    if (*b > *c) { t = *b; *b = *c; *c = t; }
+    if (*a > *b) { t = *a; *a = *b; *b = t; }
+}
+
+// first order godunov upwind update with the smallest neighbor on each axis
+static inline float eikonal_update(float a, float b, float c, float h)
+{
+    sort3(&a, &b, &c);
+
+    float u = a + h;
+    if (u <= b)
+        return u;
+
+    float d = 2.f * h * h - (a - b) * (a - b);
+    u = (a + b + sqrtf(d)) * 0.5f;
+    if (u <= c)
+        return u;
+
+    float s = a + b + c;
+    d = s * s - 3.f * (a * a + b * b + c * c - h * h);
+    if (d < 0.f)
+        d = 0.f;
+    return (s + sqrtf(d)) / 3.f;
+}
+
+// returns the largest decrease of a voxel in this sweep
+static float fast_sweeping_sweep(float* u, const uint8_t* frozen, int nx, int ny, int nz, float h, int direction)
+{
+    float max_change = 0.f;
+
+    const int slice = nx * ny;
+
+    int i_begin = (direction & 1) ? nx - 1 : 0;
+    int j_begin = (direction & 2) ? ny - 1 : 0;
+    int k_begin = (direction & 4) ? nz - 1 : 0;
+    int i_step = (direction & 1) ? -1 : 1;
+    int j_step = (direction & 2) ? -1 : 1;
+    int k_step = (direction & 4) ? -1 : 1;
+
+    for (int k = k_begin; k >= 0 && k < nz; k += k_step)
+    {
+        for (int j = j_begin; j >= 0 && j < ny; j += j_step)
+        {
+            for (int i = i_begin; i >= 0 && i < nx; i += i_step)
+            {
+                int index = (k * ny + j) * nx + i;
+                if (frozen[index] != 0)
+                    continue;
+
+                float a = FAST_SWEEPING_FAR_DISTANCE;
+                if (i > 0 && u[index - 1] < a) a = u[index - 1];
+                if (i < nx - 1 && u[index + 1] < a) a = u[index + 1];
+
+                float b = FAST_SWEEPING_FAR_DISTANCE;
+                if (j > 0 && u[index - nx] < b) b = u[index - nx];
+                if (j < ny - 1 && u[index + nx] < b) b = u[index + nx];
+
+                float c = FAST_SWEEPING_FAR_DISTANCE;
+                if (k > 0 && u[index - slice] < c) c = u[index - slice];
+                if (k < nz - 1 && u[index + slice] < c) c = u[index + slice];
+
+                if (a >= FAST_SWEEPING_FAR_DISTANCE && b >= FAST_SWEEPING_FAR_DISTANCE && c >= FAST_SWEEPING_FAR_DISTANCE)
+                    continue;
+
+                float candidate = eikonal_update(a, b, c, h);
+                if (candidate < u[index])
+                {
+                    if (u[index] - candidate > max_change)
+                        max_change = u[index] - candidate;
+
+                    u[index] = candidate;
+                }
+            }
+        }
+    }
+
+    return max_change;
+}
+
+static void fast_sweeping_work(void* param)
+{
+    FastSweepingWork& work = *(FastSweepingWork*)param;
+    work.max_change = 0.f;
+    for (int direction = work.direction_begin; direction < work.direction_end; ++direction)
+    {
+        float change = fast_sweeping_sweep(work.distances, work.frozen, work.nx, work.ny, work.nz, work.grid_delta, direction);
+        if (change > work.max_change)
+            work.max_change = change;
+    }
+}
+
+void fast_sweeping_solve(float* distances, const uint8_t* frozen, int nx, int ny, int nz, float grid_delta, int thread_count)
+{
+    const size_t voxel_count = (size_t)nx * ny * nz;
+
+    // one copy per worker. Each worker runs its share of the 8 sweep orderings on its own copy.
+    int copy_count = thread_count > 0 ? thread_count : (int)std::thread::hardware_concurrency();
+    if (copy_count < 1) copy_count = 1;
+    if (copy_count > 8) copy_count = 8;
+
+    std::vector<std::vector<float>> copies(copy_count - 1);
+    std::vector<FastSweepingWork> works(copy_count);
+
+    for (int iteration = 0; iteration < FAST_SWEEPING_MAX_ITERATION; ++iteration)
+    {
+        for (int ci = 0; ci < copy_count; ++ci)
+        {
+            FastSweepingWork& work = works[ci];
+            if (ci == 0)
+            {
+                work.distances = distances;
+            }
+            else
+            {
+                copies[ci - 1].assign(distances, distances + voxel_count);
+                work.distances = copies[ci - 1].data();
+            }
+
+            work.frozen = frozen;
+            work.nx = nx;
+            work.ny = ny;
+            work.nz = nz;
+            work.grid_delta = grid_delta;
+            work.direction_begin = 8 * ci / copy_count;
+            work.direction_end = 8 * (ci + 1) / copy_count;
+        }
+
+        if (copy_count == 1)
+        {
+            fast_sweeping_work(&works[0]);
+        }
+        else
+        {
+            ThreadPool tp(copy_count);
+            tp.EnqueueJobs(fast_sweeping_work, works.data(), sizeof(FastSweepingWork), copy_count);
+            tp.Join(ThreadPool::SHUTDOWN_GRACEFULLY);
+        }
+
+        float max_change = 0.f;
+        for (int ci = 0; ci < copy_count; ++ci)
+        {
+            if (works[ci].max_change > max_change)
+                max_change = works[ci].max_change;
+        }
+
+        for (int ci = 1; ci < copy_count; ++ci)
+        {
+            const float* copy = copies[ci - 1].data();
+            for (size_t vi = 0; vi < voxel_count; ++vi)
+            {
+                if (copy[vi] < distances[vi])
+                    distances[vi] = copy[vi];
+            }
+        }
+
+        if (max_change <= grid_delta * FAST_SWEEPING_TOLERANCE)
+            break;
+    }
+}
@@ -0,0 +1,16 @@
+#ifndef __FAST_SWEEPING_H__
+#define __FAST_SWEEPING_H__
+
+#include <stdint.h>
+
+// distance value for the voxels which are not reached yet.
+// It is finite so that the quadratic update doesn't overflow.
+#define FAST_SWEEPING_FAR_DISTANCE 1e10f
+
+// Solves the eikonal equation |grad(u)| = 1 on a uniform nx * ny * nz grid with the fast sweeping method.
+// distances[(k * ny + j) * nx + i] holds unsigned distances. Voxels with frozen[index] != 0 are the boundary condition
+// and never change; the others should start at FAST_SWEEPING_FAR_DISTANCE.
+// The 8 sweep orderings run on separate copies in parallel and are merged with min after each iteration (Zhao 2007).
+void fast_sweeping_solve(float* distances, const uint8_t* frozen, int nx, int ny, int nz, float grid_delta, int thread_count);
+
+#endif
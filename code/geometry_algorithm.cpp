@@ -1,7 +1,16 @@
 #include "geometry_algorithm.h"
 
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#endif
+
 // Real-Time Collision Detection by Christer Ericson p141-142
-Vector3 triangle_closest_point(Vector3 p, Vector3 a, Vector3 b, Vector3 c)
+Vector3 triangle_closest_point(Vector3 p, Vector3 a, Vector3 b, Vector3 c, TriangleFeature* out_feature)
 {
     Vector3 ab = vector3_sub(b, a);
     Vector3 ac = vector3_sub(c, a);
@@ -9,29 +18,43 @@ Vector3 triangle_closest_point(Vector3 p, Vector3 a, Vector3 b, Vector3 c)
     float d1 = vector3_dot(ab, ap);
     float d2 = vector3_dot(ac, ap);
 
-    if (d1 <= 0.f && d2 <= 0.f) return a;
+    if (d1 <= 0.f && d2 <= 0.f)
+    {
+        if (out_feature != NULL) *out_feature = TRIANGLE_FEATURE_VERTEX_A;
+        return a;
+    }
 
     Vector3 bp = vector3_sub(p, b);
     float d3 = vector3_dot(ab, bp);
     float d4 = vector3_dot(ac, bp);
-    if (d3 >= 0.f && d4 <= d3) return b;
+    if (d3 >= 0.f && d4 <= d3)
+    {
+        if (out_feature != NULL) *out_feature = TRIANGLE_FEATURE_VERTEX_B;
+        return b;
+    }
 
     float vc = d1 * d4 - d3 * d2;
     if (vc <= 0.f && d1 >= 0.f && d3 <= 0.f)
     {
         float v = d1 / (d1 - d3);
+        if (out_feature != NULL) *out_feature = TRIANGLE_FEATURE_EDGE_AB;
         return vector3_add(a, vector3_mul_scalar(ab, v));
     }
 
     Vector3 cp = vector3_sub(p, c);
     float d5 = vector3_dot(ab, cp);
     float d6 = vector3_dot(ac, cp);
-    if (d6 >= 0.f && d5 <= d6) return c;
+    if (d6 >= 0.f && d5 <= d6)
+    {
+        if (out_feature != NULL) *out_feature = TRIANGLE_FEATURE_VERTEX_C;
+        return c;
+    }
 
     float vb = d5 * d2 - d1 * d6;
     if (vb <= 0.f && d2 >= 0.f && d6 <= 0.f)
     {
         float  w = d2 / (d2 - d6);
+        if (out_feature != NULL) *out_feature = TRIANGLE_FEATURE_EDGE_CA;
         return vector3_add(a, vector3_mul_scalar(ac, w));
     }
 
@@ -39,15 +62,337 @@ Vector3 triangle_closest_point(Vector3 p, Vector3 a, Vector3 b, Vector3 c)
     if (va <= 0.f && (d4 - d3) >= 0.f && (d5 - d6) >= 0.f)
     {
         float w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+        if (out_feature != NULL) *out_feature = TRIANGLE_FEATURE_EDGE_BC;
         return vector3_add(b, vector3_mul_scalar(vector3_sub(c, b), w));
     }
 
     float denom = 1.f / (va + vb + vc);
+    if (out_feature != NULL) *out_feature = TRIANGLE_FEATURE_FACE;
     float v = vb * denom;
     float w = vc * denom;
     return vector3_add(a, vector3_add(vector3_mul_scalar(ab, v), vector3_mul_scalar(ac, w)));
 }
 
+#if TRIANGLES_LANE_WIDTH == 8
+typedef __m256 TrianglesLane;
+
+static inline TrianglesLane lane_load(const float* v) { return _mm256_loadu_ps(v); }
+static inline TrianglesLane lane_set1(float v) { return _mm256_set1_ps(v); }
+static inline void lane_store(float* out_v, TrianglesLane v) { _mm256_storeu_ps(out_v, v); }
+static inline TrianglesLane lane_add(TrianglesLane a, TrianglesLane b) { return _mm256_add_ps(a, b); }
+static inline TrianglesLane lane_sub(TrianglesLane a, TrianglesLane b) { return _mm256_sub_ps(a, b); }
+static inline TrianglesLane lane_mul(TrianglesLane a, TrianglesLane b) { return _mm256_mul_ps(a, b); }
+static inline TrianglesLane lane_div(TrianglesLane a, TrianglesLane b) { return _mm256_div_ps(a, b); }
+static inline TrianglesLane lane_and(TrianglesLane a, TrianglesLane b) { return _mm256_and_ps(a, b); }
+static inline TrianglesLane lane_le(TrianglesLane a, TrianglesLane b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+static inline TrianglesLane lane_ge(TrianglesLane a, TrianglesLane b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+static inline TrianglesLane lane_select(TrianglesLane mask, TrianglesLane if_true, TrianglesLane if_false) { return _mm256_blendv_ps(if_false, if_true, mask); }
+#elif TRIANGLES_LANE_WIDTH == 4
+typedef __m128 TrianglesLane;
+
+static inline TrianglesLane lane_load(const float* v) { return _mm_loadu_ps(v); }
+static inline TrianglesLane lane_set1(float v) { return _mm_set1_ps(v); }
+static inline void lane_store(float* out_v, TrianglesLane v) { _mm_storeu_ps(out_v, v); }
+static inline TrianglesLane lane_add(TrianglesLane a, TrianglesLane b) { return _mm_add_ps(a, b); }
+static inline TrianglesLane lane_sub(TrianglesLane a, TrianglesLane b) { return _mm_sub_ps(a, b); }
+static inline TrianglesLane lane_mul(TrianglesLane a, TrianglesLane b) { return _mm_mul_ps(a, b); }
+static inline TrianglesLane lane_div(TrianglesLane a, TrianglesLane b) { return _mm_div_ps(a, b); }
+static inline TrianglesLane lane_and(TrianglesLane a, TrianglesLane b) { return _mm_and_ps(a, b); }
+static inline TrianglesLane lane_le(TrianglesLane a, TrianglesLane b) { return _mm_cmple_ps(a, b); }
+static inline TrianglesLane lane_ge(TrianglesLane a, TrianglesLane b) { return _mm_cmpge_ps(a, b); }
+// SSE2 has no blendv, the masks are all ones or all zeros per lane
+static inline TrianglesLane lane_select(TrianglesLane mask, TrianglesLane if_true, TrianglesLane if_false) { return _mm_or_ps(_mm_and_ps(mask, if_true), _mm_andnot_ps(mask, if_false)); }
+#endif
+
+#if TRIANGLES_LANE_WIDTH > 1
+static inline TrianglesLane lane_dot(TrianglesLane ax, TrianglesLane ay, TrianglesLane az, TrianglesLane bx, TrianglesLane by, TrianglesLane bz)
+{
+    return lane_add(lane_add(lane_mul(ax, bx), lane_mul(ay, by)), lane_mul(az, bz));
+}
+
+// triangle_closest_point with one triangle per lane. Every region is evaluated and the first matching one
+// in the order of the scalar branches is selected, with the same operation order so the lanes give the same floats.
+// triangles is one block of the layout of triangles_get_offset.
+static inline void triangles_closest_point_lanes(Vector3 p, const float* triangles, float* out_x, float* out_y, float* out_z, float* out_squared_distance, float* out_feature)
+{
+    const TrianglesLane zero = lane_set1(0.f);
+    TrianglesLane px = lane_set1(p.v[0]), py = lane_set1(p.v[1]), pz = lane_set1(p.v[2]);
+
+    TrianglesLane ax = lane_load(triangles), ay = lane_load(triangles + TRIANGLES_LANE_WIDTH), az = lane_load(triangles + 2 * TRIANGLES_LANE_WIDTH);
+    TrianglesLane bx = lane_load(triangles + 3 * TRIANGLES_LANE_WIDTH), by = lane_load(triangles + 4 * TRIANGLES_LANE_WIDTH), bz = lane_load(triangles + 5 * TRIANGLES_LANE_WIDTH);
+    TrianglesLane cx = lane_load(triangles + 6 * TRIANGLES_LANE_WIDTH), cy = lane_load(triangles + 7 * TRIANGLES_LANE_WIDTH), cz = lane_load(triangles + 8 * TRIANGLES_LANE_WIDTH);
+
+    TrianglesLane abx = lane_sub(bx, ax), aby = lane_sub(by, ay), abz = lane_sub(bz, az);
+    TrianglesLane acx = lane_sub(cx, ax), acy = lane_sub(cy, ay), acz = lane_sub(cz, az);
+
+    TrianglesLane apx = lane_sub(px, ax), apy = lane_sub(py, ay), apz = lane_sub(pz, az);
+    TrianglesLane bpx = lane_sub(px, bx), bpy = lane_sub(py, by), bpz = lane_sub(pz, bz);
+    TrianglesLane cpx = lane_sub(px, cx), cpy = lane_sub(py, cy), cpz = lane_sub(pz, cz);
+    TrianglesLane d1 = lane_dot(abx, aby, abz, apx, apy, apz);
+    TrianglesLane d2 = lane_dot(acx, acy, acz, apx, apy, apz);
+    TrianglesLane d3 = lane_dot(abx, aby, abz, bpx, bpy, bpz);
+    TrianglesLane d4 = lane_dot(acx, acy, acz, bpx, bpy, bpz);
+    TrianglesLane d5 = lane_dot(abx, aby, abz, cpx, cpy, cpz);
+    TrianglesLane d6 = lane_dot(acx, acy, acz, cpx, cpy, cpz);
+
+    TrianglesLane vc = lane_sub(lane_mul(d1, d4), lane_mul(d3, d2));
+    TrianglesLane vb = lane_sub(lane_mul(d5, d2), lane_mul(d1, d6));
+    TrianglesLane va = lane_sub(lane_mul(d3, d6), lane_mul(d5, d4));
+
+    // face
+    TrianglesLane denom = lane_div(lane_set1(1.f), lane_add(lane_add(va, vb), vc));
+    TrianglesLane v = lane_mul(vb, denom);
+    TrianglesLane w = lane_mul(vc, denom);
+    TrianglesLane rx = lane_add(ax, lane_add(lane_mul(abx, v), lane_mul(acx, w)));
+    TrianglesLane ry = lane_add(ay, lane_add(lane_mul(aby, v), lane_mul(acy, w)));
+    TrianglesLane rz = lane_add(az, lane_add(lane_mul(abz, v), lane_mul(acz, w)));
+    TrianglesLane feature = lane_set1((float)TRIANGLE_FEATURE_FACE);
+
+    // edge bc
+    TrianglesLane d43 = lane_sub(d4, d3);
+    TrianglesLane d56 = lane_sub(d5, d6);
+    TrianglesLane mask = lane_and(lane_le(va, zero), lane_and(lane_ge(d43, zero), lane_ge(d56, zero)));
+    w = lane_div(d43, lane_add(d43, d56));
+    rx = lane_select(mask, lane_add(bx, lane_mul(lane_sub(cx, bx), w)), rx);
+    ry = lane_select(mask, lane_add(by, lane_mul(lane_sub(cy, by), w)), ry);
+    rz = lane_select(mask, lane_add(bz, lane_mul(lane_sub(cz, bz), w)), rz);
+    feature = lane_select(mask, lane_set1((float)TRIANGLE_FEATURE_EDGE_BC), feature);
+
+    // edge ca
+    mask = lane_and(lane_le(vb, zero), lane_and(lane_ge(d2, zero), lane_le(d6, zero)));
+    w = lane_div(d2, lane_sub(d2, d6));
+    rx = lane_select(mask, lane_add(ax, lane_mul(acx, w)), rx);
+    ry = lane_select(mask, lane_add(ay, lane_mul(acy, w)), ry);
+    rz = lane_select(mask, lane_add(az, lane_mul(acz, w)), rz);
+    feature = lane_select(mask, lane_set1((float)TRIANGLE_FEATURE_EDGE_CA), feature);
+
+    // vertex c
+    mask = lane_and(lane_ge(d6, zero), lane_le(d5, d6));
+    rx = lane_select(mask, cx, rx);
+    ry = lane_select(mask, cy, ry);
+    rz = lane_select(mask, cz, rz);
+    feature = lane_select(mask, lane_set1((float)TRIANGLE_FEATURE_VERTEX_C), feature);
+
+    // edge ab
+    mask = lane_and(lane_le(vc, zero), lane_and(lane_ge(d1, zero), lane_le(d3, zero)));
+    v = lane_div(d1, lane_sub(d1, d3));
+    rx = lane_select(mask, lane_add(ax, lane_mul(abx, v)), rx);
+    ry = lane_select(mask, lane_add(ay, lane_mul(aby, v)), ry);
+    rz = lane_select(mask, lane_add(az, lane_mul(abz, v)), rz);
+    feature = lane_select(mask, lane_set1((float)TRIANGLE_FEATURE_EDGE_AB), feature);
+
+    // vertex b
+    mask = lane_and(lane_ge(d3, zero), lane_le(d4, d3));
+    rx = lane_select(mask, bx, rx);
+    ry = lane_select(mask, by, ry);
+    rz = lane_select(mask, bz, rz);
+    feature = lane_select(mask, lane_set1((float)TRIANGLE_FEATURE_VERTEX_B), feature);
+
+    // vertex a
+    mask = lane_and(lane_le(d1, zero), lane_le(d2, zero));
+    rx = lane_select(mask, ax, rx);
+    ry = lane_select(mask, ay, ry);
+    rz = lane_select(mask, az, rz);
+    feature = lane_select(mask, lane_set1((float)TRIANGLE_FEATURE_VERTEX_A), feature);
+
+    TrianglesLane dx = lane_sub(rx, px), dy = lane_sub(ry, py), dz = lane_sub(rz, pz);
+    lane_store(out_x, rx);
+    lane_store(out_y, ry);
+    lane_store(out_z, rz);
+    lane_store(out_squared_distance, lane_dot(dx, dy, dz, dx, dy, dz));
+    lane_store(out_feature, feature);
+}
+#endif
+
+int triangles_closest_point(Vector3 p, const float* triangles, int triangle_count, Vector3* out_closest_point, float* out_squared_distance, TriangleFeature* out_feature)
+{
+    assert(triangle_count >= 1 && triangle_count <= TRIANGLES_CLOSEST_POINT_MAX_COUNT);
+
+    int closest_index = 0;
+    float closest_dist = FLT_MAX;
+
+#if TRIANGLES_LANE_WIDTH > 1
+    float xs[TRIANGLES_LANE_WIDTH], ys[TRIANGLES_LANE_WIDTH], zs[TRIANGLES_LANE_WIDTH];
+    float dists[TRIANGLES_LANE_WIDTH], features[TRIANGLES_LANE_WIDTH];
+    float closest_x = 0.f, closest_y = 0.f, closest_z = 0.f, closest_feature = 0.f;
+
+    for (int base = 0; base < triangle_count; base += TRIANGLES_LANE_WIDTH)
+    {
+        // the lanes of the block after triangle_count are computed and skipped
+        int lane_count = triangle_count - base < TRIANGLES_LANE_WIDTH ? triangle_count - base : TRIANGLES_LANE_WIDTH;
+        triangles_closest_point_lanes(p, triangles + base * 9, xs, ys, zs, dists, features);
+
+        for (int li = 0; li < lane_count; ++li)
+        {
+            if (dists[li] < closest_dist)
+            {
+                closest_dist = dists[li];
+                closest_index = base + li;
+                closest_x = xs[li];
+                closest_y = ys[li];
+                closest_z = zs[li];
+                closest_feature = features[li];
+            }
+        }
+    }
+
+    Vector3 closest_point = { closest_x, closest_y, closest_z };
+    *out_closest_point = closest_point;
+    *out_squared_distance = closest_dist;
+    *out_feature = (TriangleFeature)(int)closest_feature;
+#else
+    Vector3 closest_point = { 0.f, 0.f, 0.f };
+    TriangleFeature closest_feature = TRIANGLE_FEATURE_FACE;
+    for (int ti = 0; ti < triangle_count; ++ti)
+    {
+        TriangleFeature feature;
+        Vector3 point = triangle_closest_point(p, triangles_get_vertex(triangles, ti, 0), triangles_get_vertex(triangles, ti, 1), triangles_get_vertex(triangles, ti, 2), &feature);
+        float dist = vector3_distance_sq(point, p);
+        if (dist < closest_dist)
+        {
+            closest_dist = dist;
+            closest_index = ti;
+            closest_point = point;
+            closest_feature = feature;
+        }
+    }
+    *out_closest_point = closest_point;
+    *out_squared_distance = closest_dist;
+    *out_feature = closest_feature;
+#endif
+
+    return closest_index;
+}
+
+void triangle_precompute(Vector3 a, Vector3 b, Vector3 c, TrianglePrecomputed* out_triangle)
+{
+    TrianglePrecomputed& t = *out_triangle;
+    t.a = a;
+    t.ab = vector3_sub(b, a);
+    t.ac = vector3_sub(c, a);
+    t.normal = vector3_cross(t.ab, t.ac);
+
+    Vector3 bc = vector3_sub(c, b);
+    t.ab_dot_ab = vector3_dot(t.ab, t.ab);
+    t.ab_dot_ac = vector3_dot(t.ab, t.ac);
+    t.ac_dot_ac = vector3_dot(t.ac, t.ac);
+    float bc_length_sq = vector3_dot(bc, bc);
+    float normal_length_sq = vector3_dot(t.normal, t.normal);
+
+    // degenerate edges and faces keep 0 so the products below stay finite
+    t.inv_ab_length_sq = t.ab_dot_ab > 0.f ? 1.f / t.ab_dot_ab : 0.f;
+    t.inv_ac_length_sq = t.ac_dot_ac > 0.f ? 1.f / t.ac_dot_ac : 0.f;
+    t.inv_bc_length_sq = bc_length_sq > 0.f ? 1.f / bc_length_sq : 0.f;
+    t.inv_normal_length_sq = normal_length_sq > 0.f ? 1.f / normal_length_sq : 0.f;
+
+    // the centroid sphere, at most a few percent larger than the smallest one for regular meshes
+    t.sphere_center = vector3_mul_scalar(vector3_add(a, vector3_add(b, c)), 1.f / 3.f);
+    float radius_sq = vector3_distance_sq(t.sphere_center, a);
+    float rb = vector3_distance_sq(t.sphere_center, b);
+    float rc = vector3_distance_sq(t.sphere_center, c);
+    if (rb > radius_sq) radius_sq = rb;
+    if (rc > radius_sq) radius_sq = rc;
+    t.sphere_radius = sqrtf(radius_sq);
+    t.padding = 0.f;
+}
+
+// Ericson p141-142 with d3 = d1 - ab.ab, d4 = d2 - ab.ac, d5 = d1 - ab.ac, d6 = d2 - ac.ac
+// and the denominators of the edges and the face replaced by the squared lengths of the edges and the normal.
+Vector3 triangle_closest_point_precomputed(Vector3 p, const TrianglePrecomputed* triangle, TriangleFeature* out_feature)
+{
+    const TrianglePrecomputed& t = *triangle;
+    Vector3 ap = vector3_sub(p, t.a);
+    float d1 = vector3_dot(t.ab, ap);
+    float d2 = vector3_dot(t.ac, ap);
+
+    if (d1 <= 0.f && d2 <= 0.f)
+    {
+        if (out_feature != NULL) *out_feature = TRIANGLE_FEATURE_VERTEX_A;
+        return t.a;
+    }
+
+    float d3 = d1 - t.ab_dot_ab;
+    float d4 = d2 - t.ab_dot_ac;
+    if (d3 >= 0.f && d4 <= d3)
+    {
+        if (out_feature != NULL) *out_feature = TRIANGLE_FEATURE_VERTEX_B;
+        return vector3_add(t.a, t.ab);
+    }
+
+    float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0.f && d1 >= 0.f && d3 <= 0.f)
+    {
+        if (out_feature != NULL) *out_feature = TRIANGLE_FEATURE_EDGE_AB;
+        return vector3_add(t.a, vector3_mul_scalar(t.ab, d1 * t.inv_ab_length_sq));
+    }
+
+    float d5 = d1 - t.ab_dot_ac;
+    float d6 = d2 - t.ac_dot_ac;
+    if (d6 >= 0.f && d5 <= d6)
+    {
+        if (out_feature != NULL) *out_feature = TRIANGLE_FEATURE_VERTEX_C;
+        return vector3_add(t.a, t.ac);
+    }
+
+    float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0.f && d2 >= 0.f && d6 <= 0.f)
+    {
+        if (out_feature != NULL) *out_feature = TRIANGLE_FEATURE_EDGE_CA;
+        return vector3_add(t.a, vector3_mul_scalar(t.ac, d2 * t.inv_ac_length_sq));
+    }
+
+    float va = d3 * d6 - d5 * d4;
+    if (va <= 0.f && (d4 - d3) >= 0.f && (d5 - d6) >= 0.f)
+    {
+        float w = (d4 - d3) * t.inv_bc_length_sq;
+        if (out_feature != NULL) *out_feature = TRIANGLE_FEATURE_EDGE_BC;
+        return vector3_add(vector3_add(t.a, t.ab), vector3_mul_scalar(vector3_sub(t.ac, t.ab), w));
+    }
+
+    // va + vb + vc = |ab x ac|^2
+    if (out_feature != NULL) *out_feature = TRIANGLE_FEATURE_FACE;
+    float v = vb * t.inv_normal_length_sq;
+    float w = vc * t.inv_normal_length_sq;
+    return vector3_add(t.a, vector3_add(vector3_mul_scalar(t.ab, v), vector3_mul_scalar(t.ac, w)));
+}
+
+float triangle_distance_sq_lower_bound(Vector3 p, const TrianglePrecomputed* triangle)
+{
+    const TrianglePrecomputed& t = *triangle;
+    float plane = vector3_dot(t.normal, vector3_sub(p, t.a));
+    float bound = plane * plane * t.inv_normal_length_sq;
+
+    float center_dist_sq = vector3_distance_sq(p, t.sphere_center);
+    if (center_dist_sq > t.sphere_radius * t.sphere_radius)
+    {
+        float sphere = sqrtf(center_dist_sq) - t.sphere_radius;
+        if (sphere * sphere > bound)
+            bound = sphere * sphere;
+    }
+    return bound;
+}
+
+bool triangle_closest_point_within(Vector3 p, const TrianglePrecomputed* triangle, float max_squared_distance, Vector3* out_closest_point, float* out_squared_distance, TriangleFeature* out_feature)
+{
+    // the plane alone first, it is cheaper than the sphere
+    const TrianglePrecomputed& t = *triangle;
+    float plane = vector3_dot(t.normal, vector3_sub(p, t.a));
+    if (plane * plane * t.inv_normal_length_sq >= max_squared_distance)
+        return false;
+
+    float center_dist_sq = vector3_distance_sq(p, t.sphere_center);
+    if (center_dist_sq > t.sphere_radius * t.sphere_radius)
+    {
+        float sphere = sqrtf(center_dist_sq) - t.sphere_radius;
+        if (sphere * sphere >= max_squared_distance)
+            return false;
+    }
+
+    *out_closest_point = triangle_closest_point_precomputed(p, triangle, out_feature);
+    *out_squared_distance = vector3_distance_sq(*out_closest_point, p);
+    return true;
+}
+
 // Real-Time Collision Detection by Christer Ericson p190-194
 // this function return true in the case of intersection with the false plane of the triangle
 bool triangle_intersect_ray(TriangleRayIntersect& param)
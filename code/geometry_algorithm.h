@@ -1,9 +1,88 @@
 #ifndef __GEOMETRY_ALGORITHM_H__
 #define __GEOMETRY_ALGORITHM_H__
 
+#include <stddef.h>
 #include "vector.h"
 
-Vector3 triangle_closest_point(Vector3 p, Vector3 a, Vector3 b, Vector3 c);
+// the part of the triangle the closest point lies on
+enum TriangleFeature
+{
+    TRIANGLE_FEATURE_FACE = 0,
+    TRIANGLE_FEATURE_VERTEX_A,
+    TRIANGLE_FEATURE_VERTEX_B,
+    TRIANGLE_FEATURE_VERTEX_C,
+    TRIANGLE_FEATURE_EDGE_AB,
+    TRIANGLE_FEATURE_EDGE_BC,
+    TRIANGLE_FEATURE_EDGE_CA
+};
+
+// out_feature can be NULL
+Vector3 triangle_closest_point(Vector3 p, Vector3 a, Vector3 b, Vector3 c, TriangleFeature* out_feature = NULL);
+
+#define TRIANGLES_CLOSEST_POINT_MAX_COUNT 8
+
+// the SIMD lanes of triangles_closest_point : 8 with AVX2, 4 with SSE, 1 without SIMD
+#if defined(__AVX2__)
+#define TRIANGLES_LANE_WIDTH 8
+#elif defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define TRIANGLES_LANE_WIDTH 4
+#else
+#define TRIANGLES_LANE_WIDTH 1
+#endif
+
+// triangles are stored in blocks of TRIANGLES_LANE_WIDTH triangles, 9 floats per triangle. A block is in SoA :
+// a.x of its triangles, then a.y, ..., c.z, so triangles_closest_point loads each coordinate into a register.
+// The offset is the one of the x of vertex a, the next coordinates are TRIANGLES_LANE_WIDTH floats apart.
+static inline size_t triangles_get_offset(int triangle_index)
+{
+    return (size_t)(triangle_index / TRIANGLES_LANE_WIDTH) * 9 * TRIANGLES_LANE_WIDTH + triangle_index % TRIANGLES_LANE_WIDTH;
+}
+
+static inline Vector3 triangles_get_vertex(const float* triangles, int triangle_index, int vertex)
+{
+    const float* coordinates = triangles + triangles_get_offset(triangle_index) + vertex * 3 * TRIANGLES_LANE_WIDTH;
+    Vector3 v = { coordinates[0], coordinates[TRIANGLES_LANE_WIDTH], coordinates[2 * TRIANGLES_LANE_WIDTH] };
+    return v;
+}
+
+static inline void triangles_set_vertex(float* triangles, int triangle_index, int vertex, const float* position)
+{
+    float* coordinates = triangles + triangles_get_offset(triangle_index) + vertex * 3 * TRIANGLES_LANE_WIDTH;
+    coordinates[0] = position[0];
+    coordinates[TRIANGLES_LANE_WIDTH] = position[1];
+    coordinates[2 * TRIANGLES_LANE_WIDTH] = position[2];
+}
+
+// triangle_closest_point against triangle_count (1 to TRIANGLES_CLOSEST_POINT_MAX_COUNT) triangles in the blocks
+// above, run in the SIMD lanes. triangles is the start of a block and the lanes after triangle_count up to the end
+// of its block are read too, they have to hold finite floats. Returns the index of the closest triangle, the first
+// one on ties, with its closest point, squared distance and feature.
+// The squared distance stays FLT_MAX if every triangle is degenerate.
+int triangles_closest_point(Vector3 p, const float* triangles, int triangle_count, Vector3* out_closest_point, float* out_squared_distance, TriangleFeature* out_feature);
+
+// the part of triangle_closest_point that only depends on the triangle, 96 bytes
+struct TrianglePrecomputed
+{
+    Vector3 a; // origin, b = a + ab and c = a + ac
+    Vector3 ab;
+    Vector3 ac;
+    Vector3 normal; // cross(ab, ac), not normalized
+    float ab_dot_ab, ab_dot_ac, ac_dot_ac; // d3..d6 of triangle_closest_point follow from d1 and d2 with these
+    float inv_ab_length_sq, inv_ac_length_sq, inv_bc_length_sq; // 1 / squared edge lengths
+    float inv_normal_length_sq;
+    Vector3 sphere_center; // bounding sphere
+    float sphere_radius;
+    float padding;
+};
+
+void triangle_precompute(Vector3 a, Vector3 b, Vector3 c, TrianglePrecomputed* out_triangle);
+// triangle_closest_point with 2 dot products instead of 6 and no division on the edges and the face
+Vector3 triangle_closest_point_precomputed(Vector3 p, const TrianglePrecomputed* triangle, TriangleFeature* out_feature = NULL);
+// lower bound of the squared distance from p to the triangle : the larger of the distances to its plane and bounding sphere
+float triangle_distance_sq_lower_bound(Vector3 p, const TrianglePrecomputed* triangle);
+// triangle_closest_point_precomputed unless triangle_distance_sq_lower_bound already rules out a squared distance
+// below max_squared_distance. Returns false and leaves the outputs untouched when the triangle is rejected.
+bool triangle_closest_point_within(Vector3 p, const TrianglePrecomputed* triangle, float max_squared_distance, Vector3* out_closest_point, float* out_squared_distance, TriangleFeature* out_feature);
 
 struct TriangleRayIntersect
 {
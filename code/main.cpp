@@ -18,9 +18,14 @@ int main()
     glfw_init();
     imgui_init();
 
+    SDFBakeConfig bake_config;
+    bake_config.model_scale = 1.f;
+    bake_config.grid_delta = 0.05f;
+    bake_config.store_debug_info = true;
+
     std::vector<SDFObjData*> sdf_objs =
     {
-        sdf_obj_load("resource/bunny.obj", 1.f, 0.05f),
+        sdf_obj_load("resource/bunny.obj", bake_config),
     };
     renderer_init(&renderer, sdf_objs);
 
@@ -174,7 +179,9 @@ void app_gui()
 
             for (int i = 0; i < shape_count; ++i)
             {
-                ImGui::Text("Total Voxel Count for Shape %d : %d", i, (int)sod->grids[i].sdfs.size());
+                const Grid& grid = sod->grids[i];
+                ImGui::Text("Total Voxel Count for Shape %d : %d", i, (int)grid_get_voxel_count(&grid));
+                ImGui::Text("Allocated Bricks for Shape %d : %d / %d", i, (int)grid.allocated_bricks.size(), (int)grid.bricks.size());
             }
 
             ImGui::PopID();
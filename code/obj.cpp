@@ -1,10 +1,18 @@
 #include "obj.h"
 
 #include <string>
+#include <unordered_map>
 #include <assert.h>
+#include <float.h>
+#include <string.h>
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#include <emmintrin.h>
+#endif
 
 #include "common.h"
 #include "geometry_algorithm.h"
+#include "bvh.h"
+#include "bvh_traverse.h"
 
 #define TINYOBJLOADER_IMPLEMENTATION
 #include <tiny_obj_loader.h>
@@ -72,224 +80,6 @@ static inline void push_obj_data(ObjData::Frame& frame, const tinyobj::ObjReader
 }
 */
 
-// from godot/sort_array.h
-template<class T, class Comparator>
-class SortArray
-{
-public:
-	Comparator compare;
-
-	inline int bitlog(int n)
-	{
-		int k;
-		for (k = 0; n != 1; n >>= 1)
-			++k;
-
-		return k;
-	}
-
-	const T& median_of_3(const T& a, const T& b, const T& c)
-	{
-		if (compare(a, b))
-		{
-			if (compare(b, c))
-				return b;
-			else if (compare(a, c))
-				return c;
-			else
-				return a;
-		}
-		else if (compare(a, c))
-		{
-			return a;
-		}
-		else if (compare(b, c))
-		{
-			return c;
-		}
-		else
-		{
-			return b;
-		}
-	}
-
-	inline int partitioner(int first, int last, T pivot, T* arr)
-	{
-		const int unmodified_first = first;
-		const int unmodified_last = last;
-
-		while (true)
-		{
-			while (compare(arr[first], pivot))
-			{
-				++first;
-			}
-			--last;
-
-			while (compare(pivot, arr[last]))
-			{
-				--last;
-			}
-
-			if (!(first < last))
-			{
-				return first;
-			}
-
-			T temp = arr[first];
-			arr[first] = arr[last];
-			arr[last] = temp;
-
-			++first;
-		}
-	}
-
-	inline void unguarded_linear_insert(int last, T value, T* p)
-	{
-		int next = last - 1;
-		while (compare(value, p[next]))
-		{
-			p[last] = p[next];
-			last = next;
-			--next;
-		}
-		p[last] = value;
-	}
-
-	inline void linear_insert(int first, int last, T* p)
-	{
-		T val = p[last];
-		if (compare(val, p[first]))
-		{
-			for (int i = last; i > first; --i)
-			{
-				p[i] = p[i - 1];
-			}
-
-			p[first] = val;
-		}
-		else
-		{
-			unguarded_linear_insert(last, val, p);
-		}
-	}
-
-	inline void insertion_sort(int first, int last, T* p)
-	{
-		if (first == last)
-			return;
-
-		for (int i = first + 1; i != last; ++i)
-		{
-			linear_insert(first, i, p);
-		}
-	}
-
-	inline void introselect(int first, int nth, int last, T* p, int max_depth)
-	{
-		while (last - first > 3)
-		{
-			if (max_depth == 0)
-			{
-				return;
-			}
-
-			int cut = partitioner(first, last,
-				median_of_3
-				(
-					p[first],
-					p[first + (last - first) / 2],
-					p[last - 1]
-				),
-				p
-			);
-
-			if (cut <= nth)
-			{
-				first = cut;
-			}
-			else
-			{
-				last = cut;
-			}
-		}
-
-		insertion_sort(first, last, p);
-	}
-
-	
-	inline void nth_element(int first, int last, int nth, T* p)
-	{
-		if (first == last || last == nth)
-		{
-			return;
-		}
-		introselect(first, nth, last, p, bitlog(last - first));
-	}
-};
-
-template<int axis>
-struct BVHCompare
-{
-	bool operator()(const BVH* left, const BVH* right)
-	{
-		return left->center[axis] < right->center[axis];
-	}
-};
-
-// from godot/triangle_mesh.cpp
-static inline int create_bvh(BVH* p_bvh, BVH** p_bb, int p_from, int p_size, int p_depth, int& r_max_depth, int& r_max_alloc)
-{
-	if (p_depth > r_max_depth)
-		r_max_depth = p_depth;
-
-	if (p_size == 1)
-	{
-		return (int)(p_bb[p_from] - p_bvh);
-	}
-	else if (p_size == 0)
-	{
-		return -1;
-	}
-
-	AABB aabb;
-	aabb = p_bb[p_from]->aabb;
-	for (int i = 1; i < p_size; ++i)
-	{
-		aabb_combine_aabb(&aabb, &(p_bb[p_from + i]->aabb));
-	}
-
-	int li = aabb_get_logest_axis_index(&aabb);
-	
-	switch (li)
-	{
-	case 0:
-		SortArray<BVH*, BVHCompare<0>> sort_x;
-		sort_x.nth_element(0, p_size, p_size / 2, &p_bb[p_from]);
-		break;
-	case 1:
-		SortArray<BVH*, BVHCompare<1>> sort_y;
-		sort_y.nth_element(0, p_size, p_size / 2, &p_bb[p_from]);
-		break;
-	case 2:
-		SortArray<BVH*, BVHCompare<2>> sort_z;
-		sort_z.nth_element(0, p_size, p_size / 2, &p_bb[p_from]);
-		break;
-	}
-
-	int left = create_bvh(p_bvh, p_bb, p_from, p_size / 2, p_depth + 1, r_max_depth, r_max_alloc);
-	int right = create_bvh(p_bvh, p_bb, p_from + p_size / 2, p_size -  p_size / 2, p_depth + 1, r_max_depth, r_max_alloc);
-
-	int index = r_max_alloc++;
-	BVH* new_bvh = &(p_bvh[index]);
-	new_bvh->aabb = aabb;
-	aabb_get_center(&aabb, new_bvh->center);
-	new_bvh->face_index = -1;
-	new_bvh->left = left;
-	new_bvh->right = right;
-
-	return index;
-}
 /*
 static inline void push_obj_data(ObjData::Frame& frame, const std::vector<Shape>& shapes)
 {
@@ -391,8 +181,397 @@ static inline void push_obj_data(ObjData::Frame& frame, const std::vector<Shape>
 	}
 }*/
 
+// vertex : sum of the unit face normals weighted by the incident angle of the face at the vertex
+// edge : sum of the unit normals of the faces sharing the edge
+static void shape_init_pseudonormals(ObjData::Shape* shape)
+{
+    size_t face_count = shape->indices.size() / 3;
+    shape->vertex_pseudonormals.assign(shape->positions.size(), 0.f);
+    shape->edge_pseudonormals.assign(face_count * 9, 0.f);
+
+    // edge key (smaller vertex index, bigger vertex index) -> normal sum
+    std::unordered_map<uint64_t, Vector3> edge_normals;
+    edge_normals.reserve(face_count * 3 / 2);
+
+    for (size_t fi = 0; fi < face_count; ++fi)
+    {
+        uint32_t vi[3] = { shape->indices[fi * 3], shape->indices[fi * 3 + 1], shape->indices[fi * 3 + 2] };
+        Vector3 p[3] =
+        {
+            vector3_setp(&(shape->positions[vi[0] * 3])),
+            vector3_setp(&(shape->positions[vi[1] * 3])),
+            vector3_setp(&(shape->positions[vi[2] * 3]))
+        };
+        Vector3 normal = vector3_normalize(vector3_cross(vector3_sub(p[1], p[0]), vector3_sub(p[2], p[0])));
+
+        for (int ti = 0; ti < 3; ++ti)
+        {
+            Vector3 e0 = vector3_normalize(vector3_sub(p[(ti + 1) % 3], p[ti]));
+            Vector3 e1 = vector3_normalize(vector3_sub(p[(ti + 2) % 3], p[ti]));
+            float cos_angle = vector3_dot(e0, e1);
+            cos_angle = cos_angle < -1.f ? -1.f : (cos_angle > 1.f ? 1.f : cos_angle);
+            float angle = acosf(cos_angle);
+
+            float* vn = &(shape->vertex_pseudonormals[vi[ti] * 3]);
+            vn[0] += normal.v[0] * angle;
+            vn[1] += normal.v[1] * angle;
+            vn[2] += normal.v[2] * angle;
+
+            uint32_t v0 = vi[ti];
+            uint32_t v1 = vi[(ti + 1) % 3];
+            uint64_t key = v0 < v1 ? ((uint64_t)v0 << 32) | v1 : ((uint64_t)v1 << 32) | v0;
+            std::unordered_map<uint64_t, Vector3>::iterator it = edge_normals.find(key);
+            if (it == edge_normals.end())
+            {
+                edge_normals[key] = normal;
+            }
+            else
+            {
+                it->second = vector3_add(it->second, normal);
+            }
+        }
+    }
+
+    for (size_t fi = 0; fi < face_count; ++fi)
+    {
+        for (int ti = 0; ti < 3; ++ti)
+        {
+            uint32_t v0 = shape->indices[fi * 3 + ti];
+            uint32_t v1 = shape->indices[fi * 3 + (ti + 1) % 3];
+            uint64_t key = v0 < v1 ? ((uint64_t)v0 << 32) | v1 : ((uint64_t)v1 << 32) | v0;
+            Vector3 en = edge_normals[key];
+
+            float* dest = &(shape->edge_pseudonormals[fi * 9 + ti * 3]);
+            dest[0] = en.v[0];
+            dest[1] = en.v[1];
+            dest[2] = en.v[2];
+        }
+    }
+}
+
+static inline bool is_bvh_leaf(const BVH* bvh)
+{
+    return (bvh->left == -1 && bvh->right == -1);
+}
+
+// the children are created before their parent, so a single pass from the leaves up works.
+static void shape_init_bvh_dipoles(ObjData::Shape* shape)
+{
+    shape->bvh_dipoles.resize(shape->bvhs.size());
+
+    for (size_t bi = 0; bi < shape->bvhs.size(); ++bi)
+    {
+        const BVH& bvh = shape->bvhs[bi];
+        BVHDipole& dipole = shape->bvh_dipoles[bi];
+
+        if (is_bvh_leaf(&bvh))
+        {
+            int fi = bvh.face_index * 3;
+            Vector3 p[3] =
+            {
+                vector3_setp(&(shape->positions[shape->indices[fi] * 3])),
+                vector3_setp(&(shape->positions[shape->indices[fi + 1] * 3])),
+                vector3_setp(&(shape->positions[shape->indices[fi + 2] * 3]))
+            };
+            Vector3 center = vector3_mul_scalar(vector3_add(p[0], vector3_add(p[1], p[2])), 1.f / 3.f);
+            Vector3 normal = vector3_mul_scalar(vector3_cross(vector3_sub(p[1], p[0]), vector3_sub(p[2], p[0])), 0.5f);
+
+            float radius = 0.f;
+            for (int ti = 0; ti < 3; ++ti)
+            {
+                float d = vector3_distance(center, p[ti]);
+                if (d > radius)
+                    radius = d;
+            }
+
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                dipole.center[axis] = center.v[axis];
+                dipole.normal[axis] = normal.v[axis];
+            }
+            dipole.radius = radius;
+            continue;
+        }
+
+        Vector3 center = vector3_set1(0.f);
+        Vector3 normal = vector3_set1(0.f);
+        float area_sum = 0.f;
+        int children[2] = { bvh.left, bvh.right };
+        for (int ci = 0; ci < 2; ++ci)
+        {
+            if (children[ci] < 0)
+                continue;
+
+            const BVHDipole& child = shape->bvh_dipoles[children[ci]];
+            Vector3 child_normal = vector3_setp(child.normal);
+            float area = vector3_length(child_normal);
+            center = vector3_add(center, vector3_mul_scalar(vector3_setp(child.center), area));
+            normal = vector3_add(normal, child_normal);
+            area_sum += area;
+        }
+
+        if (area_sum > 0.f)
+        {
+            center = vector3_mul_scalar(center, 1.f / area_sum);
+        }
+        else
+        {
+            center = vector3_setp(bvh.center);
+        }
+
+        float radius = 0.f;
+        for (int ci = 0; ci < 2; ++ci)
+        {
+            if (children[ci] < 0)
+                continue;
+
+            const BVHDipole& child = shape->bvh_dipoles[children[ci]];
+            float d = vector3_distance(center, vector3_setp(child.center)) + child.radius;
+            if (d > radius)
+                radius = d;
+        }
+
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            dipole.center[axis] = center.v[axis];
+            dipole.normal[axis] = normal.v[axis];
+        }
+        dipole.radius = radius;
+    }
+}
+
+// opens the binary subtree with the largest surface area until the node has BVH_WIDE_WIDTH children
+static int shape_collapse_wide_bvh(ObjData::Shape* shape, const BVHLeafOrder* leaf_order, int bvh_index, int depth)
+{
+    if (depth > shape->wide_bvh_max_depth)
+        shape->wide_bvh_max_depth = depth;
+
+    int node_index = (int)shape->wide_bvhs.size();
+    shape->wide_bvhs.push_back(BVHWide());
+
+    int items[BVH_WIDE_WIDTH];
+    int item_count = 0;
+    const BVH& root = shape->bvhs[bvh_index];
+    if (bvh_is_leaf_in_order(leaf_order, bvh_index))
+    {
+        items[item_count++] = bvh_index;
+    }
+    else
+    {
+        if (root.left >= 0) items[item_count++] = root.left;
+        if (root.right >= 0) items[item_count++] = root.right;
+    }
+
+    while (item_count < BVH_WIDE_WIDTH)
+    {
+        int open_index = -1;
+        float max_area = -1.f;
+        for (int ii = 0; ii < item_count; ++ii)
+        {
+            const BVH& item = shape->bvhs[items[ii]];
+            if (bvh_is_leaf_in_order(leaf_order, items[ii]))
+                continue;
+
+            float area = aabb_get_surface_area(&(item.aabb));
+            if (area > max_area)
+            {
+                max_area = area;
+                open_index = ii;
+            }
+        }
+
+        if (open_index < 0)
+            break;
+
+        const BVH& opened = shape->bvhs[items[open_index]];
+        int left = opened.left;
+        int right = opened.right;
+        if (left >= 0 && right >= 0)
+        {
+            items[open_index] = left;
+            items[item_count++] = right;
+        }
+        else
+        {
+            items[open_index] = left >= 0 ? left : right;
+        }
+    }
+
+    int children[BVH_WIDE_WIDTH];
+    for (int ci = 0; ci < BVH_WIDE_WIDTH; ++ci)
+    {
+        if (ci >= item_count)
+        {
+            children[ci] = BVH_WIDE_EMPTY_CHILD;
+            continue;
+        }
+
+        if (bvh_is_leaf_in_order(leaf_order, items[ci]))
+        {
+            children[ci] = BVH_WIDE_LEAF_CHILD(leaf_order->firsts[items[ci]], leaf_order->counts[items[ci]]);
+        }
+        else
+        {
+            children[ci] = shape_collapse_wide_bvh(shape, leaf_order, items[ci], depth + 1);
+        }
+    }
+
+    // wide_bvhs can reallocate in the recursion above
+    BVHWide& node = shape->wide_bvhs[node_index];
+    for (int ci = 0; ci < BVH_WIDE_WIDTH; ++ci)
+    {
+        node.children[ci] = children[ci];
+        if (children[ci] == BVH_WIDE_EMPTY_CHILD)
+        {
+            node.min_x[ci] = node.min_y[ci] = node.min_z[ci] = FLT_MAX;
+            node.max_x[ci] = node.max_y[ci] = node.max_z[ci] = -FLT_MAX;
+            continue;
+        }
+
+        const AABB& aabb = shape->bvhs[items[ci]].aabb;
+        node.min_x[ci] = aabb.min_p.v[0];
+        node.min_y[ci] = aabb.min_p.v[1];
+        node.min_z[ci] = aabb.min_p.v[2];
+        node.max_x[ci] = aabb.max_p.v[0];
+        node.max_y[ci] = aabb.max_p.v[1];
+        node.max_z[ci] = aabb.max_p.v[2];
+    }
+
+    return node_index;
+}
+
+void shape_build_bvh(ObjData::Shape* shape, const ObjLoadConfig& config)
+{
+    int face_count = (int)shape->indices.size() / 3;
+    shape->bvhs.resize(face_count > 0 ? 2 * face_count - 1 : 0);
+
+    // a leaf for each face
+    for (int fi = 0; fi < face_count; ++fi)
+    {
+        Vector3 p0 = vector3_setp(&(shape->positions[shape->indices[fi * 3] * 3]));
+        Vector3 p1 = vector3_setp(&(shape->positions[shape->indices[fi * 3 + 1] * 3]));
+        Vector3 p2 = vector3_setp(&(shape->positions[shape->indices[fi * 3 + 2] * 3]));
+
+        BVH& bvh = shape->bvhs[fi];
+        AABB& aabb = bvh.aabb;
+        aabb_set_min_max(&aabb, p0.v[0], p0.v[1], p0.v[2]);
+        aabb_combine_float(&aabb, p1.v);
+        aabb_combine_float(&aabb, p2.v);
+        bvh.face_index = fi;
+        bvh.left = -1;
+        bvh.right = -1;
+        aabb_get_center(&aabb, bvh.center);
+    }
+    bvh_build(shape->bvhs.data(), face_count, config.bvh_builder, config.thread_count, &(shape->bvh_max_depth));
+
+    if (config.bvh_rotations)
+    {
+        shape->bvh_max_depth = bvh_optimize_rotations(&(shape->bvhs), face_count, 4);
+    }
+
+    // the sah split and the rotations don't bound the depth. A tree too deep for the stack of the traversals
+    // is rebuilt with the median split, which halves every range.
+    if (shape->bvh_max_depth >= BVH_TRAVERSE_STACK_SIZE)
+    {
+        bvh_build(shape->bvhs.data(), face_count, BVH_BUILDER_MEDIAN, config.thread_count, &(shape->bvh_max_depth));
+    }
+    shape->bvh_sah_cost = bvh_get_sah_cost(shape->bvhs);
+
+    shape_init_bvh_dipoles(shape);
+
+    int leaf_size = config.bvh_leaf_size;
+    if (leaf_size < 1) leaf_size = 1;
+    if (leaf_size > BVH_LEAF_MAX_FACES) leaf_size = BVH_LEAF_MAX_FACES;
+
+    BVHLeafOrder leaf_order;
+    bvh_get_leaf_order(shape->bvhs, leaf_size, TRIANGLES_LANE_WIDTH, &leaf_order);
+    shape->bvh_leaf_size = leaf_size;
+    shape->leaf_face_indices = leaf_order.face_indices;
+    shape->leaf_triangles.resize(shape->leaf_face_indices.size() * 9);
+    for (size_t li = 0; li < shape->leaf_face_indices.size(); ++li)
+    {
+        int fi = shape->leaf_face_indices[li] * 3;
+        for (int vi = 0; vi < 3; ++vi)
+        {
+            triangles_set_vertex(shape->leaf_triangles.data(), (int)li, vi, &(shape->positions[shape->indices[fi + vi] * 3]));
+        }
+    }
+
+    shape->leaf_triangle_table.clear();
+    shape->face_leaf_slots.clear();
+    if (config.triangle_table)
+    {
+        shape->leaf_triangle_table.resize(shape->leaf_face_indices.size());
+        shape->face_leaf_slots.resize(face_count);
+        for (size_t li = 0; li < shape->leaf_face_indices.size(); ++li)
+        {
+            const float* triangles = shape->leaf_triangles.data();
+            triangle_precompute(triangles_get_vertex(triangles, (int)li, 0), triangles_get_vertex(triangles, (int)li, 1), triangles_get_vertex(triangles, (int)li, 2), &(shape->leaf_triangle_table[li]));
+            shape->face_leaf_slots[shape->leaf_face_indices[li]] = (int)li;
+        }
+    }
+
+    std::vector<int> node_order;
+    bvh_linearize(shape->bvhs, leaf_order, &(shape->bvh_nodes), &node_order);
+    std::vector<BVHDipole> bvh_dipoles(node_order.size());
+    for (size_t ni = 0; ni < node_order.size(); ++ni)
+    {
+        bvh_dipoles[ni] = shape->bvh_dipoles[node_order[ni]];
+    }
+    shape->bvh_dipoles.swap(bvh_dipoles);
+
+    shape->wide_bvhs.clear();
+    shape->wide_bvhs.reserve(shape->bvhs.size() / (BVH_WIDE_WIDTH - 1) + 1);
+    shape->wide_bvh_max_depth = 0;
+    if (shape->bvhs.empty() == false)
+    {
+        shape_collapse_wide_bvh(shape, &leaf_order, (int)shape->bvhs.size() - 1, 1);
+    }
+
+    shape->quantized_bvhs.clear();
+    if (config.bvh_quantize)
+    {
+        // the queries only need the quantized wide tree and bvh_nodes
+        bvh_quantize_wide(shape->wide_bvhs, &(shape->quantized_bvhs));
+        std::vector<BVHWide>().swap(shape->wide_bvhs);
+        std::vector<BVH>().swap(shape->bvhs);
+    }
+}
+
+size_t shape_get_bvh_memory_size(const ObjData::Shape* shape)
+{
+    return shape->bvhs.capacity() * sizeof(BVH)
+        + shape->bvh_nodes.capacity() * sizeof(BVHNode)
+        + shape->bvh_dipoles.capacity() * sizeof(BVHDipole)
+        + shape->wide_bvhs.capacity() * sizeof(BVHWide)
+        + shape->quantized_bvhs.capacity() * sizeof(BVHWideQuantized)
+        + shape->leaf_face_indices.capacity() * sizeof(int)
+        + shape->leaf_triangles.capacity() * sizeof(float)
+        + shape->leaf_triangle_table.capacity() * sizeof(TrianglePrecomputed)
+        + shape->face_leaf_slots.capacity() * sizeof(int);
+}
+
 ObjData* obj_load(const char* path, float model_scale)
 {
+    ObjLoadConfig config;
+    config.model_scale = model_scale;
+    return obj_load(path, config);
+}
+
+ObjData* obj_load(const char* path, const ObjLoadConfig& config)
+{
+    ObjData* od = obj_parse(path, config);
+    for (size_t si = 0; si < od->shapes.size(); ++si)
+    {
+        shape_init(&(od->shapes[si]), config);
+    }
+
+	return od;
+}
+
+ObjData* obj_parse(const char* path, const ObjLoadConfig& config)
+{
+    float model_scale = config.model_scale;
     ObjData* od = new ObjData();
     
     tinyobj::attrib_t attrib;
@@ -420,8 +599,6 @@ ObjData* obj_load(const char* path, float model_scale)
     size_t shape_count = shapes.size();
     od->shapes.resize(shape_count);
 
-    std::vector<BVH*> bvh_ps;
-
     for (size_t si = 0; si < shapes.size(); ++si)
     {
         tinyobj::shape_t& src_shape = shapes[si];
@@ -431,9 +608,7 @@ ObjData* obj_load(const char* path, float model_scale)
         std::vector<tinyobj::index_t>& mesh_indices = mesh.indices;
 
         dest_shape.positions.resize(attrib.vertices.size());
-        dest_shape.normals.resize(attrib.vertices.size());
         dest_shape.indices.resize(mesh_indices.size());
-        dest_shape.bvhs.resize(mesh_indices.size()); // will shirink at the end.
 
         dest_shape.min_positions[0] = dest_shape.min_positions[1] = dest_shape.min_positions[2] = FLT_MAX;
         dest_shape.max_positions[0] = dest_shape.max_positions[1] = dest_shape.max_positions[2] = -FLT_MAX;
@@ -460,75 +635,60 @@ ObjData* obj_load(const char* path, float model_scale)
             }
         }
 
-        // evaluate normals, copy indices, create bvh for each face.
         assert(mesh_indices.size() % 3 == 0);
-        for (size_t ii = 0; ii < mesh_indices.size(); ii += 3)
+        for (size_t ii = 0; ii < mesh_indices.size(); ++ii)
         {
-            uint32_t vi[3] = 
-            { 
-                (uint32_t)mesh_indices[ii].vertex_index * 3 ,
-                (uint32_t)mesh_indices[ii + 1].vertex_index * 3,
-                (uint32_t)mesh_indices[ii + 2].vertex_index * 3
-            };
-
-            Vector3 p0 = vector3_setp(&attrib.vertices[vi[0]]);
-            Vector3 p1 = vector3_setp(&attrib.vertices[vi[1]]);
-            Vector3 p2 = vector3_setp(&attrib.vertices[vi[2]]);
-            Vector3 normal = vector3_normalize(vector3_cross(vector3_sub(p1, p0), vector3_sub(p2, p0)));
-
-            for (int ni = 0; ni < 3; ++ni)
-            {
-                dest_shape.normals[vi[ni]] += normal.v[0];
-                dest_shape.normals[vi[ni] + 1] += normal.v[1];
-                dest_shape.normals[vi[ni] + 2] += normal.v[2];
-            }
-            
             dest_shape.indices[ii] = mesh_indices[ii].vertex_index;
-            dest_shape.indices[ii + 1] = mesh_indices[ii + 1].vertex_index;
-            dest_shape.indices[ii + 2] = mesh_indices[ii + 2].vertex_index;
-
-            int face_index = (int)ii / 3;
-            BVH& bvh = dest_shape.bvhs[face_index];
-            AABB& aabb = bvh.aabb;
-            aabb_set_min_max(&aabb, p0.v[0], p0.v[1], p0.v[2]);
-            aabb_combine_float(&aabb, p1.v);
-            aabb_combine_float(&aabb, p2.v);
-            bvh.face_index = face_index;
-            bvh.left = -1;
-            bvh.right = -1;
-            aabb_get_center(&aabb, bvh.center);
         }
+    }
 
-        // evalute mesh unit normal
-        for (size_t ni = 0; ni < dest_shape.normals.size(); ni += 3)
-        {
-            float n[3] = { dest_shape.normals[ni], dest_shape.normals[ni + 1], dest_shape.normals[ni + 2] };
+	return od;
+}
 
-            float inv_len = n[0] * n[0] + n[1] * n[1] + n[2] * n[2];
-            if (inv_len != 0.f)
-            {
-                inv_len = 1.f / sqrtf(inv_len);
+void shape_init(ObjData::Shape* shape, const ObjLoadConfig& config)
+{
+    std::vector<float>& positions = shape->positions;
+    std::vector<uint32_t>& indices = shape->indices;
+    std::vector<float>& normals = shape->normals;
+    normals.assign(positions.size(), 0.f);
 
-                dest_shape.normals[ni] *= inv_len;
-                dest_shape.normals[ni + 1] *= inv_len;
-                dest_shape.normals[ni + 2] *= inv_len;
-            }
+    // evaluate normals
+    for (size_t ii = 0; ii < indices.size(); ii += 3)
+    {
+        uint32_t vi[3] = { indices[ii] * 3, indices[ii + 1] * 3, indices[ii + 2] * 3 };
+
+        Vector3 p0 = vector3_setp(&positions[vi[0]]);
+        Vector3 p1 = vector3_setp(&positions[vi[1]]);
+        Vector3 p2 = vector3_setp(&positions[vi[2]]);
+        Vector3 normal = vector3_normalize(vector3_cross(vector3_sub(p1, p0), vector3_sub(p2, p0)));
+
+        for (int ni = 0; ni < 3; ++ni)
+        {
+            normals[vi[ni]] += normal.v[0];
+            normals[vi[ni] + 1] += normal.v[1];
+            normals[vi[ni] + 2] += normal.v[2];
         }
+    }
+
+    // evalute mesh unit normal
+    for (size_t ni = 0; ni < normals.size(); ni += 3)
+    {
+        float n[3] = { normals[ni], normals[ni + 1], normals[ni + 2] };
 
-        // preparation for creating bvhs
-        int face_count = (int)mesh_indices.size() / 3;
-        int max_alloc = face_count;
-        dest_shape.bvh_max_depth = 0;
-        bvh_ps.resize(face_count);
-        for (int fi = 0; fi < face_count; ++fi)
+        float inv_len = n[0] * n[0] + n[1] * n[1] + n[2] * n[2];
+        if (inv_len != 0.f)
         {
-            bvh_ps[fi] = &(dest_shape.bvhs[fi]);
+            inv_len = 1.f / sqrtf(inv_len);
+
+            normals[ni] *= inv_len;
+            normals[ni + 1] *= inv_len;
+            normals[ni + 2] *= inv_len;
         }
-        create_bvh(dest_shape.bvhs.data(), bvh_ps.data(), 0, face_count, 1, dest_shape.bvh_max_depth, max_alloc);
-        dest_shape.bvhs.resize(max_alloc); // shrink now
     }
 
-	return od;
+    shape_init_pseudonormals(shape);
+
+    shape_build_bvh(shape, config);
 }
 
 void obj_unload(ObjData* od)
@@ -536,164 +696,354 @@ void obj_unload(ObjData* od)
 	delete od;
 }
 
-static inline bool is_bvh_leaf(BVH* bvh)
+// squared distances from the query point to the BVH_WIDE_WIDTH child bounds of the node, 0 inside
+static inline void wide_bvh_child_distances(const BVHWide* node, Vector3 query_point, float* out_distances)
 {
-    return (bvh->left == -1 && bvh->right == -1);
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+    const __m128 zero = _mm_setzero_ps();
+    __m128 px = _mm_set1_ps(query_point.v[0]);
+    __m128 py = _mm_set1_ps(query_point.v[1]);
+    __m128 pz = _mm_set1_ps(query_point.v[2]);
+
+    __m128 tx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(node->min_x), px), _mm_sub_ps(px, _mm_loadu_ps(node->max_x))), zero);
+    __m128 ty = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(node->min_y), py), _mm_sub_ps(py, _mm_loadu_ps(node->max_y))), zero);
+    __m128 tz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(node->min_z), pz), _mm_sub_ps(pz, _mm_loadu_ps(node->max_z))), zero);
+    _mm_storeu_ps(out_distances, _mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, tx), _mm_mul_ps(ty, ty)), _mm_mul_ps(tz, tz)));
+#else
+    for (int ci = 0; ci < BVH_WIDE_WIDTH; ++ci)
+    {
+        float tx = fmaxf(fmaxf(node->min_x[ci] - query_point.v[0], query_point.v[0] - node->max_x[ci]), 0.f);
+        float ty = fmaxf(fmaxf(node->min_y[ci] - query_point.v[1], query_point.v[1] - node->max_y[ci]), 0.f);
+        float tz = fmaxf(fmaxf(node->min_z[ci] - query_point.v[2], query_point.v[2] - node->max_z[ci]), 0.f);
+        out_distances[ci] = tx * tx + ty * ty + tz * tz;
+    }
+#endif
 }
 
-void bvh_intersect_aabb_with_leaf(ObjData::Shape* shape, AABB aabb, std::vector<int>* out_face_indices)
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+// 4 uint8_t steps to 4 floats, then origin + q * scale.
+// The steps are copied into an int, a cast of the pointer would be an aliasing violation and could be unaligned.
+static inline __m128 dequantize4(const uint8_t* steps, float origin, float scale)
 {
-    int* stack = (int*)ALLOCA(sizeof(int) * shape->bvh_max_depth);
-    assert(stack != NULL);
+    int packed;
+    memcpy(&packed, steps, sizeof(packed));
+    const __m128i zeroi = _mm_setzero_si128();
+    __m128i q = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zeroi), zeroi);
+    return _mm_add_ps(_mm_set1_ps(origin), _mm_mul_ps(_mm_cvtepi32_ps(q), _mm_set1_ps(scale)));
+}
+#endif
 
-    int stack_index = 0;
-    BVH* bvhptr = shape->bvhs.data();
-    BVH* bvh = NULL;
-    
-    stack[stack_index] = (int)shape->bvhs.size() - 1;
-    ++stack_index;
-    while (true)
+// the same for the quantized node. The empty children get FLT_MAX since their steps don't make an inverted box.
+static inline void wide_bvh_child_distances(const BVHWideQuantized* node, Vector3 query_point, float* out_distances)
+{
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+    const __m128 zero = _mm_setzero_ps();
+    __m128 px = _mm_set1_ps(query_point.v[0]);
+    __m128 py = _mm_set1_ps(query_point.v[1]);
+    __m128 pz = _mm_set1_ps(query_point.v[2]);
+
+    __m128 tx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(dequantize4(node->min_x, node->origin[0], node->scale[0]), px), _mm_sub_ps(px, dequantize4(node->max_x, node->origin[0], node->scale[0]))), zero);
+    __m128 ty = _mm_max_ps(_mm_max_ps(_mm_sub_ps(dequantize4(node->min_y, node->origin[1], node->scale[1]), py), _mm_sub_ps(py, dequantize4(node->max_y, node->origin[1], node->scale[1]))), zero);
+    __m128 tz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(dequantize4(node->min_z, node->origin[2], node->scale[2]), pz), _mm_sub_ps(pz, dequantize4(node->max_z, node->origin[2], node->scale[2]))), zero);
+    __m128 distances = _mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, tx), _mm_mul_ps(ty, ty)), _mm_mul_ps(tz, tz));
+
+    __m128 empty = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*)node->children), _mm_set1_epi32(BVH_WIDE_EMPTY_CHILD)));
+    distances = _mm_or_ps(_mm_and_ps(empty, _mm_set1_ps(FLT_MAX)), _mm_andnot_ps(empty, distances));
+    _mm_storeu_ps(out_distances, distances);
+#else
+    for (int ci = 0; ci < BVH_WIDE_WIDTH; ++ci)
     {
-        if (stack_index <= 0)
-            break;
-
-        int bvh_index = stack[stack_index - 1];
-        --stack_index;
-
-        bvh = &(bvhptr[bvh_index]);
-
-        if (is_bvh_leaf(bvh) == true)
+        if (node->children[ci] == BVH_WIDE_EMPTY_CHILD)
         {
-            (*out_face_indices).push_back(bvh->face_index);
+            out_distances[ci] = FLT_MAX;
+            continue;
         }
-        else
-        {
-            if (aabb_intersect_aabb(&aabb, &(bvh->aabb)) == false)
-                continue;
-
-            if (bvh->left >= 0)
-            {
-                stack[stack_index] = bvh->left;
-                ++stack_index;
-            }
 
-            if (bvh->right >= 0)
-            {
-                stack[stack_index] = bvh->right;
-                ++stack_index;
-            }
-        }
+        float tx = fmaxf(fmaxf(node->origin[0] + (float)node->min_x[ci] * node->scale[0] - query_point.v[0], query_point.v[0] - (node->origin[0] + (float)node->max_x[ci] * node->scale[0])), 0.f);
+        float ty = fmaxf(fmaxf(node->origin[1] + (float)node->min_y[ci] * node->scale[1] - query_point.v[1], query_point.v[1] - (node->origin[1] + (float)node->max_y[ci] * node->scale[1])), 0.f);
+        float tz = fmaxf(fmaxf(node->origin[2] + (float)node->min_z[ci] * node->scale[2] - query_point.v[2], query_point.v[2] - (node->origin[2] + (float)node->max_z[ci] * node->scale[2])), 0.f);
+        out_distances[ci] = tx * tx + ty * ty + tz * tz;
     }
+#endif
 }
 
-void minimum_squared_distance(ObjData::Shape* shape, Vector3 query_point, float* out_signed_distance, Vector3* out_closest_point, int* out_face_index)
+// Node is BVHWide or BVHWideQuantized. The children are visited nearest first, and only the ones closer than
+// max_squared_distance and the closest triangle so far. Returns false if no triangle is closer than max_squared_distance.
+template<class Node>
+static bool minimum_squared_distance_wide(ObjData::Shape* shape, const Node* nodes, Vector3 query_point, float max_squared_distance, float* out_signed_distance, Vector3* out_closest_point, int* out_face_index, TriangleFeature* out_feature, int seed_face_index)
 {
-    int* stack = (int*)ALLOCA(sizeof(int) * shape->bvh_max_depth);
-    assert(stack != NULL);
-
-    int stack_index = 0;
-    BVH* bvhptr = shape->bvhs.data();
-    BVH* bvh = NULL;
-    BVH* temp_bvh;
-
-    stack[stack_index] = (int)shape->bvhs.size() - 1;
-    ++stack_index;
+    // every pop pushes at most BVH_WIDE_WIDTH - 1 more entries than it removes
+    int* stack = (int*)ALLOCA(sizeof(int) * ((BVH_WIDE_WIDTH - 1) * shape->wide_bvh_max_depth + 1));
+    float* stack_distances = (float*)ALLOCA(sizeof(float) * ((BVH_WIDE_WIDTH - 1) * shape->wide_bvh_max_depth + 1));
+    assert(stack != NULL && stack_distances != NULL);
 
-    int tri_indices[3];
     Vector3 tri_verts[3];
-    Vector3 closest_point;
+    Vector3 closest_point = { 0.f, 0.f, 0.f };
     Vector3 temp_point;
-    float closest_dist = FLT_MAX;
+    float closest_dist = max_squared_distance;
     float temp_dist;
-    int closest_out_face_index;
+    int closest_out_face_index = -1;
+    TriangleFeature temp_feature;
+    TriangleFeature closest_feature = TRIANGLE_FEATURE_FACE;
 
-    bool is_add_left;
-    bool is_add_right;
-    float sq_left_ex_dist;
-    float sq_right_ex_dist;
+    if (seed_face_index >= 0)
+    {
+        int fi = seed_face_index * 3;
+        tri_verts[0] = vector3_setp(&(shape->positions[shape->indices[fi] * 3]));
+        tri_verts[1] = vector3_setp(&(shape->positions[shape->indices[fi + 1] * 3]));
+        tri_verts[2] = vector3_setp(&(shape->positions[shape->indices[fi + 2] * 3]));
+
+        temp_point = triangle_closest_point(query_point, tri_verts[0], tri_verts[1], tri_verts[2], &temp_feature);
+        temp_dist = vector3_distance_sq(temp_point, query_point);
+        if (temp_dist < closest_dist)
+        {
+            closest_dist = temp_dist;
+            closest_point = temp_point;
+            closest_out_face_index = seed_face_index;
+            closest_feature = temp_feature;
+        }
+    }
 
-    while (true)
+    // a shape without faces has no tree, nothing is closer than max_squared_distance
+    int stack_index = 0;
+    if (shape->indices.empty() == false)
     {
-        if (stack_index <= 0)
-            break;
+        stack[stack_index] = 0;
+        stack_distances[stack_index] = 0.f;
+        ++stack_index;
+    }
 
-        int bvh_index = stack[stack_index - 1];
-        --stack_index;
+    float child_distances[BVH_WIDE_WIDTH];
+    int order[BVH_WIDE_WIDTH];
 
-        bvh = &(bvhptr[bvh_index]);
-        if (is_bvh_leaf(bvh) == true)
-        {
-            int fi = bvh->face_index * 3;
-            tri_indices[0] = shape->indices[fi] * 3;
-            tri_indices[1] = shape->indices[fi + 1] * 3;
-            tri_indices[2] = shape->indices[fi + 2] * 3;
+    while (stack_index > 0)
+    {
+        --stack_index;
+        int child = stack[stack_index];
 
-            tri_verts[0] = vector3_setp(&(shape->positions[tri_indices[0]]));
-            tri_verts[1] = vector3_setp(&(shape->positions[tri_indices[1]]));
-            tri_verts[2] = vector3_setp(&(shape->positions[tri_indices[2]]));
+        // the bound may have shrunk since the entry was pushed
+        if (stack_distances[stack_index] >= closest_dist)
+            continue;
 
-            temp_point = triangle_closest_point(query_point, tri_verts[0], tri_verts[1], tri_verts[2]);
-            temp_dist = vector3_distance_sq(temp_point, query_point);
+        if (child < 0)
+        {
+            int first = BVH_WIDE_LEAF_FIRST(child);
+            if (shape->leaf_triangle_table.empty() == false)
+            {
+                // most triangles are rejected by the distance to their plane or bounding sphere
+                const TrianglePrecomputed* triangle = &(shape->leaf_triangle_table[first]);
+                int count = BVH_WIDE_LEAF_COUNT(child);
+                for (int li = 0; li < count; ++li)
+                {
+                    if (triangle_closest_point_within(query_point, triangle + li, closest_dist, &temp_point, &temp_dist, &temp_feature) && temp_dist < closest_dist)
+                    {
+                        closest_dist = temp_dist;
+                        closest_point = temp_point;
+                        closest_out_face_index = shape->leaf_face_indices[first + li];
+                        closest_feature = temp_feature;
+                    }
+                }
+                continue;
+            }
 
+            // the leaf triangles are one contiguous read, and run in the SIMD lanes together
+            int li = triangles_closest_point(query_point, &(shape->leaf_triangles[first * 9]), BVH_WIDE_LEAF_COUNT(child), &temp_point, &temp_dist, &temp_feature);
             if (temp_dist < closest_dist)
             {
                 closest_dist = temp_dist;
                 closest_point = temp_point;
-                closest_out_face_index = bvh->face_index;
+                closest_out_face_index = shape->leaf_face_indices[first + li];
+                closest_feature = temp_feature;
             }
+            continue;
         }
-        else
+
+        const Node* node = &(nodes[child]);
+        wide_bvh_child_distances(node, query_point, child_distances);
+
+        // sort the children that can still be closer, nearest first
+        int order_count = 0;
+        for (int ci = 0; ci < BVH_WIDE_WIDTH; ++ci)
         {
-            is_add_left = false;
-            is_add_right = false;
-            sq_left_ex_dist = FLT_MAX - 1.f;
-            sq_right_ex_dist = FLT_MAX - 1.f;
+            if (child_distances[ci] >= closest_dist)
+                continue;
 
-            if (bvh->left >= 0)
+            int oi = order_count++;
+            while (oi > 0 && child_distances[order[oi - 1]] > child_distances[ci])
             {
-                temp_bvh = &(bvhptr[bvh->left]);
+                order[oi] = order[oi - 1];
+                --oi;
+            }
+            order[oi] = ci;
+        }
 
-                sq_left_ex_dist = aabb_distance_exterior_sq_point(&(temp_bvh->aabb), query_point);
+        // pushed farthest first so the nearest is popped first
+        for (int oi = order_count - 1; oi >= 0; --oi)
+        {
+            stack[stack_index] = node->children[order[oi]];
+            stack_distances[stack_index] = child_distances[order[oi]];
+            ++stack_index;
+        }
+    }
 
-                if (aabb_contain_point(&(temp_bvh->aabb), query_point))
-                {
-                    stack[stack_index] = bvh->left;
-                    ++stack_index;
+    *out_signed_distance = closest_dist;
+    *out_closest_point = closest_point;
+    *out_face_index = closest_out_face_index;
+    *out_feature = closest_feature;
+    return closest_out_face_index >= 0;
+}
 
-                    is_add_left = true;
-                }
-            }
+void minimum_squared_distance(ObjData::Shape* shape, Vector3 query_point, float* out_signed_distance, Vector3* out_closest_point, int* out_face_index, TriangleFeature* out_feature, int seed_face_index)
+{
+    if (shape->quantized_bvhs.empty() == false)
+    {
+        minimum_squared_distance_wide(shape, shape->quantized_bvhs.data(), query_point, FLT_MAX, out_signed_distance, out_closest_point, out_face_index, out_feature, seed_face_index);
+    }
+    else
+    {
+        minimum_squared_distance_wide(shape, shape->wide_bvhs.data(), query_point, FLT_MAX, out_signed_distance, out_closest_point, out_face_index, out_feature, seed_face_index);
+    }
+}
 
-            if (bvh->right >= 0)
-            {
-                temp_bvh = &(bvhptr[bvh->right]);
+bool minimum_squared_distance_within(ObjData::Shape* shape, Vector3 query_point, float max_distance, float* out_squared_distance, Vector3* out_closest_point, int* out_face_index, TriangleFeature* out_feature, int seed_face_index)
+{
+    // FLT_MAX is unbounded, its square would be infinite
+    float max_squared_distance = max_distance == FLT_MAX ? FLT_MAX : max_distance * max_distance;
+    if (shape->quantized_bvhs.empty() == false)
+    {
+        return minimum_squared_distance_wide(shape, shape->quantized_bvhs.data(), query_point, max_squared_distance, out_squared_distance, out_closest_point, out_face_index, out_feature, seed_face_index);
+    }
 
-                sq_right_ex_dist = aabb_distance_exterior_sq_point(&(temp_bvh->aabb), query_point);
+    return minimum_squared_distance_wide(shape, shape->wide_bvhs.data(), query_point, max_squared_distance, out_squared_distance, out_closest_point, out_face_index, out_feature, seed_face_index);
+}
 
-                if (aabb_contain_point(&(temp_bvh->aabb), query_point))
-                {
-                    stack[stack_index] = bvh->right;
-                    ++stack_index;
+Vector3 shape_get_pseudonormal(const ObjData::Shape* shape, int face_index, TriangleFeature feature)
+{
+    int fi = face_index * 3;
+    switch (feature)
+    {
+    case TRIANGLE_FEATURE_VERTEX_A:
+    case TRIANGLE_FEATURE_VERTEX_B:
+    case TRIANGLE_FEATURE_VERTEX_C:
+        return vector3_setp(&(shape->vertex_pseudonormals[shape->indices[fi + (feature - TRIANGLE_FEATURE_VERTEX_A)] * 3]));
+    case TRIANGLE_FEATURE_EDGE_AB:
+    case TRIANGLE_FEATURE_EDGE_BC:
+    case TRIANGLE_FEATURE_EDGE_CA:
+        return vector3_setp(&(shape->edge_pseudonormals[(size_t)face_index * 9 + (feature - TRIANGLE_FEATURE_EDGE_AB) * 3]));
+    default:
+        break;
+    }
 
-                    is_add_right = true;
-                }
-            }
+    if (shape->leaf_triangle_table.empty() == false)
+    {
+        return shape->leaf_triangle_table[shape->face_leaf_slots[face_index]].normal;
+    }
 
-            if (bvh->left >= 0 && is_add_left == false && sq_left_ex_dist < closest_dist)
-            {
-                stack[stack_index] = bvh->left;
-                ++stack_index;
-            }
+    Vector3 ta = vector3_setp(&(shape->positions[shape->indices[fi] * 3]));
+    Vector3 tb = vector3_setp(&(shape->positions[shape->indices[fi + 1] * 3]));
+    Vector3 tc = vector3_setp(&(shape->positions[shape->indices[fi + 2] * 3]));
+    return vector3_cross(vector3_sub(tb, ta), vector3_sub(tc, ta));
+}
 
-            if (bvh->right >= 0 && is_add_right == false && sq_right_ex_dist < closest_dist)
-            {
-                stack[stack_index] = bvh->right;
-                ++stack_index;
-            }
+// Van Oosterom and Strackee
+static inline float triangle_solid_angle(Vector3 q, Vector3 p0, Vector3 p1, Vector3 p2)
+{
+    Vector3 a = vector3_sub(p0, q);
+    Vector3 b = vector3_sub(p1, q);
+    Vector3 c = vector3_sub(p2, q);
+    float la = vector3_length(a);
+    float lb = vector3_length(b);
+    float lc = vector3_length(c);
+
+    float numerator = vector3_dot(a, vector3_cross(b, c));
+    float denominator = la * lb * lc + vector3_dot(a, b) * lc + vector3_dot(b, c) * la + vector3_dot(c, a) * lb;
+    return 2.f * atan2f(numerator, denominator);
+}
+
+// a subtree farther than WINDING_NUMBER_BETA times its radius is approximated by its dipole
+#define WINDING_NUMBER_BETA 2.f
+
+// near triangles exactly, far subtrees through their dipole
+struct WindingNumberVisitor
+{
+    const ObjData::Shape* shape;
+    Vector3 query_point;
+    float solid_angle;
+
+    bool visit_node(const BVHNode* node, int node_index)
+    {
+        if (node->face_count > 0)
+            return true;
+
+        const BVHDipole* dipole = &(shape->bvh_dipoles[node_index]);
+        Vector3 to_center = vector3_sub(vector3_setp(dipole->center), query_point);
+        float d = vector3_length(to_center);
+        if (d > WINDING_NUMBER_BETA * dipole->radius)
+        {
+            // solid angle of a dipole : n . (c - q) / |c - q|^3
+            solid_angle += vector3_dot(vector3_setp(dipole->normal), to_center) / (d * d * d);
+            return false;
         }
+        return true;
     }
 
-    *out_signed_distance = closest_dist;
-    *out_closest_point = closest_point;
-    *out_face_index = closest_out_face_index;
-}
\ No newline at end of file
+    bool visit_leaf(const BVHNode* node, int)
+    {
+        const float* triangles = &(shape->leaf_triangles[node->offset * 9]);
+        for (int li = 0; li < node->face_count; ++li)
+        {
+            solid_angle += triangle_solid_angle(query_point, triangles_get_vertex(triangles, li, 0), triangles_get_vertex(triangles, li, 1), triangles_get_vertex(triangles, li, 2));
+        }
+        return true;
+    }
+};
+
+float winding_number(ObjData::Shape* shape, Vector3 query_point)
+{
+    WindingNumberVisitor visitor = { shape, query_point, 0.f };
+    bvh_traverse(shape, visitor);
+    return visitor.solid_angle / (4.f * PIF);
+}
+
+float signed_distance_from_closest(ObjData::Shape* shape, Vector3 query_point, float squared_distance, Vector3 closest_point, int face_index, TriangleFeature feature, SignMethod sign_method)
+{
+    float dist = sqrtf(squared_distance);
+    if (sign_method == SIGN_METHOD_WINDING_NUMBER)
+    {
+        if (winding_number(shape, query_point) >= 0.5f)
+        {
+            dist = dist * -1.f;
+        }
+    }
+    else if (face_index >= 0)
+    {
+        // the query point is outside if it is on the positive side of the pseudonormal of the closest feature.
+        // Without a closest face (a shape without faces), it is outside.
+        // The face normal alone gives the wrong sign around the edges and vertices.
+        Vector3 normal = shape_get_pseudonormal(shape, face_index, feature);
+        if (vector3_dot(normal, vector3_sub(query_point, closest_point)) <= 0.f)
+        {
+            dist = dist * -1.f;
+        }
+    }
+
+    return dist;
+}
+
+float signed_distance(ObjData::Shape* shape, Vector3 query_point, Vector3* out_closest_point, int* out_face_index, SignMethod sign_method, int seed_face_index)
+{
+    float sq_dist;
+    Vector3 closest_point;
+    int face_index;
+    TriangleFeature feature;
+    minimum_squared_distance(shape, query_point, &sq_dist, &closest_point, &face_index, &feature, seed_face_index);
+
+    float dist = signed_distance_from_closest(shape, query_point, sq_dist, closest_point, face_index, feature, sign_method);
+
+    if (out_closest_point != NULL)
+        *out_closest_point = closest_point;
+    if (out_face_index != NULL)
+        *out_face_index = face_index;
+
+    return dist;
+}
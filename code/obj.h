@@ -3,6 +3,9 @@
 
 #include "aabb.h"
 #include "vector.h"
+#include "geometry_algorithm.h"
+#include "common.h"
+#include <stdint.h>
 #include <vector>
 
 struct BVH
@@ -14,6 +17,92 @@ struct BVH
 	int right;
 };
 
+// BVH linearized for the traversals, 32 bytes so two nodes share a cache line. The nodes are in depth first
+// order : nodes[0] is the root and the left child of an internal node is the node right after it.
+struct alignas(32) BVHNode
+{
+	float min_p[3];
+	int offset; // internal node : index of the right child, leaf : first face in Shape::leaf_face_indices
+	float max_p[3];
+	int face_count; // 0 for an internal node
+};
+
+typedef std::vector<BVHNode, AlignedAllocator<BVHNode, 32>> BVHNodeArray;
+
+// a leaf holds up to BVH_LEAF_MAX_FACES faces, the count takes 3 bits of the wide leaf child
+#define BVH_LEAF_MAX_FACES 8
+// at least a full block of triangles_closest_point, so no lane idles with AVX2
+#define BVH_LEAF_DEFAULT_FACES (TRIANGLES_LANE_WIDTH > 4 ? TRIANGLES_LANE_WIDTH : 4)
+
+#define BVH_WIDE_WIDTH 4
+#define BVH_WIDE_EMPTY_CHILD (-2147483647 - 1)
+// the faces [first, first + count) of Shape::leaf_face_indices
+#define BVH_WIDE_LEAF_CHILD(first, count) (-((((first) << 3) | ((count) - 1)) + 1))
+#define BVH_WIDE_LEAF_FIRST(child) ((-(child) - 1) >> 3)
+#define BVH_WIDE_LEAF_COUNT(child) (((-(child) - 1) & 7) + 1)
+
+// BVH_WIDE_WIDTH children per node, collapsed from the binary bvh. The child bounds are in SoA so
+// the distances to every child are computed at once. An empty slot has inverted bounds.
+// children[c] >= 0 : node index, BVH_WIDE_EMPTY_CHILD : empty, otherwise BVH_WIDE_LEAF_CHILD for a leaf
+struct BVHWide
+{
+	float min_x[BVH_WIDE_WIDTH];
+	float min_y[BVH_WIDE_WIDTH];
+	float min_z[BVH_WIDE_WIDTH];
+	float max_x[BVH_WIDE_WIDTH];
+	float max_y[BVH_WIDE_WIDTH];
+	float max_z[BVH_WIDE_WIDTH];
+	int children[BVH_WIDE_WIDTH];
+};
+
+// BVHWide with the child bounds stored as 8 bit steps from the node bounds, 64 bytes instead of 112.
+// bound = origin + q * scale. scale is a power of two so the product is exact, and the steps are rounded
+// outwards at the build so the child boxes only grow.
+struct alignas(64) BVHWideQuantized
+{
+	float origin[3]; // min corner of the node
+	float scale[3];
+	uint8_t min_x[BVH_WIDE_WIDTH];
+	uint8_t min_y[BVH_WIDE_WIDTH];
+	uint8_t min_z[BVH_WIDE_WIDTH];
+	uint8_t max_x[BVH_WIDE_WIDTH];
+	uint8_t max_y[BVH_WIDE_WIDTH];
+	uint8_t max_z[BVH_WIDE_WIDTH];
+	int children[BVH_WIDE_WIDTH]; // as BVHWide::children, the bounds of an empty child are meaningless
+};
+
+// far field expansion of the triangles under a bvh node for the fast winding number (Barill et al. 2018)
+struct BVHDipole
+{
+	float center[3]; // area weighted centroid of the triangles
+	float normal[3]; // sum of the area weighted triangle normals
+	float radius; // distance from center to the farthest triangle vertex
+};
+
+enum SignMethod
+{
+	SIGN_METHOD_PSEUDONORMAL = 0, // side of the pseudonormal of the closest feature, needs a closed mesh
+	SIGN_METHOD_WINDING_NUMBER // inside if the generalized winding number >= 0.5, robust to holes
+};
+
+enum BVHBuilder
+{
+	BVH_BUILDER_MEDIAN = 0, // splits at the median of the longest axis
+	BVH_BUILDER_SAH, // binned surface area heuristic, slower build but fewer nodes visited per query
+	BVH_BUILDER_LBVH // splits at the highest differing bit of the sorted morton codes, the fastest build
+};
+
+struct ObjLoadConfig
+{
+	float model_scale = 1.f;
+	BVHBuilder bvh_builder = BVH_BUILDER_MEDIAN;
+	bool bvh_rotations = false; // tree rotations after the build to shrink the node surface areas
+	int thread_count = 0; // bvh build threads, 0 : std::thread::hardware_concurrency()
+	bool bvh_quantize = false; // quantized_bvhs replace wide_bvhs and bvhs, for very large meshes
+	int bvh_leaf_size = BVH_LEAF_DEFAULT_FACES; // faces per leaf, 1 to BVH_LEAF_MAX_FACES
+	bool triangle_table = false; // TrianglePrecomputed of the leaf faces, fewer flops per query for 96 bytes per face
+};
+
 struct ObjData
 {
 	struct Shape
@@ -22,20 +111,62 @@ struct ObjData
 		std::vector<float> normals;
 		std::vector<uint32_t> indices;
 
+		// angle weighted pseudonormals (Baerentzen and Aanaes) giving the sign of the distance
+		// when the closest point is on a vertex or an edge.
+		std::vector<float> vertex_pseudonormals; // same layout as positions
+		std::vector<float> edge_pseudonormals; // 9 floats per face for the edges ab, bc, ca
+
 		float min_positions[3];
 		float max_positions[3];
 
-		std::vector<BVH> bvhs;
+		std::vector<BVH> bvhs; // the tree of the builder, leaves first and the root last
+		BVHNodeArray bvh_nodes; // bvhs in depth first order, used by the traversals
+		std::vector<BVHDipole> bvh_dipoles; // bvh_dipoles[i] is for bvh_nodes[i]
 		int bvh_max_depth;
+		float bvh_sah_cost; // bvh_get_sah_cost of bvhs
+
+		std::vector<BVHWide> wide_bvhs; // wide_bvhs[0] is the root, used by minimum_squared_distance
+		std::vector<BVHWideQuantized, AlignedAllocator<BVHWideQuantized, 64>> quantized_bvhs; // same tree as wide_bvhs
+		int wide_bvh_max_depth;
+
+		// the faces of the leaves of bvh_nodes and wide_bvhs, in leaf order so a leaf is contiguous. A leaf starts
+		// at a multiple of TRIANGLES_LANE_WIDTH, the padding slots repeat its last face.
+		int bvh_leaf_size;
+		std::vector<int> leaf_face_indices;
+		std::vector<float> leaf_triangles; // the positions of a, b, c of leaf_face_indices in the blocks of triangles_get_offset
+		std::vector<TrianglePrecomputed> leaf_triangle_table; // same order as leaf_face_indices, empty unless ObjLoadConfig::triangle_table
+		std::vector<int> face_leaf_slots; // index in leaf_face_indices of every face, with leaf_triangle_table
 	};
 
 	std::vector<Shape> shapes;
 };
 
 ObjData* obj_load(const char* path, float model_scale = 1.f);
+ObjData* obj_load(const char* path, const ObjLoadConfig& config);
 void obj_unload(ObjData* od);
+// obj_load in two steps : obj_parse reads the file into the positions, indices and bounds of the shapes,
+// shape_init computes the normals, the pseudonormals and the bvh of one shape. The shapes are independent after the parse.
+ObjData* obj_parse(const char* path, const ObjLoadConfig& config);
+void shape_init(ObjData::Shape* shape, const ObjLoadConfig& config);
+// (re)builds the bvh and its derived data over the faces, with config.bvh_*
+void shape_build_bvh(ObjData::Shape* shape, const ObjLoadConfig& config);
+size_t shape_get_bvh_memory_size(const ObjData::Shape* shape);
+
+// the box, sphere, nearest and ray queries over bvh_nodes are in bvh_traverse.h
 
-void bvh_intersect_aabb_with_leaf(ObjData::Shape* shape, AABB aabb, std::vector<int>* out_face_indices);
-void minimum_squared_distance(ObjData::Shape* shape, Vector3 query_point, float* out_squared_distance, Vector3* out_closest_point, int* out_face_index);
+// seed_face_index >= 0 starts the search with the distance to that face as the upper bound.
+// The closest face of a neighbor query point prunes most of the bvh nodes at once.
+void minimum_squared_distance(ObjData::Shape* shape, Vector3 query_point, float* out_squared_distance, Vector3* out_closest_point, int* out_face_index, TriangleFeature* out_feature, int seed_face_index = -1);
+// minimum_squared_distance limited to the triangles closer than max_distance, the subtrees beyond it are never
+// visited. Returns false, with out_face_index -1, when there is none.
+bool minimum_squared_distance_within(ObjData::Shape* shape, Vector3 query_point, float max_distance, float* out_squared_distance, Vector3* out_closest_point, int* out_face_index, TriangleFeature* out_feature, int seed_face_index = -1);
+// the normal of the face, edge or vertex of the face. It is not normalized for the face.
+Vector3 shape_get_pseudonormal(const ObjData::Shape* shape, int face_index, TriangleFeature feature);
+// exact solid angle for the near triangles and the dipole of the bvh node for the far subtrees
+float winding_number(ObjData::Shape* shape, Vector3 query_point);
+// applies the sign_method to the result of minimum_squared_distance
+float signed_distance_from_closest(ObjData::Shape* shape, Vector3 query_point, float squared_distance, Vector3 closest_point, int face_index, TriangleFeature feature, SignMethod sign_method);
+// out_closest_point and out_face_index can be NULL
+float signed_distance(ObjData::Shape* shape, Vector3 query_point, Vector3* out_closest_point, int* out_face_index, SignMethod sign_method = SIGN_METHOD_PSEUDONORMAL, int seed_face_index = -1);
 
 #endif
\ No newline at end of file
@@ -2,6 +2,7 @@
 
 #include <glad/glad.h>
 #include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
 
 #include "camera.h"
 #include "obj.h"
@@ -92,7 +93,7 @@ void renderer_init(Renderer* r, const std::vector<SDFObjData*>& sdf_objs)
         {
             ObjData::Shape& shape = od->shapes[ssi];
             SDFGPUBuffer& gpub = sdf_buffers[ssi];
-            Grid& shape_grid = sod->grids[si];
+            Grid& shape_grid = sod->grids[ssi];
             std::vector<Vector3>& sdf_debug_grid_point = sdf_debug_grid_points[ssi];
             sdf_debug_grid_point.reserve(shape_grid.nz * shape_grid.ny * shape_grid.nx);
 
@@ -132,7 +133,31 @@ void renderer_init(Renderer* r, const std::vector<SDFObjData*>& sdf_objs)
             glTexParameterf(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
             glTexParameterf(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
             glTexParameterf(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-            glTexImage3D(GL_TEXTURE_3D, 0, GL_R32F, shape_grid.nx, shape_grid.ny, shape_grid.nz, 0, GL_RED, GL_FLOAT, shape_grid.sdfs.data());
+            glTexImage3D(GL_TEXTURE_3D, 0, GL_R32F, shape_grid.nx, shape_grid.ny, shape_grid.nz, 0, GL_RED, GL_FLOAT, NULL);
+
+            // upload brick by brick. The bricks on the grid boundary are clipped.
+            float brick_samples[SDF_BRICK_VOXEL_COUNT];
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, SDF_BRICK_SIZE);
+            glPixelStorei(GL_UNPACK_IMAGE_HEIGHT, SDF_BRICK_SIZE);
+            for (int bi = 0; bi < (int)shape_grid.bricks.size(); ++bi)
+            {
+                int bx = bi % shape_grid.brick_counts[0];
+                int by = (bi / shape_grid.brick_counts[0]) % shape_grid.brick_counts[1];
+                int bz = bi / (shape_grid.brick_counts[0] * shape_grid.brick_counts[1]);
+
+                int x = bx * SDF_BRICK_SIZE;
+                int y = by * SDF_BRICK_SIZE;
+                int z = bz * SDF_BRICK_SIZE;
+                int w = std::min(SDF_BRICK_SIZE, shape_grid.nx - x);
+                int h = std::min(SDF_BRICK_SIZE, shape_grid.ny - y);
+                int d = std::min(SDF_BRICK_SIZE, shape_grid.nz - z);
+
+                grid_copy_brick(&shape_grid, bi, brick_samples);
+                glTexSubImage3D(GL_TEXTURE_3D, 0, x, y, z, w, h, d, GL_RED, GL_FLOAT, brick_samples);
+            }
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+            glPixelStorei(GL_UNPACK_IMAGE_HEIGHT, 0);
 
             glBindVertexArray(0);
         }
@@ -279,13 +304,17 @@ void sdf_obj_render(Renderer* r, size_t sdf_obj_index)
             }
         }
 
-        if (sod->render_grid_points || sod->render_sdf_debug_info)
+        if (sod->render_grid_points || (sod->render_sdf_debug_info && shape_grid.sdf_debugs.empty() == false))
         {
             Vector3 grid_point_color = VECTOR3_COLOR_WHITE;
-            for (size_t sdi = 0; sdi < shape_grid.sdf_debugs.size(); ++sdi)
+            SDFDebug empty_sd = {};
+            for (size_t sdi = 0; sdi < grid_points.size(); ++sdi)
             {
-                float sd_value = shape_grid.sdfs[sdi];
-                const SDFDebug& sd = shape_grid.sdf_debugs[sdi];
+                int gi = (int)(sdi % shape_grid.nx);
+                int gj = (int)((sdi / shape_grid.nx) % shape_grid.ny);
+                int gk = (int)(sdi / ((size_t)shape_grid.nx * shape_grid.ny));
+                float sd_value = grid_get_sdf(&shape_grid, gi, gj, gk);
+                const SDFDebug& sd = shape_grid.sdf_debugs.empty() ? empty_sd : shape_grid.sdf_debugs[sdi];
                 Vector3 grid_point = vector3_add(sdf_pos, grid_points[sdi]);
 
                 if (sod->render_grid_points)
@@ -303,7 +332,7 @@ void sdf_obj_render(Renderer* r, size_t sdf_obj_index)
                         grid_point_color = VECTOR3_COLOR_BLUE;
                     }
 
-                    if (sd.is_set == false)
+                    if (shape_grid.sdf_debugs.empty() == false && sd.is_set == false)
                     {
                         grid_point_color = VECTOR3_COLOR_LAVENDER;
                     }
@@ -349,7 +378,7 @@ void sdf_obj_render(Renderer* r, size_t sdf_obj_index)
             glUniform1f(glGetUniformLocation(pso, "iso_value"), sod->iso_value);
 
             glBindVertexArray(gpub.vao);
-            glDrawArrays(GL_POINTS, 0, (GLsizei)shape_grid.sdfs.size());
+            glDrawArrays(GL_POINTS, 0, (GLsizei)grid_get_voxel_count(&shape_grid));
         }
     }
 
@@ -0,0 +1,243 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "obj.h"
+#include "sdf_obj.h"
+
+// headless sdf baker. It doesn't touch glfw/glad/imgui so it can run on machines without a display.
+static void print_usage()
+{
+    printf("usage: sdf_bake <mesh.obj> <output.sdf> [options]\n");
+    printf("  -s, --scale <float>     model scale (default 1.0)\n");
+    printf("  -d, --delta <float>     grid delta (default 0.05)\n");
+    printf("  -p, --padding <int>     grid padding in cells (default 1)\n");
+    printf("  -t, --threads <int>     worker thread count, 0 uses every core (default 0)\n");
+    printf("  -b, --band <int>        narrow band width in cells, 0 computes every voxel exactly (default 0)\n");
+    printf("  -f, --far-field <mode>  clamp | sweep, how the voxels outside of the band are filled (default clamp)\n");
+    printf("  -g, --sign <mode>       pseudonormal | winding, winding number sign for meshes with holes (default pseudonormal)\n");
+    printf("  -a, --adf <float>       write an adaptive octree with this distance tolerance instead of a grid\n");
+    printf("  -B, --bvh <builder>     median | sah | lbvh, bvh split strategy (default median)\n");
+    printf("  -r, --bvh-rotate        tree rotations after the bvh build\n");
+    printf("  -q, --bvh-quantize      8 bit bvh node bounds, less memory for very large meshes\n");
+    printf("  -l, --bvh-leaf <int>    faces per bvh leaf, 1 to 8 (default %d)\n", BVH_LEAF_DEFAULT_FACES);
+    printf("  -T, --triangle-table    precomputed triangle data, faster queries for 96 bytes per triangle\n");
+    printf("  -P, --pin               pin the worker threads to cpus, spread over the NUMA nodes\n");
+    printf("  -R, --numa-replicate    a copy of the mesh and its bvh on every NUMA node, implies --pin\n");
+}
+
+static bool is_option(const char* arg, const char* short_name, const char* long_name)
+{
+    return strcmp(arg, short_name) == 0 || strcmp(arg, long_name) == 0;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3)
+    {
+        print_usage();
+        return 1;
+    }
+
+    const char* mesh_path = argv[1];
+    const char* output_path = argv[2];
+
+    SDFBakeConfig config;
+    bool pin_threads = false;
+    for (int ai = 3; ai < argc; ++ai)
+    {
+        const char* arg = argv[ai];
+        if (is_option(arg, "-r", "--bvh-rotate"))
+        {
+            config.bvh_rotations = true;
+            continue;
+        }
+
+        if (is_option(arg, "-q", "--bvh-quantize"))
+        {
+            config.bvh_quantize = true;
+            continue;
+        }
+
+        if (is_option(arg, "-T", "--triangle-table"))
+        {
+            config.triangle_table = true;
+            continue;
+        }
+
+        if (is_option(arg, "-P", "--pin"))
+        {
+            pin_threads = true;
+            continue;
+        }
+
+        if (is_option(arg, "-R", "--numa-replicate"))
+        {
+            config.numa_replicate = true;
+            continue;
+        }
+
+        if (ai + 1 >= argc)
+        {
+            printf("Missing value for %s\n", arg);
+            print_usage();
+            return 1;
+        }
+
+        const char* value = argv[++ai];
+        if (is_option(arg, "-s", "--scale"))
+        {
+            config.model_scale = (float)atof(value);
+        }
+        else if (is_option(arg, "-d", "--delta"))
+        {
+            config.grid_delta = (float)atof(value);
+        }
+        else if (is_option(arg, "-p", "--padding"))
+        {
+            config.grid_padding = atoi(value);
+        }
+        else if (is_option(arg, "-t", "--threads"))
+        {
+            config.thread_count = atoi(value);
+        }
+        else if (is_option(arg, "-b", "--band"))
+        {
+            config.narrow_band = atoi(value);
+        }
+        else if (is_option(arg, "-f", "--far-field"))
+        {
+            if (strcmp(value, "clamp") == 0)
+            {
+                config.far_field = SDF_FAR_FIELD_CLAMP;
+            }
+            else if (strcmp(value, "sweep") == 0)
+            {
+                config.far_field = SDF_FAR_FIELD_FAST_SWEEPING;
+            }
+            else
+            {
+                printf("Unknown far field mode %s\n", value);
+                print_usage();
+                return 1;
+            }
+        }
+        else if (is_option(arg, "-g", "--sign"))
+        {
+            if (strcmp(value, "pseudonormal") == 0)
+            {
+                config.sign_method = SIGN_METHOD_PSEUDONORMAL;
+            }
+            else if (strcmp(value, "winding") == 0)
+            {
+                config.sign_method = SIGN_METHOD_WINDING_NUMBER;
+            }
+            else
+            {
+                printf("Unknown sign mode %s\n", value);
+                print_usage();
+                return 1;
+            }
+        }
+        else if (is_option(arg, "-B", "--bvh"))
+        {
+            if (strcmp(value, "median") == 0)
+            {
+                config.bvh_builder = BVH_BUILDER_MEDIAN;
+            }
+            else if (strcmp(value, "sah") == 0)
+            {
+                config.bvh_builder = BVH_BUILDER_SAH;
+            }
+            else if (strcmp(value, "lbvh") == 0)
+            {
+                config.bvh_builder = BVH_BUILDER_LBVH;
+            }
+            else
+            {
+                printf("Unknown bvh builder %s\n", value);
+                print_usage();
+                return 1;
+            }
+        }
+        else if (is_option(arg, "-l", "--bvh-leaf"))
+        {
+            config.bvh_leaf_size = atoi(value);
+        }
+        else if (is_option(arg, "-a", "--adf"))
+        {
+            config.output = SDF_OUTPUT_ADF;
+            config.adf_tolerance = (float)atof(value);
+            config.adf_resample_grid = false;
+        }
+        else
+        {
+            printf("Unknown option %s\n", arg);
+            print_usage();
+            return 1;
+        }
+    }
+
+    if (config.model_scale <= 0.f || config.grid_delta <= 0.f || config.grid_padding < 0 || config.thread_count < 0 || config.narrow_band < 0 || config.adf_tolerance <= 0.f || config.bvh_leaf_size < 1 || config.bvh_leaf_size > BVH_LEAF_MAX_FACES)
+    {
+        printf("Invalid option value\n");
+        print_usage();
+        return 1;
+    }
+
+    if (is_file_exist(mesh_path) == false)
+    {
+        printf("Fail to find %s\n", mesh_path);
+        return 1;
+    }
+
+    // the workers only read the copy of their node if they stay on it
+    if (config.numa_replicate)
+    {
+        pin_threads = true;
+    }
+
+    // every job of the bake runs on these threads
+    scheduler_configure(config.thread_count, pin_threads);
+
+    // the shapes are written while the others are still baking
+    config.output_path = output_path;
+    SDFObjData* sod = sdf_obj_load(mesh_path, config);
+
+    for (size_t si = 0; si < sod->data->shapes.size(); ++si)
+    {
+        const ObjData::Shape& shape = sod->data->shapes[si];
+        printf("shape %d : %d bvh nodes, depth %d, sah cost %.2f, %.2f MB\n", (int)si, (int)shape.bvh_nodes.size(), shape.bvh_max_depth, shape.bvh_sah_cost, (double)shape_get_bvh_memory_size(&shape) / (1024.0 * 1024.0));
+    }
+
+    size_t voxel_count = 0;
+    size_t memory_size = 0;
+    if (sod->adfs.empty() == false)
+    {
+        for (size_t si = 0; si < sod->adfs.size(); ++si)
+        {
+            const ADF& adf = sod->adfs[si];
+            printf("shape %d : %d nodes, %d leaves, depth %d\n", (int)si, (int)adf.nodes.size(), (int)adf_get_leaf_count(&adf), adf.max_depth);
+            voxel_count += adf.nodes.size();
+            memory_size += adf_get_memory_size(&adf);
+        }
+        printf("%llu nodes in total, %.2f MB\n", (unsigned long long)voxel_count, (double)memory_size / (1024.0 * 1024.0));
+    }
+    else
+    {
+        for (size_t si = 0; si < sod->grids.size(); ++si)
+        {
+            const Grid& grid = sod->grids[si];
+            printf("shape %d : %d x %d x %d, %d / %d bricks allocated\n", (int)si, grid.nx, grid.ny, grid.nz, (int)grid.allocated_bricks.size(), (int)grid.bricks.size());
+            voxel_count += grid_get_voxel_count(&grid);
+            memory_size += grid_get_memory_size(&grid);
+        }
+        printf("%llu voxels in total, %.2f MB\n", (unsigned long long)voxel_count, (double)memory_size / (1024.0 * 1024.0));
+    }
+
+    bool saved = sod->output_saved;
+    sdf_obj_unload(sod);
+
+    return saved ? 0 : 1;
+}
@@ -0,0 +1,205 @@
+#include "sdf_grid.h"
+
+#include <math.h>
+#include <assert.h>
+
+void grid_init_bricks(Grid* grid, float constant)
+{
+    grid->brick_counts[0] = (grid->nx + SDF_BRICK_SIZE - 1) / SDF_BRICK_SIZE;
+    grid->brick_counts[1] = (grid->ny + SDF_BRICK_SIZE - 1) / SDF_BRICK_SIZE;
+    grid->brick_counts[2] = (grid->nz + SDF_BRICK_SIZE - 1) / SDF_BRICK_SIZE;
+
+    size_t brick_count = (size_t)grid->brick_counts[0] * grid->brick_counts[1] * grid->brick_counts[2];
+    grid->bricks.assign(brick_count, -1);
+    grid->brick_constants.assign(brick_count, constant);
+    grid->allocated_bricks.clear();
+    grid->brick_sdfs.clear();
+}
+
+int grid_allocate_brick(Grid* grid, int brick_index)
+{
+    int slot = grid->bricks[brick_index];
+    if (slot >= 0)
+        return slot;
+
+    slot = (int)grid->allocated_bricks.size();
+    grid->bricks[brick_index] = slot;
+    grid->allocated_bricks.push_back(brick_index);
+    grid->brick_sdfs.resize(grid->brick_sdfs.size() + SDF_BRICK_VOXEL_COUNT, grid->brick_constants[brick_index]);
+
+    return slot;
+}
+
+void grid_allocate_all_bricks(Grid* grid)
+{
+    grid->allocated_bricks.reserve(grid->bricks.size());
+    grid->brick_sdfs.reserve(grid->bricks.size() * SDF_BRICK_VOXEL_COUNT);
+    for (int bi = 0; bi < (int)grid->bricks.size(); ++bi)
+    {
+        grid_allocate_brick(grid, bi);
+    }
+}
+
+int grid_assign_brick_slot(Grid* grid, int brick_index)
+{
+    int slot = grid->bricks[brick_index];
+    if (slot >= 0)
+        return slot;
+
+    slot = (int)grid->allocated_bricks.size();
+    grid->bricks[brick_index] = slot;
+    grid->allocated_bricks.push_back(brick_index);
+
+    return slot;
+}
+
+void grid_assign_all_brick_slots(Grid* grid)
+{
+    grid->allocated_bricks.reserve(grid->bricks.size());
+    for (int bi = 0; bi < (int)grid->bricks.size(); ++bi)
+    {
+        grid_assign_brick_slot(grid, bi);
+    }
+}
+
+void grid_resize_brick_samples(Grid* grid)
+{
+    grid->brick_sdfs.resize(grid->allocated_bricks.size() * SDF_BRICK_VOXEL_COUNT);
+}
+
+void grid_fill_brick_constant(Grid* grid, int slot)
+{
+    float constant = grid->brick_constants[grid->allocated_bricks[slot]];
+    float* samples = &(grid->brick_sdfs[(size_t)slot * SDF_BRICK_VOXEL_COUNT]);
+    for (int vi = 0; vi < SDF_BRICK_VOXEL_COUNT; ++vi)
+    {
+        samples[vi] = constant;
+    }
+}
+
+int grid_get_brick_index(const Grid* grid, int i, int j, int k)
+{
+    int bi = i / SDF_BRICK_SIZE;
+    int bj = j / SDF_BRICK_SIZE;
+    int bk = k / SDF_BRICK_SIZE;
+
+    return (bk * grid->brick_counts[1] + bj) * grid->brick_counts[0] + bi;
+}
+
+size_t grid_get_sample_slot(const Grid* grid, int i, int j, int k)
+{
+    int slot = grid->bricks[grid_get_brick_index(grid, i, j, k)];
+    if (slot < 0)
+        return (size_t)-1;
+
+    int local = ((k % SDF_BRICK_SIZE) * SDF_BRICK_SIZE + (j % SDF_BRICK_SIZE)) * SDF_BRICK_SIZE + (i % SDF_BRICK_SIZE);
+    return (size_t)slot * SDF_BRICK_VOXEL_COUNT + local;
+}
+
+void grid_get_slot_coordinate(const Grid* grid, size_t slot, int* out_i, int* out_j, int* out_k)
+{
+    int brick_index = grid->allocated_bricks[slot / SDF_BRICK_VOXEL_COUNT];
+    int local = (int)(slot % SDF_BRICK_VOXEL_COUNT);
+
+    int bi = brick_index % grid->brick_counts[0];
+    int bj = (brick_index / grid->brick_counts[0]) % grid->brick_counts[1];
+    int bk = brick_index / (grid->brick_counts[0] * grid->brick_counts[1]);
+
+    *out_i = bi * SDF_BRICK_SIZE + local % SDF_BRICK_SIZE;
+    *out_j = bj * SDF_BRICK_SIZE + (local / SDF_BRICK_SIZE) % SDF_BRICK_SIZE;
+    *out_k = bk * SDF_BRICK_SIZE + local / (SDF_BRICK_SIZE * SDF_BRICK_SIZE);
+}
+
+float grid_get_sdf(const Grid* grid, int i, int j, int k)
+{
+    int brick_index = grid_get_brick_index(grid, i, j, k);
+    int slot = grid->bricks[brick_index];
+    if (slot < 0)
+        return grid->brick_constants[brick_index];
+
+    int local = ((k % SDF_BRICK_SIZE) * SDF_BRICK_SIZE + (j % SDF_BRICK_SIZE)) * SDF_BRICK_SIZE + (i % SDF_BRICK_SIZE);
+    return grid->brick_sdfs[(size_t)slot * SDF_BRICK_VOXEL_COUNT + local];
+}
+
+void grid_set_sdf(Grid* grid, int i, int j, int k, float sdf)
+{
+    size_t slot = grid_get_sample_slot(grid, i, j, k);
+    assert(slot != (size_t)-1);
+
+    grid->brick_sdfs[slot] = sdf;
+}
+
+float grid_sample(const Grid* grid, Vector3 p)
+{
+    float inv_delta = 1.f / grid->delta;
+    int counts[3] = { grid->nx, grid->ny, grid->nz };
+    int c0[3];
+    int c1[3];
+    float t[3];
+
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        float g = (p.v[axis] - grid->min_pos[axis]) * inv_delta;
+        float g_max = (float)(counts[axis] - 1);
+        if (g < 0.f) g = 0.f;
+        if (g > g_max) g = g_max;
+
+        c0[axis] = (int)floorf(g);
+        c1[axis] = c0[axis] + 1 < counts[axis] ? c0[axis] + 1 : c0[axis];
+        t[axis] = g - (float)c0[axis];
+    }
+
+    float s000 = grid_get_sdf(grid, c0[0], c0[1], c0[2]);
+    float s100 = grid_get_sdf(grid, c1[0], c0[1], c0[2]);
+    float s010 = grid_get_sdf(grid, c0[0], c1[1], c0[2]);
+    float s110 = grid_get_sdf(grid, c1[0], c1[1], c0[2]);
+    float s001 = grid_get_sdf(grid, c0[0], c0[1], c1[2]);
+    float s101 = grid_get_sdf(grid, c1[0], c0[1], c1[2]);
+    float s011 = grid_get_sdf(grid, c0[0], c1[1], c1[2]);
+    float s111 = grid_get_sdf(grid, c1[0], c1[1], c1[2]);
+
+    float s00 = s000 + (s100 - s000) * t[0];
+    float s10 = s010 + (s110 - s010) * t[0];
+    float s01 = s001 + (s101 - s001) * t[0];
+    float s11 = s011 + (s111 - s011) * t[0];
+
+    float s0 = s00 + (s10 - s00) * t[1];
+    float s1 = s01 + (s11 - s01) * t[1];
+
+    return s0 + (s1 - s0) * t[2];
+}
+
+void grid_copy_brick(const Grid* grid, int brick_index, float* out_samples)
+{
+    int slot = grid->bricks[brick_index];
+    if (slot < 0)
+    {
+        float constant = grid->brick_constants[brick_index];
+        for (int si = 0; si < SDF_BRICK_VOXEL_COUNT; ++si)
+        {
+            out_samples[si] = constant;
+        }
+    }
+    else
+    {
+        const float* samples = &(grid->brick_sdfs[(size_t)slot * SDF_BRICK_VOXEL_COUNT]);
+        for (int si = 0; si < SDF_BRICK_VOXEL_COUNT; ++si)
+        {
+            out_samples[si] = samples[si];
+        }
+    }
+}
+
+size_t grid_get_voxel_count(const Grid* grid)
+{
+    return (size_t)grid->nx * grid->ny * grid->nz;
+}
+
+size_t grid_get_memory_size(const Grid* grid)
+{
+    return sizeof(int) * grid->bricks.size() +
+        sizeof(float) * grid->brick_constants.size() +
+        sizeof(int) * grid->allocated_bricks.size() +
+        sizeof(float) * grid->brick_sdfs.size() +
+        sizeof(SDFDebug) * grid->sdf_debugs.size();
+}
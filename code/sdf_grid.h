@@ -0,0 +1,76 @@
+#ifndef __SDF_GRID_H__
+#define __SDF_GRID_H__
+
+#include <stddef.h>
+#include <vector>
+#include "vector.h"
+#include "common.h"
+
+#define SDF_BRICK_SIZE 8
+#define SDF_BRICK_VOXEL_COUNT (SDF_BRICK_SIZE * SDF_BRICK_SIZE * SDF_BRICK_SIZE)
+
+struct SDFDebug
+{
+    bool is_set;
+    Vector3 tri[3];
+    Vector3 closest_tri_pos;
+    Vector3 closest_tri_normal;
+};
+
+// sparse grid of nx * ny * nz sample points made of SDF_BRICK_SIZE^3 bricks.
+// grid point (i, j, k) is at min_pos + delta * (i, j, k).
+// bricks[b] >= 0 : brick b is allocated. Its samples are brick_sdfs[bricks[b] * SDF_BRICK_VOXEL_COUNT + local]
+//                  where local = (lk * SDF_BRICK_SIZE + lj) * SDF_BRICK_SIZE + li
+// bricks[b] < 0  : every sample of brick b is brick_constants[b]
+// b = (bk * brick_counts[1] + bj) * brick_counts[0] + bi
+struct Grid
+{
+	int nx, ny, nz;
+    float delta;
+    float min_pos[3];
+    float max_pos[3];
+    float dimensions[3];
+
+    int brick_counts[3];
+    std::vector<int> bricks;
+    std::vector<float> brick_constants;
+    std::vector<int> allocated_bricks; // brick index of each allocated brick slot
+    std::vector<float, DefaultInitAllocator<float>> brick_sdfs;
+
+    // per grid point, (k * ny + j) * nx + i. Empty unless SDFBakeConfig::store_debug_info is set.
+    std::vector<SDFDebug> sdf_debugs;
+};
+
+// every brick becomes a constant brick with the value
+void grid_init_bricks(Grid* grid, float constant);
+// returns the slot of the brick. The samples of a new brick start with its constant.
+int grid_allocate_brick(Grid* grid, int brick_index);
+void grid_allocate_all_bricks(Grid* grid);
+
+// the same in two steps, without writing the samples : grid_assign_brick_slot only gives the brick a slot and
+// grid_resize_brick_samples makes room for the samples of the new slots, leaving them uninitialized.
+// Each brick is then filled by grid_fill_brick_constant in the job which computes it, so its pages are
+// first touched by that thread and end up on its NUMA node.
+int grid_assign_brick_slot(Grid* grid, int brick_index);
+void grid_assign_all_brick_slots(Grid* grid);
+void grid_resize_brick_samples(Grid* grid);
+void grid_fill_brick_constant(Grid* grid, int slot);
+
+int grid_get_brick_index(const Grid* grid, int i, int j, int k);
+// sample slot in brick_sdfs of the grid point. -1 if its brick is constant
+size_t grid_get_sample_slot(const Grid* grid, int i, int j, int k);
+// grid point of a sample slot. The point can be out of the grid for the bricks on the boundary.
+void grid_get_slot_coordinate(const Grid* grid, size_t slot, int* out_i, int* out_j, int* out_k);
+
+float grid_get_sdf(const Grid* grid, int i, int j, int k);
+void grid_set_sdf(Grid* grid, int i, int j, int k, float sdf); // the brick of (i, j, k) must be allocated
+// trilinear interpolation. p is clamped into the grid bounds.
+float grid_sample(const Grid* grid, Vector3 p);
+
+// fills SDF_BRICK_VOXEL_COUNT samples of the brick, constant or not
+void grid_copy_brick(const Grid* grid, int brick_index, float* out_samples);
+
+size_t grid_get_voxel_count(const Grid* grid);
+size_t grid_get_memory_size(const Grid* grid);
+
+#endif
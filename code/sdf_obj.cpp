@@ -2,13 +2,20 @@
 
 #include <thread>
 #include <stack>
+#include <algorithm>
+#include <float.h>
 
 #include "common.h"
 #include "obj.h"
 #include "geometry_algorithm.h"
+#include "fast_sweeping.h"
+#include "distance_packet.h"
+#include "bvh_traverse.h"
+#include "topology.h"
 
 
-static inline void grid_init(Grid* grid, ObjData::Shape& shape, SDFObjData* sod)
+// grid points are on the multiples of grid_delta around the padded shape bounds
+static void grid_init_dimensions(Grid* grid, ObjData::Shape& shape, SDFObjData* sod)
 {
     Vector3 min_pos = vector3_setp(shape.min_positions);
     Vector3 max_pos = vector3_setp(shape.max_positions);
@@ -17,9 +24,6 @@ static inline void grid_init(Grid* grid, ObjData::Shape& shape, SDFObjData* sod)
     min_pos = vector3_sub(min_pos, voxel_pad);
     max_pos = vector3_add(max_pos, voxel_pad);
 
-    // after setting min/max pos, change it into grid_delta to use it as padding to find another closest triangle
-    voxel_pad = vector3_set1(sod->grid_delta); 
-
     int xm = (int)floorf(min_pos.v[0] / sod->grid_delta);
     int ym = (int)floorf(min_pos.v[1] / sod->grid_delta);
     int zm = (int)floorf(min_pos.v[2] / sod->grid_delta);
@@ -28,6 +32,8 @@ static inline void grid_init(Grid* grid, ObjData::Shape& shape, SDFObjData* sod)
     int yp = (int)ceilf(max_pos.v[1] / sod->grid_delta);
     int zp = (int)ceilf(max_pos.v[2] / sod->grid_delta);
 
+    grid->delta = sod->grid_delta;
+
     grid->min_pos[0] = xm * sod->grid_delta;
     grid->min_pos[1] = ym * sod->grid_delta;
     grid->min_pos[2] = zm * sod->grid_delta;
@@ -44,12 +50,23 @@ static inline void grid_init(Grid* grid, ObjData::Shape& shape, SDFObjData* sod)
     grid->ny = yp - ym;
     grid->nz = zp - zm;
 
-    grid->sdfs = std::vector<float>(grid->nx * grid->ny * grid->nz, 10000000.f);
-    grid->sdf_debugs.resize(grid->sdfs.size());
+    if (sod->config.store_debug_info)
+    {
+        grid->sdf_debugs.resize(grid_get_voxel_count(grid));
+    }
+}
+
+static inline void grid_init(Grid* grid, ObjData::Shape& shape, SDFObjData* sod)
+{
+    grid_init_dimensions(grid, shape, sod);
+    grid_init_bricks(grid, 10000000.f);
+    grid_allocate_all_bricks(grid);
+
+    // use grid_delta as padding to find another closest triangle
+    Vector3 voxel_pad = vector3_set1(sod->grid_delta);
 
     Vector3 voxel_center;
     AABB voxel_aabb;
-    std::vector<int> triangle_faces;
     int grid_index = 0;
     int pos_index = 0;
     uint32_t tri_inds[3];
@@ -57,10 +74,13 @@ static inline void grid_init(Grid* grid, ObjData::Shape& shape, SDFObjData* sod)
     Vector3 tcp;
     float dist;
     float cur_sdf;
+    bool is_set;
     uint32_t closest_tri_pos_index;
     Vector3 closest_tri_pos;
     Vector3 closest_tri_normal;
     Vector3 tcp_to_vc;
+    TriangleFeature feature;
+    TriangleFeature closest_feature = TRIANGLE_FEATURE_FACE;
 
     for (int k = 0; k < grid->nz; ++k)
     {
@@ -81,23 +101,17 @@ static inline void grid_init(Grid* grid, ObjData::Shape& shape, SDFObjData* sod)
                 voxel_aabb.max_p.v[0] = voxel_center.v[0] + sod->grid_delta * 0.5f;
 
                 grid_index = (k * grid->ny + j) * grid->nx + i;
-                SDFDebug& sd = grid->sdf_debugs[grid_index];
-                cur_sdf = grid->sdfs[grid_index];
+                cur_sdf = grid_get_sdf(grid, i, j, k);
+                is_set = false;
 
-                while (sd.is_set == false)
+                // the box grows by grid_delta until it reaches a triangle
+                AABB query_aabb = voxel_aabb;
+                while (is_set == false)
                 {
-                    triangle_faces.clear();
-                    bvh_intersect_aabb_with_leaf(&shape, voxel_aabb, &triangle_faces);
-
-                    if (triangle_faces.size() == 0)
-                    {
-                        voxel_aabb.min_p = vector3_sub(voxel_aabb.min_p, voxel_pad);
-                        voxel_aabb.max_p = vector3_add(voxel_aabb.max_p, voxel_pad);
-                        continue;
-                    }
-
-                    for (int face_index : triangle_faces)
+                    bool is_found = false;
+                    bvh_query_aabb(&shape, query_aabb, [&](int face_index)
                     {
+                        is_found = true;
                         pos_index = face_index * 3;
 
                         tri_inds[0] = shape.indices[pos_index] * 3;
@@ -108,7 +122,7 @@ static inline void grid_init(Grid* grid, ObjData::Shape& shape, SDFObjData* sod)
                         tb = vector3_setp(&(shape.positions[tri_inds[1]]));
                         tc = vector3_setp(&(shape.positions[tri_inds[2]]));
 
-                        tcp = triangle_closest_point(voxel_center, ta, tb, tc);
+                        tcp = triangle_closest_point(voxel_center, ta, tb, tc, &feature);
 
                         dist = vector3_distance_sq(voxel_center, tcp);
 
@@ -117,7 +131,15 @@ static inline void grid_init(Grid* grid, ObjData::Shape& shape, SDFObjData* sod)
                             cur_sdf = dist;
                             closest_tri_pos_index = pos_index;
                             closest_tri_pos = tcp;
+                            closest_feature = feature;
                         }
+                    });
+
+                    if (is_found == false)
+                    {
+                        query_aabb.min_p = vector3_sub(query_aabb.min_p, voxel_pad);
+                        query_aabb.max_p = vector3_add(query_aabb.max_p, voxel_pad);
+                        continue;
                     }
 
                     tri_inds[0] = shape.indices[closest_tri_pos_index] * 3;
@@ -131,241 +153,712 @@ static inline void grid_init(Grid* grid, ObjData::Shape& shape, SDFObjData* sod)
                     tcp_to_vc = vector3_sub(voxel_center, closest_tri_pos);
 
                     cur_sdf = sqrtf(cur_sdf);
-                    if (vector3_dot(closest_tri_normal, tcp_to_vc) > 0.f)
+                    if (vector3_dot(shape_get_pseudonormal(&shape, closest_tri_pos_index / 3, closest_feature), tcp_to_vc) > 0.f)
                     {
-                        grid->sdfs[grid_index] = cur_sdf;
+                        grid_set_sdf(grid, i, j, k, cur_sdf);
                     }
                     else
                     {
-                        grid->sdfs[grid_index] = cur_sdf * -1.f;
+                        grid_set_sdf(grid, i, j, k, cur_sdf * -1.f);
                     }
 
-                    sd.is_set = true;
-                    sd.tri[0] = ta;
-                    sd.tri[1] = tb;
-                    sd.tri[2] = tc;
-                    sd.closest_tri_pos = closest_tri_pos;
-                    sd.closest_tri_normal = vector3_normalize(closest_tri_normal);
+                    is_set = true;
+                    if (grid->sdf_debugs.empty() == false)
+                    {
+                        SDFDebug& sd = grid->sdf_debugs[grid_index];
+                        sd.is_set = true;
+                        sd.tri[0] = ta;
+                        sd.tri[1] = tb;
+                        sd.tri[2] = tc;
+                        sd.closest_tri_pos = closest_tri_pos;
+                        sd.closest_tri_normal = vector3_normalize(closest_tri_normal);
+                    }
                 }
             }
         }
     }
 }
 
+enum
+{
+    VOXEL_STATE_FAR = 0,
+    VOXEL_STATE_FAR_VISITED = 1,
+    VOXEL_STATE_BAND = 2
+};
+
 struct Grid2Work
 {
     Grid* grid;
     ObjData::Shape* shape;
-    Vector3* voxels;
-    int begin;
-    int end;
+    uint8_t* sample_states; // NULL : every sample is computed. Otherwise only VOXEL_STATE_BAND samples.
+    // FLT_MAX, or the clamped band distance : the band samples without a triangle closer than it
+    // are clamped without the closest point search
+    float max_distance;
+    SignMethod sign_method;
+    const int* brick_slots; // allocated bricks in morton order, parallel_for runs over them
+    // NULL, or the copy of shape on every NUMA node (SDFBakeConfig::numa_replicate). Every entry, [0] included, is a replica made on its own node
+    ObjData::Shape* const* node_shapes;
+    int node_count;
 };
-static void grid2_work(void* param)
+
+// local sample indices of a brick in morton order, so consecutive samples are mostly neighbors
+static int brick_morton_locals[SDF_BRICK_VOXEL_COUNT];
+static std::once_flag brick_morton_locals_flag;
+
+static void init_brick_morton_locals()
+{
+    std::vector<std::pair<uint64_t, int>> codes(SDF_BRICK_VOXEL_COUNT);
+    for (int local = 0; local < SDF_BRICK_VOXEL_COUNT; ++local)
+    {
+        int li = local % SDF_BRICK_SIZE;
+        int lj = (local / SDF_BRICK_SIZE) % SDF_BRICK_SIZE;
+        int lk = local / (SDF_BRICK_SIZE * SDF_BRICK_SIZE);
+        codes[local] = std::make_pair(morton_encode3(li, lj, lk), local);
+    }
+    std::sort(codes.begin(), codes.end());
+
+    for (int mi = 0; mi < SDF_BRICK_VOXEL_COUNT; ++mi)
+    {
+        brick_morton_locals[mi] = codes[mi].second;
+    }
+}
+static void grid2_work(void* param, size_t begin, size_t end)
 {
     Grid2Work& work = *(Grid2Work*)param;
     Grid* grid = work.grid;
-    ObjData::Shape& shape = *(work.shape);
+    int node = scheduler_get_numa_node();
+    ObjData::Shape& shape = work.node_shapes != NULL && node < work.node_count ? *(work.node_shapes[node]) : *(work.shape);
 
-    int grid_index = 0;
     int pos_index = 0;
     uint32_t tri_inds[3];
     Vector3 ta, tb, tc;
-    float cur_sdf;
-    int closest_tri_pos_index;
     Vector3 closest_tri_pos;
-    Vector3 closest_tri_normal;
-    Vector3 tcp_to_vc;
     Vector3 voxel_center;
+    int i, j, k;
+
+    // 8 consecutive morton samples are a 2x2x2 cube and go through the bvh as one packet.
+    // Each lane is seeded with the closest face of the same lane in the previous packet.
+    DistancePacket packet;
+    packet.max_distance = work.max_distance;
+    size_t packet_slots[DISTANCE_PACKET_SIZE];
+    int packet_grid_indices[DISTANCE_PACKET_SIZE];
+    for (int li = 0; li < DISTANCE_PACKET_SIZE; ++li)
+    {
+        packet.seed_face_indices[li] = -1;
+    }
 
-    for (int grid_index = work.begin; grid_index < work.end; ++grid_index)
+    for (size_t slot_index = begin * SDF_BRICK_VOXEL_COUNT; slot_index < end * SDF_BRICK_VOXEL_COUNT; slot_index += DISTANCE_PACKET_SIZE)
     {
-        SDFDebug& sd = grid->sdf_debugs[grid_index];
-        voxel_center = work.voxels[grid_index];
+        // the samples of the brick are first written here, by the thread computing them
+        if (slot_index % SDF_BRICK_VOXEL_COUNT == 0)
+            grid_fill_brick_constant(grid, work.brick_slots[slot_index / SDF_BRICK_VOXEL_COUNT]);
+
+        int lane_count = 0;
+        for (int li = 0; li < DISTANCE_PACKET_SIZE; ++li)
+        {
+            size_t si = slot_index + li;
+            size_t slot = (size_t)work.brick_slots[si / SDF_BRICK_VOXEL_COUNT] * SDF_BRICK_VOXEL_COUNT + brick_morton_locals[si % SDF_BRICK_VOXEL_COUNT];
+            if (work.sample_states != NULL && work.sample_states[slot] != VOXEL_STATE_BAND)
+                continue;
+
+            // the bricks on the grid boundary have samples out of the grid
+            grid_get_slot_coordinate(grid, slot, &i, &j, &k);
+            if (i >= grid->nx || j >= grid->ny || k >= grid->nz)
+                continue;
+
+            packet_slots[lane_count] = slot;
+            packet_grid_indices[lane_count] = (int)(((size_t)k * grid->ny + j) * grid->nx + i);
+            packet.x[lane_count] = grid->min_pos[0] + grid->delta * i;
+            packet.y[lane_count] = grid->min_pos[1] + grid->delta * j;
+            packet.z[lane_count] = grid->min_pos[2] + grid->delta * k;
+            ++lane_count;
+        }
 
-        minimum_squared_distance(&shape, voxel_center, &cur_sdf, &closest_tri_pos, &closest_tri_pos_index);
+        if (lane_count == 0)
+            continue;
 
-        pos_index = closest_tri_pos_index * 3;
+        // the unused lanes repeat the first query so they don't widen the traversal
+        for (int li = lane_count; li < DISTANCE_PACKET_SIZE; ++li)
+        {
+            packet.x[li] = packet.x[0];
+            packet.y[li] = packet.y[0];
+            packet.z[li] = packet.z[0];
+        }
 
-        tri_inds[0] = shape.indices[pos_index] * 3;
-        tri_inds[1] = shape.indices[pos_index + 1] * 3;
-        tri_inds[2] = shape.indices[pos_index + 2] * 3;
+        minimum_squared_distance_packet(&shape, &packet);
 
-        ta = vector3_setp(&(shape.positions[tri_inds[0]]));
-        tb = vector3_setp(&(shape.positions[tri_inds[1]]));
-        tc = vector3_setp(&(shape.positions[tri_inds[2]]));
+        for (int li = 0; li < lane_count; ++li)
+        {
+            voxel_center = vector3_set3(packet.x[li], packet.y[li], packet.z[li]);
+            closest_tri_pos = vector3_set3(packet.closest_x[li], packet.closest_y[li], packet.closest_z[li]);
+            int closest_face_index = packet.face_indices[li];
+            if (closest_face_index < 0)
+            {
+                // the winding number gives the sign without a closest feature, like grid_fill_far_field does
+                if (work.sign_method == SIGN_METHOD_WINDING_NUMBER)
+                    grid->brick_sdfs[packet_slots[li]] = winding_number(&shape, voxel_center) >= 0.5f ? -work.max_distance : work.max_distance;
+                else
+                    work.sample_states[packet_slots[li]] = VOXEL_STATE_FAR;
+                continue;
+            }
 
-        closest_tri_normal = vector3_cross(vector3_sub(tb, ta), vector3_sub(tc, ta));
-        tcp_to_vc = vector3_sub(voxel_center, closest_tri_pos);
-        cur_sdf = sqrtf(cur_sdf);
-        if (vector3_dot(closest_tri_normal, tcp_to_vc) > 0.f)
+            grid->brick_sdfs[packet_slots[li]] = signed_distance_from_closest(&shape, voxel_center, packet.squared_distances[li], closest_tri_pos, closest_face_index, (TriangleFeature)packet.features[li], work.sign_method);
+
+            if (grid->sdf_debugs.empty() == false)
+            {
+                pos_index = closest_face_index * 3;
+
+                tri_inds[0] = shape.indices[pos_index] * 3;
+                tri_inds[1] = shape.indices[pos_index + 1] * 3;
+                tri_inds[2] = shape.indices[pos_index + 2] * 3;
+
+                ta = vector3_setp(&(shape.positions[tri_inds[0]]));
+                tb = vector3_setp(&(shape.positions[tri_inds[1]]));
+                tc = vector3_setp(&(shape.positions[tri_inds[2]]));
+
+                SDFDebug& sd = grid->sdf_debugs[packet_grid_indices[li]];
+                sd.is_set = true;
+                sd.tri[0] = ta;
+                sd.tri[1] = tb;
+                sd.tri[2] = tc;
+                sd.closest_tri_pos = closest_tri_pos;
+                sd.closest_tri_normal = vector3_normalize(vector3_cross(vector3_sub(tb, ta), vector3_sub(tc, ta)));
+            }
+        }
+
+        for (int li = 0; li < DISTANCE_PACKET_SIZE; ++li)
         {
-            grid->sdfs[grid_index] = cur_sdf;
+            packet.seed_face_indices[li] = packet.face_indices[li < lane_count ? li : 0];
         }
-        else
+    }
+}
+
+// call f(i, j, k) for every grid point that can be within band_distance from a triangle.
+// The triangle aabb is used instead of the exact distance so the band is conservative.
+template<typename F>
+static void grid_for_each_band_point(Grid* grid, ObjData::Shape& shape, float band_distance, F f)
+{
+    float inv_delta = 1.f / grid->delta;
+    int grid_counts[3] = { grid->nx, grid->ny, grid->nz };
+    int range_min[3];
+    int range_max[3];
+
+    for (size_t ii = 0; ii < shape.indices.size(); ii += 3)
+    {
+        AABB aabb;
+        aabb_set_min_max(&aabb, shape.positions[shape.indices[ii] * 3], shape.positions[shape.indices[ii] * 3 + 1], shape.positions[shape.indices[ii] * 3 + 2]);
+        aabb_combine_float(&aabb, &(shape.positions[shape.indices[ii + 1] * 3]));
+        aabb_combine_float(&aabb, &(shape.positions[shape.indices[ii + 2] * 3]));
+
+        for (int axis = 0; axis < 3; ++axis)
         {
-            grid->sdfs[grid_index] = cur_sdf * -1.f;
+            range_min[axis] = (int)ceilf((aabb.min_p.v[axis] - band_distance - grid->min_pos[axis]) * inv_delta);
+            range_max[axis] = (int)floorf((aabb.max_p.v[axis] + band_distance - grid->min_pos[axis]) * inv_delta);
+
+            if (range_min[axis] < 0) range_min[axis] = 0;
+            if (range_max[axis] > grid_counts[axis] - 1) range_max[axis] = grid_counts[axis] - 1;
         }
 
-        sd.is_set = true;
-        sd.tri[0] = ta;
-        sd.tri[1] = tb;
-        sd.tri[2] = tc;
-        sd.closest_tri_pos = closest_tri_pos;
-        sd.closest_tri_normal = vector3_normalize(closest_tri_normal);
+        f(range_min, range_max);
     }
 }
 
-static inline void grid_init2(Grid* grid, ObjData::Shape& shape, SDFObjData* sod)
+// allocate the bricks touching the band and mark the band samples in them
+static void grid_mark_narrow_band(Grid* grid, ObjData::Shape& shape, float band_distance, std::vector<uint8_t>* out_sample_states)
 {
-    Vector3 min_pos = vector3_setp(shape.min_positions);
-    Vector3 max_pos = vector3_setp(shape.max_positions);
+    grid_for_each_band_point(grid, shape, band_distance, [grid](const int* range_min, const int* range_max)
+    {
+        for (int bk = range_min[2] / SDF_BRICK_SIZE; bk <= range_max[2] / SDF_BRICK_SIZE; ++bk)
+        {
+            for (int bj = range_min[1] / SDF_BRICK_SIZE; bj <= range_max[1] / SDF_BRICK_SIZE; ++bj)
+            {
+                for (int bi = range_min[0] / SDF_BRICK_SIZE; bi <= range_max[0] / SDF_BRICK_SIZE; ++bi)
+                {
+                    grid_assign_brick_slot(grid, (bk * grid->brick_counts[1] + bj) * grid->brick_counts[0] + bi);
+                }
+            }
+        }
+    });
 
-    Vector3 voxel_pad = vector3_set1(sod->grid_delta * sod->grid_padding);
-    min_pos = vector3_sub(min_pos, voxel_pad);
-    max_pos = vector3_add(max_pos, voxel_pad);
+    std::vector<uint8_t>& sample_states = *out_sample_states;
+    sample_states.assign(grid->allocated_bricks.size() * SDF_BRICK_VOXEL_COUNT, VOXEL_STATE_FAR);
 
-    // after setting min/max pos, change it into grid_delta to use it as padding to find another closest triangle
-    voxel_pad = vector3_set1(sod->grid_delta);
+    grid_for_each_band_point(grid, shape, band_distance, [grid, &sample_states](const int* range_min, const int* range_max)
+    {
+        for (int k = range_min[2]; k <= range_max[2]; ++k)
+        {
+            for (int j = range_min[1]; j <= range_max[1]; ++j)
+            {
+                for (int i = range_min[0]; i <= range_max[0]; ++i)
+                {
+                    sample_states[grid_get_sample_slot(grid, i, j, k)] = VOXEL_STATE_BAND;
+                }
+            }
+        }
+    });
+}
 
-    int xm = (int)floorf(min_pos.v[0] / sod->grid_delta);
-    int ym = (int)floorf(min_pos.v[1] / sod->grid_delta);
-    int zm = (int)floorf(min_pos.v[2] / sod->grid_delta);
+struct FarFieldWindingWork
+{
+    Grid* grid;
+    ObjData::Shape* shape;
+    float band_distance;
+    const float* far_distances; // NULL : band_distance
+    const uint8_t* sample_states;
+};
 
-    int xp = (int)ceilf(max_pos.v[0] / sod->grid_delta);
-    int yp = (int)ceilf(max_pos.v[1] / sod->grid_delta);
-    int zp = (int)ceilf(max_pos.v[2] / sod->grid_delta);
+// signs the far samples of the allocated bricks one by one, and each constant brick by the winding number of its center
+static void far_field_winding_work(void* param, size_t begin, size_t end)
+{
+    FarFieldWindingWork& work = *(FarFieldWindingWork*)param;
+    Grid* grid = work.grid;
+    const int* bc = grid->brick_counts;
+    int counts[3] = { grid->nx, grid->ny, grid->nz };
+    int i, j, k;
 
-    grid->min_pos[0] = xm * sod->grid_delta;
-    grid->min_pos[1] = ym * sod->grid_delta;
-    grid->min_pos[2] = zm * sod->grid_delta;
+    for (size_t brick_index = begin; brick_index < end; ++brick_index)
+    {
+        int brick_slot = grid->bricks[brick_index];
+        if (brick_slot < 0)
+        {
+            // the center of the grid points of the brick, the bricks on the boundary are cut by the grid
+            int b[3] = { (int)brick_index % bc[0], ((int)brick_index / bc[0]) % bc[1], (int)brick_index / (bc[0] * bc[1]) };
+            Vector3 center;
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                int lo = b[axis] * SDF_BRICK_SIZE;
+                int hi = lo + SDF_BRICK_SIZE - 1;
+                if (hi > counts[axis] - 1) hi = counts[axis] - 1;
+                center.v[axis] = grid->min_pos[axis] + grid->delta * 0.5f * (float)(lo + hi);
+            }
+            grid->brick_constants[brick_index] = winding_number(work.shape, center) >= 0.5f ? -work.band_distance : work.band_distance;
+            continue;
+        }
 
-    grid->max_pos[0] = xp * sod->grid_delta;
-    grid->max_pos[1] = yp * sod->grid_delta;
-    grid->max_pos[2] = zp * sod->grid_delta;
+        for (size_t slot = (size_t)brick_slot * SDF_BRICK_VOXEL_COUNT; slot < (size_t)(brick_slot + 1) * SDF_BRICK_VOXEL_COUNT; ++slot)
+        {
+            if (work.sample_states[slot] != VOXEL_STATE_FAR)
+                continue;
 
-    grid->dimensions[0] = grid->max_pos[0] - grid->min_pos[0];
-    grid->dimensions[1] = grid->max_pos[1] - grid->min_pos[1];
-    grid->dimensions[2] = grid->max_pos[2] - grid->min_pos[2];
+            grid_get_slot_coordinate(grid, slot, &i, &j, &k);
+            if (i >= grid->nx || j >= grid->ny || k >= grid->nz)
+                continue;
 
-    grid->nx = xp - xm;
-    grid->ny = yp - ym;
-    grid->nz = zp - zm;
+            float magnitude = work.far_distances != NULL ? work.far_distances[((size_t)k * grid->ny + j) * grid->nx + i] : work.band_distance;
+            Vector3 p = vector3_set3(grid->min_pos[0] + grid->delta * i, grid->min_pos[1] + grid->delta * j, grid->min_pos[2] + grid->delta * k);
+            grid->brick_sdfs[slot] = winding_number(work.shape, p) >= 0.5f ? -magnitude : magnitude;
+        }
+    }
+}
 
-    grid->sdfs = std::vector<float>(grid->nx * grid->ny * grid->nz, 10000000.f);
-    grid->sdf_debugs.resize(grid->sdfs.size());
+// fill the grid points outside of the band.
+// Far points are flood-filled as 6-connected components which can't cross the band,
+// so each component takes the majority sign of the band samples around it.
+// A constant brick has no band sample, so it is a single node of the flood fill.
+// With SIGN_METHOD_WINDING_NUMBER a component would leak through the holes of the mesh,
+// so the winding number signs every far sample and constant brick instead.
+// The magnitude is band_distance (band samples are clamped to it as well),
+// or the unsigned distance in far_distances[(k * ny + j) * nx + i] if it is given.
+static void grid_fill_far_field(Grid* grid, ObjData::Shape& shape, SignMethod sign_method, int thread_count, float band_distance, const float* far_distances, std::vector<uint8_t>* sample_states)
+{
+    std::vector<uint8_t>& states = *sample_states;
+    std::vector<float, DefaultInitAllocator<float>>& sdfs = grid->brick_sdfs;
 
-    Vector3 voxel_center;
-    int grid_index = 0;
-    /*
-    int pos_index = 0;
-    uint32_t tri_inds[3];
-    Vector3 ta, tb, tc;
-    Vector3 tcp;
-    float dist;
-    float cur_sdf;
-    int closest_tri_pos_index;
-    Vector3 closest_tri_pos;
-    Vector3 closest_tri_normal;
-    Vector3 tcp_to_vc;
-    */
+    if (far_distances == NULL)
+    {
+        for (size_t slot = 0; slot < sdfs.size(); ++slot)
+        {
+            if (states[slot] != VOXEL_STATE_BAND)
+                continue;
 
-    std::vector<Vector3> voxels;
-    voxels.resize(grid->sdfs.size());
+            if (sdfs[slot] > band_distance)
+                sdfs[slot] = band_distance;
+            else if (sdfs[slot] < -band_distance)
+                sdfs[slot] = -band_distance;
+        }
+    }
 
-    for (int k = 0; k < grid->nz; ++k)
+    if (sign_method == SIGN_METHOD_WINDING_NUMBER)
     {
-        voxel_center.v[2] = grid->min_pos[2] + sod->grid_delta * k;
+        FarFieldWindingWork work = { grid, &shape, band_distance, far_distances, states.data() };
+        parallel_for(0, grid->bricks.size(), 1, thread_count, far_field_winding_work, &work);
+        return;
+    }
 
-        for (int j = 0; j < grid->ny; ++j)
-        {
-            voxel_center.v[1] = grid->min_pos[1] + sod->grid_delta * j;
+    const int nx = grid->nx;
+    const int ny = grid->ny;
+    const int nz = grid->nz;
+    const int* bc = grid->brick_counts;
 
-            for (int i = 0; i < grid->nx; ++i)
-            {
-                voxel_center.v[0] = grid->min_pos[0] + sod->grid_delta * i;
+    std::vector<uint8_t> brick_visited(grid->bricks.size(), 0);
 
-                grid_index = (k * grid->ny + j) * grid->nx + i;
-                voxels[grid_index] = voxel_center;
+    // component items : sample slot >= 0, constant brick b as -(b + 1)
+    std::vector<int64_t> component;
+    int positive_votes;
+    int negative_votes;
 
-                /*
-                SDFDebug& sd = grid->sdf_debugs[grid_index];
+    // visit a grid point reached from a neighbor
+    auto visit_point = [&](int i, int j, int k)
+    {
+        int brick_index = grid_get_brick_index(grid, i, j, k);
+        if (grid->bricks[brick_index] < 0)
+        {
+            if (brick_visited[brick_index] == 0)
+            {
+                brick_visited[brick_index] = 1;
+                component.push_back(-(int64_t)brick_index - 1);
+            }
+            return;
+        }
 
-                minimum_squared_distance(&shape, voxel_center, &cur_sdf, &closest_tri_pos, &closest_tri_pos_index);
+        size_t slot = grid_get_sample_slot(grid, i, j, k);
+        if (states[slot] == VOXEL_STATE_FAR)
+        {
+            states[slot] = VOXEL_STATE_FAR_VISITED;
+            component.push_back((int64_t)slot);
+        }
+        else if (states[slot] == VOXEL_STATE_BAND)
+        {
+            if (sdfs[slot] > 0.f)
+                ++positive_votes;
+            else
+                ++negative_votes;
+        }
+    };
 
-                pos_index = closest_tri_pos_index * 3;
+    auto flood_fill = [&]()
+    {
+        int i, j, k;
+        for (size_t ci = 0; ci < component.size(); ++ci)
+        {
+            int64_t item = component[ci];
+            if (item >= 0)
+            {
+                grid_get_slot_coordinate(grid, (size_t)item, &i, &j, &k);
+
+                if (i > 0) visit_point(i - 1, j, k);
+                if (i < nx - 1) visit_point(i + 1, j, k);
+                if (j > 0) visit_point(i, j - 1, k);
+                if (j < ny - 1) visit_point(i, j + 1, k);
+                if (k > 0) visit_point(i, j, k - 1);
+                if (k < nz - 1) visit_point(i, j, k + 1);
+                continue;
+            }
 
-                tri_inds[0] = shape.indices[pos_index] * 3;
-                tri_inds[1] = shape.indices[pos_index + 1] * 3;
-                tri_inds[2] = shape.indices[pos_index + 2] * 3;
+            // every grid point just outside of the faces of the constant brick
+            int brick_index = (int)(-item - 1);
+            int b[3] =
+            {
+                brick_index % bc[0],
+                (brick_index / bc[0]) % bc[1],
+                brick_index / (bc[0] * bc[1])
+            };
+            int counts[3] = { nx, ny, nz };
+            int lo[3];
+            int hi[3];
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                lo[axis] = b[axis] * SDF_BRICK_SIZE;
+                hi[axis] = lo[axis] + SDF_BRICK_SIZE - 1;
+                if (hi[axis] > counts[axis] - 1) hi[axis] = counts[axis] - 1;
+            }
 
-                ta = vector3_setp(&(shape.positions[tri_inds[0]]));
-                tb = vector3_setp(&(shape.positions[tri_inds[1]]));
-                tc = vector3_setp(&(shape.positions[tri_inds[2]]));
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                int u = (axis + 1) % 3;
+                int v = (axis + 2) % 3;
+                int outside[2] = { lo[axis] - 1, hi[axis] + 1 };
 
-                closest_tri_normal = vector3_cross(vector3_sub(tb, ta), vector3_sub(tc, ta));
-                tcp_to_vc = vector3_sub(voxel_center, closest_tri_pos);
-                cur_sdf = sqrtf(cur_sdf);
-                if (vector3_dot(closest_tri_normal, tcp_to_vc) > 0.f)
+                for (int side = 0; side < 2; ++side)
                 {
-                    grid->sdfs[grid_index] = cur_sdf;
+                    if (outside[side] < 0 || outside[side] > counts[axis] - 1)
+                        continue;
+
+                    int p[3];
+                    p[axis] = outside[side];
+                    for (p[v] = lo[v]; p[v] <= hi[v]; ++p[v])
+                    {
+                        for (p[u] = lo[u]; p[u] <= hi[u]; ++p[u])
+                        {
+                            visit_point(p[0], p[1], p[2]);
+                        }
+                    }
                 }
-                else
+            }
+        }
+
+        float far_sign = positive_votes >= negative_votes ? 1.f : -1.f;
+        for (int64_t item : component)
+        {
+            if (item >= 0)
+            {
+                float magnitude = band_distance;
+                if (far_distances != NULL)
                 {
-                    grid->sdfs[grid_index] = cur_sdf * -1.f;
+                    grid_get_slot_coordinate(grid, (size_t)item, &i, &j, &k);
+                    magnitude = far_distances[((size_t)k * ny + j) * nx + i];
                 }
-
-                sd.is_set = true;
-                sd.tri[0] = ta;
-                sd.tri[1] = tb;
-                sd.tri[2] = tc;
-                sd.closest_tri_pos = closest_tri_pos;
-                sd.closest_tri_normal = vector3_normalize(closest_tri_normal);
-                */
+                sdfs[(size_t)item] = far_sign * magnitude;
+            }
+            else
+            {
+                grid->brick_constants[(size_t)(-item - 1)] = far_sign * band_distance;
             }
         }
+    };
+
+    for (int brick_index = 0; brick_index < (int)grid->bricks.size(); ++brick_index)
+    {
+        if (grid->bricks[brick_index] >= 0 || brick_visited[brick_index] != 0)
+            continue;
+
+        positive_votes = 0;
+        negative_votes = 0;
+        component.clear();
+        brick_visited[brick_index] = 1;
+        component.push_back(-(int64_t)brick_index - 1);
+        flood_fill();
     }
 
-    ThreadPool tp;
-    int tc = (int)tp.GetThreadCount();
-    int total_task_count = (int)grid->sdfs.size();
-    int each_task_count = total_task_count / tc;
-    
-    std::vector<Grid2Work> works(total_task_count);
-    for (int i = 0; i < tc; ++i)
-    {
-        Grid2Work& work = works[i];
-        work.begin = each_task_count * i;
-        work.end = each_task_count * (i + 1);
-        if (work.end > total_task_count)
-            work.end = total_task_count;
-        work.grid = grid;
-        work.shape = &shape;
-        work.voxels = voxels.data();
-
-        tp.EnqueueJob(grid2_work, &work);
+    int i, j, k;
+    for (size_t slot = 0; slot < states.size(); ++slot)
+    {
+        if (states[slot] != VOXEL_STATE_FAR)
+            continue;
+
+        grid_get_slot_coordinate(grid, slot, &i, &j, &k);
+        if (i >= nx || j >= ny || k >= nz)
+            continue;
+
+        positive_votes = 0;
+        negative_votes = 0;
+        component.clear();
+        states[slot] = VOXEL_STATE_FAR_VISITED;
+        component.push_back((int64_t)slot);
+        flood_fill();
     }
+}
+
+struct ShapeReplicaWork
+{
+    const ObjData::Shape* source;
+    ObjData::Shape* replica;
+};
 
-    tp.Join(tp.SHUTDOWN_GRACEFULLY);
+// on a thread of the node of the replica, so its arrays are allocated and first written there
+static void shape_replica_work(void* param)
+{
+    ShapeReplicaWork& work = *(ShapeReplicaWork*)param;
+    *(work.replica) = *(work.source);
 }
 
+static inline void grid_init2(Grid* grid, ObjData::Shape& shape, SDFObjData* sod)
+{
+    grid_init_dimensions(grid, shape, sod);
+
+    // a shape without faces (only lines or points) has nothing to bake, every sample is outside.
+    // The grid diagonal stands in for the distance, so the far value stays finite for the interpolation.
+    if (shape.indices.empty())
+    {
+        float far_distance = sod->config.narrow_band > 0 && sod->config.far_field == SDF_FAR_FIELD_CLAMP ? sod->grid_delta * sod->config.narrow_band : vector3_length(vector3_setp(grid->dimensions));
+        grid_init_bricks(grid, far_distance);
+        return;
+    }
+
+    // with a narrow band, only the bricks close to the surface are allocated
+    // and only the samples close to the surface get the exact distance.
+    std::vector<uint8_t> sample_states;
+    float band_distance = sod->grid_delta * sod->config.narrow_band;
+    grid_init_bricks(grid, band_distance);
+    if (sod->config.narrow_band > 0)
+    {
+        if (sod->config.far_field == SDF_FAR_FIELD_FAST_SWEEPING)
+        {
+            grid_assign_all_brick_slots(grid);
+        }
+        grid_mark_narrow_band(grid, shape, band_distance, &sample_states);
+    }
+    else
+    {
+        grid_assign_all_brick_slots(grid);
+    }
+    // grid2_work fills every brick
+    grid_resize_brick_samples(grid);
+
+    // the queries of a worker read the copy of the shape made on its NUMA node.
+    // Node 0 gets a copy too, the shape was loaded by whichever thread ran its task.
+    std::vector<ObjData::Shape> replicas;
+    std::vector<ObjData::Shape*> node_shapes;
+    int node_count = topology_get_node_count();
+    if (sod->config.numa_replicate && node_count > 1)
+    {
+        replicas.resize(node_count);
+        for (int node = 0; node < node_count; ++node)
+        {
+            ShapeReplicaWork replica_work = { &shape, &(replicas[node]) };
+            topology_run_on_node(node, shape_replica_work, &replica_work);
+            node_shapes.push_back(&(replicas[node]));
+        }
+    }
+
+    // each thread gets a run of bricks along the morton curve, which keeps its samples and
+    // the bvh nodes they touch close together.
+    std::call_once(brick_morton_locals_flag, init_brick_morton_locals);
+    std::vector<std::pair<uint64_t, int>> brick_codes(grid->allocated_bricks.size());
+    for (size_t slot = 0; slot < grid->allocated_bricks.size(); ++slot)
+    {
+        int brick_index = grid->allocated_bricks[slot];
+        int bi = brick_index % grid->brick_counts[0];
+        int bj = (brick_index / grid->brick_counts[0]) % grid->brick_counts[1];
+        int bk = brick_index / (grid->brick_counts[0] * grid->brick_counts[1]);
+        brick_codes[slot] = std::make_pair(morton_encode3(bi, bj, bk), (int)slot);
+    }
+    std::sort(brick_codes.begin(), brick_codes.end());
+
+    std::vector<int> brick_slots(brick_codes.size());
+    for (size_t bi = 0; bi < brick_codes.size(); ++bi)
+    {
+        brick_slots[bi] = brick_codes[bi].second;
+    }
+
+    // the threads take runs of bricks as they go, a dense surface region doesn't hold back the others
+    Grid2Work work;
+    work.grid = grid;
+    work.shape = &shape;
+    work.sample_states = sod->config.narrow_band > 0 ? sample_states.data() : NULL;
+    work.max_distance = sod->config.narrow_band > 0 && sod->config.far_field == SDF_FAR_FIELD_CLAMP ? band_distance : FLT_MAX;
+    work.sign_method = sod->config.sign_method;
+    work.brick_slots = brick_slots.data();
+    work.node_shapes = node_shapes.empty() ? NULL : node_shapes.data();
+    work.node_count = (int)node_shapes.size();
+    parallel_for(0, brick_slots.size(), 1, sod->config.thread_count, grid2_work, &work);
+
+    if (sod->config.narrow_band > 0)
+    {
+        if (sod->config.far_field == SDF_FAR_FIELD_FAST_SWEEPING)
+        {
+            // propagate the exact band distances to the rest of the grid.
+            // Every brick is allocated in this mode, the solver runs on a dense copy.
+            size_t voxel_count = grid_get_voxel_count(grid);
+            std::vector<float> far_distances(voxel_count, FAST_SWEEPING_FAR_DISTANCE);
+            std::vector<uint8_t> frozen(voxel_count, 0);
+            for (int k = 0; k < grid->nz; ++k)
+            {
+                for (int j = 0; j < grid->ny; ++j)
+                {
+                    for (int i = 0; i < grid->nx; ++i)
+                    {
+                        size_t slot = grid_get_sample_slot(grid, i, j, k);
+                        if (sample_states[slot] != VOXEL_STATE_BAND)
+                            continue;
+
+                        size_t grid_index = ((size_t)k * grid->ny + j) * grid->nx + i;
+                        far_distances[grid_index] = fabsf(grid->brick_sdfs[slot]);
+                        frozen[grid_index] = 1;
+                    }
+                }
+            }
+
+            fast_sweeping_solve(far_distances.data(), frozen.data(), grid->nx, grid->ny, grid->nz, sod->grid_delta, sod->config.thread_count);
+            grid_fill_far_field(grid, shape, sod->config.sign_method, sod->config.thread_count, band_distance, far_distances.data(), &sample_states);
+        }
+        else
+        {
+            grid_fill_far_field(grid, shape, sod->config.sign_method, sod->config.thread_count, band_distance, NULL, &sample_states);
+        }
+    }
+}
+
+struct SDFLoadPipeline
+{
+    ObjLoadConfig load_config;
+    FILE* output; // NULL without SDFBakeConfig::output_path
+};
+
 struct GridWork
 {
     SDFObjData* sod;
     ObjData::Shape* shape;
     Grid* grid;
+    ADF* adf; // NULL unless SDF_OUTPUT_ADF
+    SDFLoadPipeline* pipeline;
+    size_t shape_index;
 };
 
+static void adf_init(ADF* adf, Grid* grid, ObjData::Shape& shape, SDFObjData* sod)
+{
+    // the adf covers the same padded bounds as the grid would
+    grid_init_dimensions(grid, shape, sod);
+    adf_build(adf, &shape, grid->min_pos, grid->max_pos, sod->grid_delta, sod->config.adf_tolerance, sod->config.sign_method, sod->config.thread_count);
+
+    if (sod->config.adf_resample_grid)
+    {
+        adf_to_grid(adf, sod->grid_delta, grid);
+    }
+    else
+    {
+        grid->sdf_debugs.clear();
+        grid_init_bricks(grid, 0.f);
+    }
+}
+
 void grid_task(void* param)
 {
     GridWork& work = *((GridWork*)param);
+    if (work.adf != NULL)
+    {
+        adf_init(work.adf, work.grid, *(work.shape), work.sod);
+        return;
+    }
+
     // grid_init(work.grid, *(work.shape), work.sod);
     grid_init2(work.grid, *(work.shape), work.sod);
 }
 
 SDFObjData* sdf_obj_load(const char* path, float model_scale, float grid_delta)
+{
+    SDFBakeConfig config;
+    config.model_scale = model_scale;
+    config.grid_delta = grid_delta;
+
+    return sdf_obj_load(path, config);
+}
+
+static void shape_init_task(void* param)
+{
+    GridWork& work = *((GridWork*)param);
+    shape_init(work.shape, work.pipeline->load_config);
+}
+
+static bool sdf_obj_write_header(const SDFObjData* sod, FILE* fp);
+static bool sdf_obj_write_shape(const SDFObjData* sod, FILE* fp, size_t shape_index);
+
+static void grid_output_task(void* param)
+{
+    GridWork& work = *((GridWork*)param);
+    if (work.sod->output_saved)
+    {
+        work.sod->output_saved = sdf_obj_write_shape(work.sod, work.pipeline->output, work.shape_index);
+    }
+}
+
+// the load is a task graph : the parse, then for every shape the bvh build, the bake and the output.
+// A shape is baked as soon as its bvh is built and written as soon as it and the shapes before it are baked,
+// so the shapes overlap instead of waiting for every bvh and every bake.
+SDFObjData* sdf_obj_load(const char* path, const SDFBakeConfig& config)
 {
 	SDFObjData* sod = new SDFObjData();
-	sod->data = obj_load(path, model_scale);
+    sod->config = config;
+    SDFLoadPipeline pipeline;
+    ObjLoadConfig& load_config = pipeline.load_config;
+    load_config.model_scale = config.model_scale;
+    load_config.bvh_builder = config.bvh_builder;
+    load_config.bvh_rotations = config.bvh_rotations;
+    load_config.thread_count = config.thread_count;
+    load_config.bvh_quantize = config.bvh_quantize;
+    load_config.bvh_leaf_size = config.bvh_leaf_size;
+    load_config.triangle_table = config.triangle_table;
+	sod->data = obj_parse(path, load_config);
 	
     sod->render_mesh_by_marching_cubes = true;
 	sod->render_bounds = false;
@@ -373,40 +866,78 @@ SDFObjData* sdf_obj_load(const char* path, float model_scale, float grid_delta)
 	sod->render_bvh = false;
     sod->render_sdf_debug_info = false;
     sod->render_sdf_debug_triangle_normal = true;
-	sod->grid_delta = grid_delta;
-	sod->grid_padding = 1;
+	sod->grid_delta = config.grid_delta;
+	sod->grid_padding = config.grid_padding;
     sod->iso_value = 0.f;
     
     size_t shape_count = sod->data->shapes.size();
     sod->grids.resize(shape_count);
+    if (config.output == SDF_OUTPUT_ADF)
+    {
+        sod->adfs.resize(shape_count);
+    }
+
+    pipeline.output = NULL;
+    sod->output_saved = false;
+    if (config.output_path != NULL)
+    {
+        pipeline.output = open_file(config.output_path, "wb");
+        if (pipeline.output == NULL)
+        {
+            printf("Fail to open %s for writing\n", config.output_path);
+        }
+        else
+        {
+            sod->output_saved = sdf_obj_write_header(sod, pipeline.output);
+        }
+    }
     
     std::vector<GridWork> works;
     works.resize(shape_count);
-    
-    size_t work_index = 0;
-    ThreadPool tp;
-
-    clock_t time_measure = clock();
 
+    TaskGraph graph;
+    int previous_output = -1;
     for (size_t si = 0; si < shape_count; ++si)
     {
-        ObjData::Shape& shape = sod->data->shapes[si];
-
-        GridWork& work = works[work_index];
-        ++work_index;
-
+        GridWork& work = works[si];
         work.grid = &(sod->grids[si]);
-        work.shape = &shape;
+        work.shape = &(sod->data->shapes[si]);
         work.sod = sod;
+        work.adf = sod->adfs.empty() ? NULL : &(sod->adfs[si]);
+        work.pipeline = &pipeline;
+        work.shape_index = si;
 
-        tp.EnqueueJob(grid_task, &work);
+        int init = task_graph_add(&graph, shape_init_task, &work);
+        int bake = task_graph_add(&graph, grid_task, &work);
+        task_graph_add_dependency(&graph, init, bake);
+
+        if (pipeline.output != NULL)
+        {
+            // the shapes are written in order
+            int output = task_graph_add(&graph, grid_output_task, &work);
+            task_graph_add_dependency(&graph, bake, output);
+            if (previous_output >= 0)
+                task_graph_add_dependency(&graph, previous_output, output);
+            previous_output = output;
+        }
     }
-    
-    tp.Join(ThreadPool::SHUTDOWN_GRACEFULLY);
+
+    clock_t time_measure = clock();
+
+    task_graph_run(&graph, config.thread_count);
 
     time_measure = clock() - time_measure;
 
-    printf("%f seconds for calculating sdf values of %llu shapes\n", (float)time_measure / CLOCKS_PER_SEC, shape_count);
+    printf("%f seconds for building the bvhs and calculating sdf values of %llu shapes\n", (float)time_measure / CLOCKS_PER_SEC, (unsigned long long)shape_count);
+
+    if (pipeline.output != NULL)
+    {
+        fclose(pipeline.output);
+        if (sod->output_saved == false)
+        {
+            printf("Fail to write %s\n", config.output_path);
+        }
+    }
 
 	return sod;
 }
@@ -415,4 +946,83 @@ void sdf_obj_unload(SDFObjData* od)
 {
 	obj_unload(od->data);
 	delete od;
-}
\ No newline at end of file
+}
+
+static bool sdf_obj_write_header(const SDFObjData* sod, FILE* fp)
+{
+    const char grid_magic[4] = { 'S', 'D', 'F', 'G' };
+    const char adf_magic[4] = { 'S', 'D', 'F', 'A' };
+    bool is_adf = sod->config.output == SDF_OUTPUT_ADF;
+    uint32_t version = is_adf ? 1 : 2;
+    uint32_t shape_count = is_adf ? (uint32_t)sod->adfs.size() : (uint32_t)sod->grids.size();
+
+    bool ok = true;
+    ok = ok && fwrite(is_adf ? adf_magic : grid_magic, 1, 4, fp) == 4;
+    ok = ok && fwrite(&version, sizeof(version), 1, fp) == 1;
+    ok = ok && fwrite(&shape_count, sizeof(shape_count), 1, fp) == 1;
+
+    return ok;
+}
+
+static bool sdf_obj_write_shape(const SDFObjData* sod, FILE* fp, size_t shape_index)
+{
+    bool ok = true;
+    if (sod->config.output == SDF_OUTPUT_ADF)
+    {
+        const ADF& adf = sod->adfs[shape_index];
+        int32_t max_depth = adf.max_depth;
+        uint32_t node_count = (uint32_t)adf.nodes.size();
+
+        ok = ok && fwrite(adf.min_pos, sizeof(float), 3, fp) == 3;
+        ok = ok && fwrite(adf.max_pos, sizeof(float), 3, fp) == 3;
+        ok = ok && fwrite(&(adf.size), sizeof(float), 1, fp) == 1;
+        ok = ok && fwrite(&(adf.tolerance), sizeof(float), 1, fp) == 1;
+        ok = ok && fwrite(&max_depth, sizeof(int32_t), 1, fp) == 1;
+        ok = ok && fwrite(&node_count, sizeof(uint32_t), 1, fp) == 1;
+        ok = ok && fwrite(adf.nodes.data(), sizeof(ADFNode), adf.nodes.size(), fp) == adf.nodes.size();
+        return ok;
+    }
+
+    const Grid& grid = sod->grids[shape_index];
+    int32_t dims[3] = { grid.nx, grid.ny, grid.nz };
+    int32_t brick_size = SDF_BRICK_SIZE;
+    uint32_t allocated_count = (uint32_t)grid.allocated_bricks.size();
+
+    ok = ok && fwrite(dims, sizeof(int32_t), 3, fp) == 3;
+    ok = ok && fwrite(grid.min_pos, sizeof(float), 3, fp) == 3;
+    ok = ok && fwrite(&(grid.delta), sizeof(float), 1, fp) == 1;
+    ok = ok && fwrite(&brick_size, sizeof(int32_t), 1, fp) == 1;
+    ok = ok && fwrite(grid.brick_counts, sizeof(int32_t), 3, fp) == 3;
+    ok = ok && fwrite(grid.bricks.data(), sizeof(int32_t), grid.bricks.size(), fp) == grid.bricks.size();
+    ok = ok && fwrite(grid.brick_constants.data(), sizeof(float), grid.brick_constants.size(), fp) == grid.brick_constants.size();
+    ok = ok && fwrite(&allocated_count, sizeof(uint32_t), 1, fp) == 1;
+    ok = ok && fwrite(grid.brick_sdfs.data(), sizeof(float), grid.brick_sdfs.size(), fp) == grid.brick_sdfs.size();
+
+    return ok;
+}
+
+bool sdf_obj_save(const SDFObjData* sod, const char* path)
+{
+    FILE* fp = open_file(path, "wb");
+    if (fp == NULL)
+    {
+        printf("Fail to open %s for writing\n", path);
+        return false;
+    }
+
+    bool ok = sdf_obj_write_header(sod, fp);
+    size_t shape_count = sod->config.output == SDF_OUTPUT_ADF ? sod->adfs.size() : sod->grids.size();
+    for (size_t si = 0; si < shape_count && ok; ++si)
+    {
+        ok = sdf_obj_write_shape(sod, fp, si);
+    }
+
+    fclose(fp);
+
+    if (ok == false)
+    {
+        printf("Fail to write %s\n", path);
+    }
+
+    return ok;
+}
@@ -3,30 +3,62 @@
 
 #include <vector>
 #include "vector.h"
+#include "sdf_grid.h"
+#include "adf.h"
+#include "obj.h"
 
 struct ObjData;
 
-struct SDFDebug
+enum SDFFarField
 {
-    bool is_set;
-    Vector3 tri[3];
-    Vector3 closest_tri_pos;
-    Vector3 closest_tri_normal;
+    SDF_FAR_FIELD_CLAMP = 0, // sign * (narrow_band * grid_delta)
+    SDF_FAR_FIELD_FAST_SWEEPING // eikonal distances propagated from the band
 };
 
-struct Grid
+enum SDFOutput
 {
-	int nx, ny, nz;
-    float min_pos[3];
-    float max_pos[3];
-    float dimensions[3];
-    std::vector<float> sdfs;
-    std::vector<SDFDebug> sdf_debugs;
+    SDF_OUTPUT_GRID = 0, // uniform brick grid
+    SDF_OUTPUT_ADF // adaptive octree, cells split until the trilinear error is below adf_tolerance
+};
+
+struct SDFBakeConfig
+{
+    float model_scale = 1.f;
+    float grid_delta = 0.05f;
+    int grid_padding = 1;
+    int thread_count = 0; // 0 : std::thread::hardware_concurrency()
+
+    // > 0 : only the voxels within narrow_band cells from the surface get the exact distance.
+    // The others are filled according to far_field.
+    int narrow_band = 0;
+    SDFFarField far_field = SDF_FAR_FIELD_CLAMP;
+    // SIGN_METHOD_WINDING_NUMBER for meshes with holes
+    SignMethod sign_method = SIGN_METHOD_PSEUDONORMAL;
+    BVHBuilder bvh_builder = BVH_BUILDER_MEDIAN;
+    bool bvh_rotations = false;
+    bool bvh_quantize = false; // 8 bit child bounds, for meshes too big for the memory
+    int bvh_leaf_size = BVH_LEAF_DEFAULT_FACES; // faces per bvh leaf, 1 to BVH_LEAF_MAX_FACES
+    bool triangle_table = false; // precomputed triangle data for the closest point queries
+    // a copy of the shape for every NUMA node, read by the workers of that node.
+    // Only useful with pinned workers, see scheduler_configure.
+    bool numa_replicate = false;
+
+    SDFOutput output = SDF_OUTPUT_GRID;
+    float adf_tolerance = 0.001f; // absolute distance error, the finest adf cell is grid_delta
+    bool adf_resample_grid = true; // fill grids from the adf for the marching cubes rendering
+
+    // keep the closest triangle of every grid point for the debug rendering
+    bool store_debug_info = false;
+
+    // written by sdf_obj_load like sdf_obj_save, every shape as soon as it and the shapes before it are baked
+    const char* output_path = NULL;
 };
 
 struct SDFObjData
 {
 	ObjData* data;
+    SDFBakeConfig config;
+
     bool render_mesh_by_marching_cubes;
 	bool render_bounds;
 	bool render_grid_points;
@@ -40,9 +72,26 @@ struct SDFObjData
 
 	// grids[shapes]
 	std::vector<Grid> grids;
+    // adfs[shapes], only with SDF_OUTPUT_ADF
+    std::vector<ADF> adfs;
+
+    bool output_saved; // config.output_path is complete
 };
 
 SDFObjData* sdf_obj_load(const char* path, float model_scale, float grid_delta);
+SDFObjData* sdf_obj_load(const char* path, const SDFBakeConfig& config);
 void sdf_obj_unload(SDFObjData* od);
 
+// binary layout (little-endian), the arrays are the ones of Grid
+// header : char magic[4] = "SDFG", uint32 version = 2, uint32 shape_count
+// shape  : int32 nx, ny, nz, float min_pos[3], float grid_delta,
+//          int32 brick_size, int32 brick_counts[3], int32 bricks[brick_count], float brick_constants[brick_count],
+//          uint32 allocated_brick_count, float brick_sdfs[allocated_brick_count * brick_size^3]
+//
+// with SDF_OUTPUT_ADF the adfs are written instead
+// header : char magic[4] = "SDFA", uint32 version = 1, uint32 shape_count
+// shape  : float min_pos[3], float max_pos[3], float size, float tolerance, int32 max_depth,
+//          uint32 node_count, ADFNode nodes[node_count] (float corners[8], int32 children), nodes[0] is the root
+bool sdf_obj_save(const SDFObjData* sod, const char* path);
+
 #endif
\ No newline at end of file
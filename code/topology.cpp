@@ -0,0 +1,173 @@
+#include "topology.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <mutex>
+
+#if _WIN32 || _WIN64
+#include <Windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#if defined(__linux__)
+// "0-3,8-11\n", the format of the cpu and node lists
+static void topology_parse_cpu_list(const char* text, std::vector<int>* out_cpus)
+{
+    const char* p = text;
+    while (*p != '\0' && *p != '\n')
+    {
+        char* end;
+        long first = strtol(p, &end, 10);
+        if (end == p)
+            break;
+
+        long last = first;
+        p = end;
+        if (*p == '-')
+        {
+            last = strtol(p + 1, &end, 10);
+            p = end;
+        }
+
+        for (long cpu = first; cpu <= last; ++cpu)
+        {
+            out_cpus->push_back((int)cpu);
+        }
+
+        if (*p == ',')
+            ++p;
+    }
+}
+#endif
+
+static void topology_init(CPUTopology* topology)
+{
+#if _WIN32 || _WIN64
+    ULONG highest_node = 0;
+    if (GetNumaHighestNodeNumber(&highest_node))
+    {
+        for (ULONG node = 0; node <= highest_node; ++node)
+        {
+            ULONGLONG mask = 0;
+            if (GetNumaNodeProcessorMask((UCHAR)node, &mask) == FALSE || mask == 0)
+                continue;
+
+            std::vector<int> cpus;
+            for (int cpu = 0; cpu < 64; ++cpu)
+            {
+                if (mask & (1ull << cpu))
+                    cpus.push_back(cpu);
+            }
+            topology->node_cpus.push_back(cpus);
+        }
+    }
+#elif defined(__linux__)
+    char text[4096];
+    std::vector<int> nodes;
+    FILE* fp = fopen("/sys/devices/system/node/online", "r");
+    if (fp != NULL)
+    {
+        if (fgets(text, sizeof(text), fp) != NULL)
+            topology_parse_cpu_list(text, &nodes);
+        fclose(fp);
+    }
+
+    for (int node : nodes)
+    {
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        fp = fopen(path, "r");
+        if (fp == NULL)
+            continue;
+
+        std::vector<int> cpus;
+        if (fgets(text, sizeof(text), fp) != NULL)
+            topology_parse_cpu_list(text, &cpus);
+        fclose(fp);
+
+        // nodes with memory only
+        if (cpus.empty() == false)
+            topology->node_cpus.push_back(cpus);
+    }
+#endif
+
+    if (topology->node_cpus.empty())
+    {
+        int cpu_count = (int)std::thread::hardware_concurrency();
+        if (cpu_count <= 0)
+            cpu_count = 1;
+
+        topology->node_cpus.resize(1);
+        for (int cpu = 0; cpu < cpu_count; ++cpu)
+        {
+            topology->node_cpus[0].push_back(cpu);
+        }
+    }
+}
+
+const CPUTopology* topology_get()
+{
+    static CPUTopology topology;
+    static std::once_flag flag;
+    std::call_once(flag, topology_init, &topology);
+
+    return &topology;
+}
+
+int topology_get_node_count()
+{
+    return (int)topology_get()->node_cpus.size();
+}
+
+static bool topology_pin_current_thread_to_cpus(const std::vector<int>& cpus)
+{
+#if _WIN32 || _WIN64
+    DWORD_PTR mask = 0;
+    for (int cpu : cpus)
+    {
+        if (cpu < (int)(sizeof(DWORD_PTR) * 8))
+            mask |= (DWORD_PTR)1 << cpu;
+    }
+    return mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus)
+    {
+        if (cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpus;
+    return false;
+#endif
+}
+
+bool topology_pin_current_thread(int cpu)
+{
+    std::vector<int> cpus(1, cpu);
+    return topology_pin_current_thread_to_cpus(cpus);
+}
+
+bool topology_pin_current_thread_to_node(int node)
+{
+    const CPUTopology* topology = topology_get();
+    if (node < 0 || node >= (int)topology->node_cpus.size())
+        return false;
+
+    return topology_pin_current_thread_to_cpus(topology->node_cpus[node]);
+}
+
+void topology_run_on_node(int node, void(*function)(void*), void* argument)
+{
+    std::thread t([node, function, argument]
+    {
+        topology_pin_current_thread_to_node(node);
+        function(argument);
+    });
+    t.join();
+}
@@ -0,0 +1,25 @@
+#ifndef __TOPOLOGY_H__
+#define __TOPOLOGY_H__
+
+#include <vector>
+
+// the NUMA nodes of the machine and the logical cpus of each of them.
+// A machine without NUMA information is a single node with every hardware thread.
+struct CPUTopology
+{
+    std::vector<std::vector<int>> node_cpus;
+};
+
+// read once, on the first call
+const CPUTopology* topology_get();
+int topology_get_node_count();
+
+// pins the calling thread to the cpu, or to every cpu of the node. Returns false where it isn't supported.
+bool topology_pin_current_thread(int cpu);
+bool topology_pin_current_thread_to_node(int node);
+
+// runs function(argument) on a new thread pinned to the node and waits for it.
+// Memory first written there lands on that node, which is how the per node copies are made.
+void topology_run_on_node(int node, void(*function)(void*), void* argument);
+
+#endif
@@ -0,0 +1,308 @@
+// brute force checks of the queries of bvh_traverse.h and of minimum_squared_distance, over a few generated
+// meshes with every bvh builder. Prints the first mismatches and returns non zero if there is any.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include <float.h>
+#include <vector>
+#include <algorithm>
+
+#include "obj.h"
+#include "bvh_traverse.h"
+
+#define TEST_QUERY_COUNT 200
+#define TEST_MAX_ERROR_COUNT 10
+
+static uint32_t test_random_state = 1;
+static int test_error_count = 0;
+
+// [0, 1), the same sequence on every platform
+static float test_random()
+{
+    test_random_state = test_random_state * 1664525u + 1013904223u;
+    return (float)(test_random_state >> 8) / (float)(1 << 24);
+}
+
+static void test_fail(const char* mesh_name, const char* config_name, const char* query_name, int query_index)
+{
+    if (test_error_count < TEST_MAX_ERROR_COUNT)
+        printf("FAIL %s %s : %s query %d\n", mesh_name, config_name, query_name, query_index);
+    ++test_error_count;
+}
+
+static bool test_near(float a, float b)
+{
+    return fabsf(a - b) <= 1e-5f * fmaxf(1.f, fmaxf(fabsf(a), fabsf(b)));
+}
+
+static void shape_add_vertex(ObjData::Shape* shape, float x, float y, float z)
+{
+    shape->positions.push_back(x);
+    shape->positions.push_back(y);
+    shape->positions.push_back(z);
+}
+
+static void shape_add_face(ObjData::Shape* shape, int a, int b, int c)
+{
+    shape->indices.push_back(a);
+    shape->indices.push_back(b);
+    shape->indices.push_back(c);
+}
+
+static void shape_update_bounds(ObjData::Shape* shape)
+{
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        shape->min_positions[axis] = FLT_MAX;
+        shape->max_positions[axis] = -FLT_MAX;
+    }
+    for (size_t pi = 0; pi < shape->positions.size(); pi += 3)
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            shape->min_positions[axis] = fminf(shape->min_positions[axis], shape->positions[pi + axis]);
+            shape->max_positions[axis] = fmaxf(shape->max_positions[axis], shape->positions[pi + axis]);
+        }
+    }
+}
+
+// closed uv sphere of radius 1
+static void shape_make_sphere(ObjData::Shape* shape, int rings, int segments)
+{
+    const float pi = 3.14159265f;
+    for (int ri = 0; ri <= rings; ++ri)
+    {
+        float theta = pi * ri / rings;
+        for (int si = 0; si < segments; ++si)
+        {
+            float phi = 2.f * pi * si / segments;
+            shape_add_vertex(shape, sinf(theta) * cosf(phi), sinf(theta) * sinf(phi), cosf(theta));
+        }
+    }
+
+    for (int ri = 0; ri < rings; ++ri)
+    {
+        for (int si = 0; si < segments; ++si)
+        {
+            int a = ri * segments + si;
+            int b = ri * segments + (si + 1) % segments;
+            int c = a + segments;
+            int d = b + segments;
+            if (ri > 0)
+                shape_add_face(shape, a, b, c);
+            if (ri < rings - 1)
+                shape_add_face(shape, b, d, c);
+        }
+    }
+}
+
+// random triangles of every size in the unit cube, overlapping
+static void shape_make_soup(ObjData::Shape* shape, int count)
+{
+    for (int fi = 0; fi < count; ++fi)
+    {
+        float size = 0.01f + 0.3f * test_random() * test_random();
+        float cx = test_random();
+        float cy = test_random();
+        float cz = test_random();
+        for (int vi = 0; vi < 3; ++vi)
+        {
+            shape_add_vertex(shape, cx + size * (test_random() - 0.5f), cy + size * (test_random() - 0.5f), cz + size * (test_random() - 0.5f));
+        }
+        shape_add_face(shape, fi * 3, fi * 3 + 1, fi * 3 + 2);
+    }
+}
+
+// parallel unit squares at x = -0.9^i. Each sah split takes the first slice alone, the tree would be count deep.
+static void shape_make_slices(ObjData::Shape* shape, int count)
+{
+    for (int fi = 0; fi < count; ++fi)
+    {
+        float x = -powf(0.9f, (float)fi);
+        shape_add_vertex(shape, x, 0.f, 0.f);
+        shape_add_vertex(shape, x, 1.f, 0.f);
+        shape_add_vertex(shape, x, 0.f, 1.f);
+        shape_add_face(shape, fi * 3, fi * 3 + 1, fi * 3 + 2);
+    }
+}
+
+static Vector3 shape_get_vertex(const ObjData::Shape* shape, int face_index, int vertex)
+{
+    return vector3_setp(&(shape->positions[shape->indices[face_index * 3 + vertex] * 3]));
+}
+
+static void check_queries(ObjData::Shape* shape, const char* mesh_name, const char* config_name)
+{
+    int face_count = (int)shape->indices.size() / 3;
+    std::vector<std::pair<float, int>> distances(face_count);
+
+    for (int qi = 0; qi < TEST_QUERY_COUNT; ++qi)
+    {
+        // around the bounds, with a margin
+        Vector3 p;
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            float extent = shape->max_positions[axis] - shape->min_positions[axis];
+            p.v[axis] = shape->min_positions[axis] - 0.2f * extent + 1.4f * extent * test_random();
+        }
+
+        for (int fi = 0; fi < face_count; ++fi)
+        {
+            Vector3 point = triangle_closest_point(p, shape_get_vertex(shape, fi, 0), shape_get_vertex(shape, fi, 1), shape_get_vertex(shape, fi, 2));
+            distances[fi] = std::make_pair(vector3_distance_sq(point, p), fi);
+        }
+        std::sort(distances.begin(), distances.end());
+
+        // nearest, through the binary and the wide tree
+        float squared_distance;
+        Vector3 closest_point;
+        TriangleFeature feature;
+        int face_index = bvh_query_nearest(shape, p, FLT_MAX, &squared_distance, &closest_point, &feature);
+        if (face_index < 0 || test_near(squared_distance, distances[0].first) == false)
+            test_fail(mesh_name, config_name, "nearest", qi);
+
+        minimum_squared_distance(shape, p, &squared_distance, &closest_point, &face_index, &feature);
+        if (face_index < 0 || test_near(squared_distance, distances[0].first) == false)
+            test_fail(mesh_name, config_name, "minimum_squared_distance", qi);
+
+        // the closest face is found within a bound just above its distance, and nothing below it
+        float max_distance = sqrtf(distances[0].first) * 1.01f + 1e-4f;
+        bool is_found = minimum_squared_distance_within(shape, p, max_distance, &squared_distance, &closest_point, &face_index, &feature);
+        if (is_found == false || test_near(squared_distance, distances[0].first) == false)
+            test_fail(mesh_name, config_name, "minimum_squared_distance_within", qi);
+        if (minimum_squared_distance_within(shape, p, sqrtf(distances[0].first) * 0.5f, &squared_distance, &closest_point, &face_index, &feature))
+            test_fail(mesh_name, config_name, "minimum_squared_distance_within empty", qi);
+
+        int k_face_indices[8];
+        float k_squared_distances[8];
+        int k = std::min(8, face_count);
+        int k_count = bvh_query_k_nearest(shape, p, 8, FLT_MAX, k_face_indices, k_squared_distances);
+        if (k_count != k)
+            test_fail(mesh_name, config_name, "k nearest count", qi);
+        for (int ki = 0; ki < k_count && ki < k; ++ki)
+        {
+            if (k_squared_distances[ki] != distances[ki].first)
+            {
+                test_fail(mesh_name, config_name, "k nearest", qi);
+                break;
+            }
+        }
+
+        // the sphere and the brute force use the same closest point, the counts are exact
+        float radius = sqrtf(distances[std::min(5, face_count - 1)].first) * 1.0001f;
+        int sphere_count = 0;
+        bvh_query_sphere(shape, p, radius, [&](int) { ++sphere_count; });
+        int brute_sphere_count = 0;
+        for (int fi = 0; fi < face_count; ++fi)
+        {
+            if (distances[fi].first <= radius * radius)
+                ++brute_sphere_count;
+        }
+        if (sphere_count != brute_sphere_count)
+            test_fail(mesh_name, config_name, "sphere", qi);
+
+        AABB box;
+        box.min_p = vector3_sub(p, vector3_set1(0.1f));
+        box.max_p = vector3_add(p, vector3_set1(0.1f));
+        int box_count = 0;
+        bvh_query_aabb(shape, box, [&](int) { ++box_count; });
+        int brute_box_count = 0;
+        for (int fi = 0; fi < face_count; ++fi)
+        {
+            Vector3 a = shape_get_vertex(shape, fi, 0);
+            Vector3 b = shape_get_vertex(shape, fi, 1);
+            Vector3 c = shape_get_vertex(shape, fi, 2);
+            AABB triangle_box;
+            aabb_set_min_max(&triangle_box, a.v[0], a.v[1], a.v[2]);
+            aabb_combine_float(&triangle_box, b.v);
+            aabb_combine_float(&triangle_box, c.v);
+            if (aabb_intersect_aabb(&box, &triangle_box))
+                ++brute_box_count;
+        }
+        if (box_count != brute_box_count)
+            test_fail(mesh_name, config_name, "aabb", qi);
+
+        Vector3 dir = vector3_normalize(vector3_set3(test_random() - 0.5f, test_random() - 0.5f, test_random() - 0.5f));
+        float t;
+        int ray_face_index = bvh_query_ray(shape, p, dir, FLT_MAX, &t);
+        float brute_t = FLT_MAX;
+        int brute_face_index = -1;
+        for (int fi = 0; fi < face_count; ++fi)
+        {
+            TriangleRayIntersect param;
+            param.a = shape_get_vertex(shape, fi, 0);
+            param.b = shape_get_vertex(shape, fi, 1);
+            param.c = shape_get_vertex(shape, fi, 2);
+            param.ray_origin = p;
+            param.ray_dir = dir;
+            if (triangle_intersect_ray(param) && param.out_t >= 0.f && param.out_t < brute_t)
+            {
+                brute_t = param.out_t;
+                brute_face_index = fi;
+            }
+        }
+        if ((ray_face_index < 0) != (brute_face_index < 0) || (ray_face_index >= 0 && t != brute_t))
+            test_fail(mesh_name, config_name, "ray", qi);
+    }
+}
+
+int main()
+{
+    const char* mesh_names[] = { "sphere", "soup", "slices" };
+    const char* builder_names[] = { "median", "sah", "lbvh" };
+
+    for (int mi = 0; mi < 3; ++mi)
+    {
+        ObjData::Shape shape;
+        if (mi == 0)
+            shape_make_sphere(&shape, 24, 32);
+        else if (mi == 1)
+            shape_make_soup(&shape, 1500);
+        else
+            shape_make_slices(&shape, 300);
+        shape_update_bounds(&shape);
+
+        for (int bi = 0; bi < 3; ++bi)
+        {
+            for (int ci = 0; ci < 4; ++ci)
+            {
+                ObjLoadConfig config;
+                config.bvh_builder = (BVHBuilder)bi;
+                config.bvh_rotations = ci == 1;
+                config.bvh_leaf_size = ci == 2 ? 1 : 4;
+                config.triangle_table = ci == 2;
+                config.bvh_quantize = ci == 3;
+                shape_init(&shape, config);
+
+                char config_name[64];
+                snprintf(config_name, sizeof(config_name), "%s%s%s%s", builder_names[bi], ci == 1 ? " rotations" : "", ci == 2 ? " leaf 1 table" : "", ci == 3 ? " quantized" : "");
+                if (shape.bvh_max_depth >= BVH_TRAVERSE_STACK_SIZE)
+                    test_fail(mesh_names[mi], config_name, "depth", 0);
+
+                check_queries(&shape, mesh_names[mi], config_name);
+            }
+        }
+    }
+
+    // a shape without faces has no tree, and no closest face
+    ObjData::Shape empty_shape;
+    shape_add_vertex(&empty_shape, 0.f, 0.f, 0.f);
+    shape_update_bounds(&empty_shape);
+    shape_init(&empty_shape, ObjLoadConfig());
+    float squared_distance;
+    Vector3 closest_point;
+    int face_index;
+    TriangleFeature feature;
+    if (minimum_squared_distance_within(&empty_shape, vector3_set1(1.f), FLT_MAX, &squared_distance, &closest_point, &face_index, &feature) || face_index >= 0)
+        test_fail("empty", "median", "minimum_squared_distance_within", 0);
+
+    if (test_error_count > 0)
+    {
+        printf("%d failures\n", test_error_count);
+        return 1;
+    }
+
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,121 @@
+// sign of the narrow band bakes with SIGN_METHOD_WINDING_NUMBER on a mesh with a hole : a unit sphere without
+// its cap above z = 0.5. The samples well inside have to be negative and the ones well outside positive, in the
+// band as in the far field, for both far field modes.
+
+#include <stdio.h>
+#include <math.h>
+
+#include "sdf_obj.h"
+
+#define TEST_MESH_PATH "test_far_field_sign.obj"
+
+static bool write_open_sphere(const char* path, int rings, int segments)
+{
+    FILE* fp = fopen(path, "w");
+    if (fp == NULL)
+        return false;
+
+    const float pi = 3.14159265f;
+    for (int ri = 0; ri <= rings; ++ri)
+    {
+        float theta = pi * ri / rings;
+        for (int si = 0; si < segments; ++si)
+        {
+            float phi = 2.f * pi * si / segments;
+            fprintf(fp, "v %f %f %f\n", sinf(theta) * cosf(phi), sinf(theta) * sinf(phi), cosf(theta));
+        }
+    }
+
+    // ring ri is at z = cos(pi * ri / rings), the faces of the rings above z = 0.5 are left out.
+    // Counter clockwise seen from outside, the winding number is 1 inside.
+    for (int ri = 0; ri < rings; ++ri)
+    {
+        if (cosf(pi * ri / rings) > 0.5f)
+            continue;
+
+        for (int si = 0; si < segments; ++si)
+        {
+            int a = ri * segments + si + 1;
+            int b = ri * segments + (si + 1) % segments + 1;
+            int c = a + segments;
+            int d = b + segments;
+            fprintf(fp, "f %d %d %d\n", a, c, b);
+            if (ri < rings - 1)
+                fprintf(fp, "f %d %d %d\n", b, c, d);
+        }
+    }
+
+    fclose(fp);
+    return true;
+}
+
+// below the equator, away from the hole, the samples within 0.7 of the center are inside and the ones beyond 1.3 outside
+static int count_wrong_signs(const Grid* grid, int* out_checked_count)
+{
+    int wrong_count = 0;
+    *out_checked_count = 0;
+    for (int k = 0; k < grid->nz; ++k)
+    {
+        for (int j = 0; j < grid->ny; ++j)
+        {
+            for (int i = 0; i < grid->nx; ++i)
+            {
+                float x = grid->min_pos[0] + grid->delta * i;
+                float y = grid->min_pos[1] + grid->delta * j;
+                float z = grid->min_pos[2] + grid->delta * k;
+                float r = sqrtf(x * x + y * y + z * z);
+                float sdf = grid_get_sdf(grid, i, j, k);
+                if (z > 0.f)
+                    continue;
+
+                if (r < 0.7f)
+                {
+                    ++(*out_checked_count);
+                    wrong_count += sdf < 0.f ? 0 : 1;
+                }
+                else if (r > 1.3f)
+                {
+                    ++(*out_checked_count);
+                    wrong_count += sdf > 0.f ? 0 : 1;
+                }
+            }
+        }
+    }
+    return wrong_count;
+}
+
+int main()
+{
+    if (write_open_sphere(TEST_MESH_PATH, 24, 32) == false)
+    {
+        printf("FAIL can't write %s\n", TEST_MESH_PATH);
+        return 1;
+    }
+
+    const int narrow_bands[] = { 0, 3, 3 };
+    const SDFFarField far_fields[] = { SDF_FAR_FIELD_CLAMP, SDF_FAR_FIELD_CLAMP, SDF_FAR_FIELD_FAST_SWEEPING };
+    const char* names[] = { "dense", "band 3 clamp", "band 3 sweep" };
+
+    int error_count = 0;
+    for (int ti = 0; ti < 3; ++ti)
+    {
+        SDFBakeConfig config;
+        config.grid_delta = 0.05f;
+        config.grid_padding = 8;
+        config.narrow_band = narrow_bands[ti];
+        config.far_field = far_fields[ti];
+        config.sign_method = SIGN_METHOD_WINDING_NUMBER;
+
+        SDFObjData* sod = sdf_obj_load(TEST_MESH_PATH, config);
+        int checked_count;
+        int wrong_count = count_wrong_signs(&(sod->grids[0]), &checked_count);
+        sdf_obj_unload(sod);
+
+        printf("%s : %d wrong signs out of %d samples\n", names[ti], wrong_count, checked_count);
+        if (wrong_count > 0 || checked_count == 0)
+            ++error_count;
+    }
+
+    remove(TEST_MESH_PATH);
+    return error_count > 0 ? 1 : 0;
+}
@@ -0,0 +1,291 @@
+// stress test of the scheduler of common.h : many tiny jobs, nested fork/join, parallel_for coverage,
+// task graph order and cancellation, repeated so a lost wake up shows as a hang (ctest has a timeout).
+// Build it with -fsanitize=thread to check the lock-free deques and queue for races.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+#if defined(__linux__)
+#include <dirent.h>
+#endif
+
+#include "common.h"
+
+#define TEST_ROUND_COUNT 300
+#define TEST_TINY_JOB_COUNT 100000
+#define TEST_NESTED_OUTER_COUNT 6
+#define TEST_NESTED_INNER_COUNT 50
+#define TEST_FIB_N 16
+
+static int test_error_count = 0;
+
+static void test_check(bool condition, const char* name, int round)
+{
+    if (condition)
+        return;
+
+    if (test_error_count < 10)
+        printf("FAIL %s, round %d\n", name, round);
+    ++test_error_count;
+}
+
+static std::atomic<int64_t> tiny_total(0);
+
+static void tiny_job(void* argument)
+{
+    tiny_total += (int64_t)(intptr_t)argument;
+}
+
+static void batch_job(void* argument)
+{
+    tiny_total += *(int*)argument;
+}
+
+// more jobs than a deque holds, so the injection queue takes the rest
+static void test_tiny_jobs(int round)
+{
+    tiny_total = 0;
+    {
+        ThreadPool tp(8);
+        for (int ji = 0; ji < TEST_TINY_JOB_COUNT; ++ji)
+        {
+            tp.EnqueueJob(tiny_job, (void*)(intptr_t)1);
+        }
+        tp.Join(ThreadPool::SHUTDOWN_GRACEFULLY);
+    }
+    test_check(tiny_total == TEST_TINY_JOB_COUNT, "tiny jobs", round);
+
+    std::vector<int> values(TEST_TINY_JOB_COUNT, 2);
+    tiny_total = 0;
+    {
+        ThreadPool tp(8);
+        tp.EnqueueJobs(batch_job, values.data(), sizeof(int), values.size());
+        tp.Join(ThreadPool::SHUTDOWN_GRACEFULLY);
+    }
+    test_check(tiny_total == 2 * TEST_TINY_JOB_COUNT, "batch jobs", round);
+}
+
+static std::atomic<int64_t> nested_total(0);
+
+static void nested_inner_work(void*, size_t begin, size_t end)
+{
+    nested_total += (int64_t)(end - begin);
+}
+
+static void nested_outer_job(void*)
+{
+    for (int ri = 0; ri < TEST_NESTED_INNER_COUNT; ++ri)
+    {
+        parallel_for(0, 1000, 3, 4, nested_inner_work, NULL);
+    }
+}
+
+#if defined(__linux__)
+static int get_process_thread_count()
+{
+    DIR* dir = opendir("/proc/self/task");
+    if (dir == NULL)
+        return -1;
+
+    int count = 0;
+    while (readdir(dir) != NULL)
+    {
+        ++count;
+    }
+    closedir(dir);
+    return count - 2; // . and ..
+}
+#endif
+
+// parallel_for inside the jobs of a pool. The waits run the other jobs, so no thread is created for them.
+static void test_nested(int round)
+{
+    nested_total = 0;
+    ThreadPool tp(4);
+    for (int ji = 0; ji < TEST_NESTED_OUTER_COUNT; ++ji)
+    {
+        tp.EnqueueJob(nested_outer_job, NULL);
+    }
+    tp.Join(ThreadPool::SHUTDOWN_GRACEFULLY);
+    test_check(nested_total == (int64_t)TEST_NESTED_OUTER_COUNT * TEST_NESTED_INNER_COUNT * 1000, "nested parallel_for", round);
+
+#if defined(__linux__)
+    // the workers are created by the first round, the next ones don't add any
+    static int first_thread_count = -1;
+    int thread_count = get_process_thread_count();
+    if (first_thread_count < 0)
+        first_thread_count = thread_count;
+    test_check(thread_count <= first_thread_count, "nested parallel_for thread count", round);
+#endif
+}
+
+struct Fib
+{
+    int n;
+    int64_t result;
+};
+
+// a pool per call, each job waits for its two children
+static void fib_job(void* argument)
+{
+    Fib* fib = (Fib*)argument;
+    if (fib->n < 2)
+    {
+        fib->result = fib->n;
+        return;
+    }
+
+    Fib a = { fib->n - 1, 0 };
+    Fib b = { fib->n - 2, 0 };
+    ThreadPool tp(8);
+    tp.EnqueueJob(fib_job, &a);
+    tp.EnqueueJob(fib_job, &b);
+    tp.Join(ThreadPool::SHUTDOWN_GRACEFULLY);
+    fib->result = a.result + b.result;
+}
+
+static void test_fib(int round)
+{
+    Fib fib = { TEST_FIB_N, 0 };
+    fib_job(&fib);
+    test_check(fib.result == 987, "recursive fork/join", round);
+}
+
+struct CoverageWork
+{
+    std::atomic<int>* visits;
+    size_t begin;
+    size_t end;
+    std::atomic<int> bad_chunk_count;
+};
+
+static void coverage_work(void* param, size_t begin, size_t end)
+{
+    CoverageWork& work = *(CoverageWork*)param;
+    if (begin >= end || begin < work.begin || end > work.end)
+        ++work.bad_chunk_count;
+
+    for (size_t i = begin; i < end && i < work.end; ++i)
+    {
+        ++work.visits[i];
+    }
+}
+
+// every index once, for ranges smaller and larger than the chunks
+static void test_parallel_for_coverage(int round)
+{
+    const size_t ranges[][3] = { { 0, 0, 1 }, { 5, 6, 1 }, { 3, 100, 7 }, { 0, 10000, 1 }, { 17, 50000, 64 }, { 0, 1000, 5000 } };
+    for (size_t ri = 0; ri < sizeof(ranges) / sizeof(ranges[0]); ++ri)
+    {
+        std::vector<std::atomic<int>> visits(ranges[ri][1]);
+        for (size_t i = 0; i < visits.size(); ++i)
+        {
+            visits[i] = 0;
+        }
+
+        CoverageWork work;
+        work.visits = visits.data();
+        work.begin = ranges[ri][0];
+        work.end = ranges[ri][1];
+        work.bad_chunk_count = 0;
+        parallel_for(ranges[ri][0], ranges[ri][1], ranges[ri][2], 0, coverage_work, &work);
+
+        bool is_covered = work.bad_chunk_count == 0;
+        for (size_t i = 0; i < visits.size(); ++i)
+        {
+            is_covered = is_covered && visits[i] == (i >= ranges[ri][0] ? 1 : 0);
+        }
+        test_check(is_covered, "parallel_for coverage", round);
+    }
+}
+
+struct GraphStamp
+{
+    std::atomic<int>* clock;
+    int start;
+    int end;
+};
+
+static void graph_job(void* argument)
+{
+    GraphStamp* stamp = (GraphStamp*)argument;
+    stamp->start = (*stamp->clock)++;
+    stamp->end = (*stamp->clock)++;
+}
+
+// chains of 3 nodes joined by a last node, a node starts after the end of every node before it
+static void test_task_graph(int round)
+{
+    const int chain_count = 16;
+    std::atomic<int> clock(0);
+    std::vector<GraphStamp> stamps(chain_count * 3 + 1);
+    TaskGraph graph;
+    for (size_t si = 0; si < stamps.size(); ++si)
+    {
+        stamps[si].clock = &clock;
+        task_graph_add(&graph, graph_job, &(stamps[si]));
+    }
+
+    int last = chain_count * 3;
+    for (int ci = 0; ci < chain_count; ++ci)
+    {
+        task_graph_add_dependency(&graph, ci * 3, ci * 3 + 1);
+        task_graph_add_dependency(&graph, ci * 3 + 1, ci * 3 + 2);
+        task_graph_add_dependency(&graph, ci * 3 + 2, last);
+    }
+
+    // a graph can run twice
+    for (int ri = 0; ri < 2; ++ri)
+    {
+        clock = 0;
+        task_graph_run(&graph, 0);
+
+        bool is_ordered = clock == (int)stamps.size() * 2;
+        for (int ci = 0; ci < chain_count; ++ci)
+        {
+            is_ordered = is_ordered && stamps[ci * 3].end < stamps[ci * 3 + 1].start;
+            is_ordered = is_ordered && stamps[ci * 3 + 1].end < stamps[ci * 3 + 2].start;
+            is_ordered = is_ordered && stamps[ci * 3 + 2].end < stamps[last].start;
+        }
+        test_check(is_ordered, "task graph order", round);
+    }
+}
+
+// the jobs that haven't started are dropped, the others finish before the join returns
+static void test_cancel(int round)
+{
+    tiny_total = 0;
+    {
+        ThreadPool tp(8);
+        for (int ji = 0; ji < TEST_TINY_JOB_COUNT; ++ji)
+        {
+            tp.EnqueueJob(tiny_job, (void*)(intptr_t)1);
+        }
+        tp.Join(ThreadPool::SHUTDOWN_IMMEDIATE);
+    }
+    test_check(tiny_total >= 0 && tiny_total <= TEST_TINY_JOB_COUNT, "cancel", round);
+}
+
+int main()
+{
+    for (int round = 0; round < TEST_ROUND_COUNT; ++round)
+    {
+        test_tiny_jobs(round);
+        test_nested(round);
+        test_fib(round);
+        test_parallel_for_coverage(round);
+        test_task_graph(round);
+        test_cancel(round);
+    }
+
+    if (test_error_count > 0)
+    {
+        printf("%d failures\n", test_error_count);
+        return 1;
+    }
+
+    printf("ok\n");
+    return 0;
+}